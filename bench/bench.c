@@ -0,0 +1,513 @@
+// Benchmarks
+
+// Generates synthetic .ini file corpora of different shapes, parses them with
+// `eini()` and `eini_parse()`, and reports throughput (lines/sec and MB/sec),
+// the number of memory allocations, and peak RSS. Each benchmark runs in a
+// separate child process, so that its allocations and RSS are its own. Errors
+// found while parsing make the benchmark fail, since its results would only
+// cover part of the corpus.
+//
+// Usage: `eini_bench [-s scale] [-r repeat] [-o save_file] [-b baseline_file]
+// [-t threshold]`
+//
+// `-o` saves the results to a file, which can later be passed to `-b`. When
+// comparing against a baseline, benchmarks that became more than `threshold`
+// percent slower (default 10), or that allocate more memory blocks than
+// before, are reported as regressions.
+//
+// Exit codes:
+//           0: no regressions
+//           n: n regressions were found
+//          -1: invalid arguments or I/O error
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "eini.h"
+
+//
+// Types
+//
+
+// A corpus of .ini files
+typedef struct {
+  const char *name;                             // name
+  void (*gen)(const char *dir, unsigned scale); // generator function
+  bool many;                                    // true if each file is a root
+} corpus_t;
+
+// Result of a benchmark
+typedef struct {
+  char name[EINI_SHORT]; // benchmark name (`<corpus>/<function>`)
+  double lps;            // lines per second
+  double mbps;           // megabytes per second
+  unsigned long allocs;  // number of memory allocations
+  long rss;              // peak RSS (in KiB)
+} result_t;
+
+//
+// Constants
+//
+
+// Number of files in the deep include chain (which is deeper than
+// `EINI_MAX_DEPTH`, so the limit is raised to match)
+#define DEEP_FILES 200
+
+//
+// Global variables
+//
+
+unsigned long bench_allocs; // number of memory allocations made so far
+
+//
+// Memory allocation counting (glibc only)
+//
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  bench_allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  bench_allocs++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  bench_allocs++;
+  return __libc_realloc(ptr, size);
+}
+#endif
+
+//
+// Corpus generators
+//
+
+// Helper of the corpus generators. Open file `name` in `dir` for writing.
+FILE *gen_open(const char *dir, const char *name) {
+  char path[EINI_LONG]; // file path
+  FILE *fp;             // return value
+
+  snprintf(path, EINI_LONG, "%s/%s", dir, name);
+  fp = fopen(path, "w");
+  if (NULL == fp) {
+    perror(path);
+    exit(-1);
+  }
+
+  return fp;
+}
+
+// Many small files
+void gen_small(const char *dir, unsigned scale) {
+  char name[EINI_SHORT]; // file name
+
+  for (unsigned f = 0; f < 2000 * scale; f++) {
+    snprintf(name, EINI_SHORT, "small%05u.ini", f);
+    FILE *fp = gen_open(dir, name);
+    fprintf(fp, "; Small file #%u\n\n[main]\n", f);
+    for (unsigned i = 0; i < 10; i++)
+      fprintf(fp, "key%u = value %u\n", i, f + i);
+    fclose(fp);
+  }
+}
+
+// One huge file
+void gen_huge(const char *dir, unsigned scale) {
+  FILE *fp = gen_open(dir, "huge.ini");
+
+  for (unsigned i = 0; i < 500000 * scale; i++) {
+    if (0 == i % 100)
+      fprintf(fp, "\n[section_%u]\n", i / 100);
+    switch (i % 4) {
+    case 0:
+      fprintf(fp, "key_%u=%u\n", i, i);
+      break;
+    case 1:
+      fprintf(fp, "  key_%u = 'quoted value %u'\n", i, i);
+      break;
+    case 2:
+      fprintf(fp, "key_%u = \"double quoted value %u\" ; comment\n", i, i);
+      break;
+    default:
+      fprintf(fp, "key_%u = /usr/share/eini/%u.conf\n", i, i);
+      break;
+    }
+  }
+
+  fclose(fp);
+}
+
+// Deep include chain
+void gen_deep(const char *dir, unsigned scale) {
+  char name[EINI_SHORT]; // file name
+
+  for (unsigned f = 0; f < DEEP_FILES; f++) {
+    snprintf(name, EINI_SHORT, "%s%03u.ini", 0 == f ? "deep" : "link", f);
+    FILE *fp = gen_open(dir, name);
+    fprintf(fp, "[level_%u]\n", f);
+    for (unsigned i = 0; i < 500 * scale; i++)
+      fprintf(fp, "key%u = value %u\n", i, i);
+    if (f < DEEP_FILES - 1)
+      fprintf(fp, "include link%03u.ini\n", f + 1);
+    fclose(fp);
+  }
+}
+
+// Long quoted values with escape sequences
+void gen_escaped(const char *dir, unsigned scale) {
+  FILE *fp = gen_open(dir, "escaped.ini");
+  const char *esc[] = {"\\t", "\\\"", "\\\\", "\\n", "\\'"}; // escapes
+
+  fprintf(fp, "[escaped]\n");
+  for (unsigned i = 0; i < 20000 * scale; i++) {
+    fprintf(fp, "key%u = \"", i);
+    for (unsigned j = 0; j < 50; j++)
+      fprintf(fp, "abcdefgh%s", esc[(i + j) % 5]);
+    fprintf(fp, "\"\n");
+  }
+
+  fclose(fp);
+}
+
+// Comment-heavy file
+void gen_comments(const char *dir, unsigned scale) {
+  FILE *fp = gen_open(dir, "comments.ini");
+
+  fprintf(fp, "[comments]\n");
+  for (unsigned i = 0; i < 500000 * scale; i++) {
+    if (0 == i % 10)
+      fprintf(fp, "key%u = value %u ; trailing comment\n", i, i);
+    else if (0 == i % 3)
+      fprintf(fp, "    ; indented comment number %u\n", i);
+    else
+      fprintf(fp, "; comment number %u, which is a bit longer than usual\n",
+              i);
+  }
+
+  fclose(fp);
+}
+
+// All corpora
+const corpus_t corpora[] = {{"small", gen_small, true},
+                            {"huge", gen_huge, false},
+                            {"deep", gen_deep, false},
+                            {"escaped", gen_escaped, false},
+                            {"comments", gen_comments, false}};
+
+//
+// Helper functions
+//
+
+// Return the current time, in seconds
+double now() {
+  struct timespec ts; // current time
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Handler function for `eini()`
+void bench_handler(const wchar_t *section, const wchar_t *key,
+                   const wchar_t *value, const char *path,
+                   const unsigned line) {}
+
+// Error function for `eini()`. Give up on the benchmark.
+void bench_error(const wchar_t *error, const char *path, const unsigned line) {
+  fprintf(stderr, "%s:%u -- %ls\n", path, line, error);
+  exit(-1);
+}
+
+// Return the sorted list of files in `dir`, and store its length in `n`
+char **list_files(const char *dir, unsigned *n) {
+  struct dirent **ents; // directory entries
+  char **ret;           // return value
+  int cnt = scandir(dir, &ents, NULL, alphasort);
+
+  if (cnt < 0) {
+    perror(dir);
+    exit(-1);
+  }
+
+  ret = calloc(cnt, sizeof(char *));
+  *n = 0;
+  for (int i = 0; i < cnt; i++) {
+    if ('.' != ents[i]->d_name[0]) {
+      ret[*n] = malloc(strlen(dir) + strlen(ents[i]->d_name) + 2);
+      sprintf(ret[*n], "%s/%s", dir, ents[i]->d_name);
+      (*n)++;
+    }
+    free(ents[i]);
+  }
+  free(ents);
+
+  return ret;
+}
+
+// Read all of the file in `path` into memory, store its size in `size`, and
+// return its contents
+char *slurp(const char *path, size_t *size) {
+  FILE *fp = fopen(path, "r"); // file pointer
+  struct stat st;              // file status
+  char *ret;                   // return value
+
+  if (NULL == fp || 0 != fstat(fileno(fp), &st)) {
+    perror(path);
+    exit(-1);
+  }
+  ret = malloc(st.st_size + 1);
+  *size = fread(ret, 1, st.st_size, fp);
+  ret[*size] = '\0';
+  fclose(fp);
+
+  return ret;
+}
+
+// Benchmark body, run by a child process. Parse the files of corpus `c` in
+// `dir` (whose total size is `bytes`, in `lines` lines) `repeat` times, using
+// `eini()` (through a context of its own, as deep as the deepest corpus) or
+// (if `lines_api` is true) `eini_parse()`, and store the results in `res`.
+void run(const corpus_t *c, const char *dir, bool lines_api, unsigned repeat,
+         result_t *res) {
+  unsigned n;                              // number of files
+  char **files = list_files(dir, &n);      // the files
+  char **bufs = calloc(n, sizeof(char *)); // file contents (`eini_parse()`)
+  char **ends = calloc(n, sizeof(char *)); // ends of `bufs`
+  size_t bytes = 0, lines = 0;             // corpus size
+  double best = 0;                         // best time
+  struct rusage ru;                        // resource usage
+  eini_ctx_t *ctx;                         // context for `eini()`
+
+  for (unsigned f = 0; f < n; f++) {
+    size_t size; // file size
+    bufs[f] = slurp(files[f], &size);
+    ends[f] = &bufs[f][size];
+    bytes += size;
+    for (size_t i = 0; i < size; i++)
+      if ('\n' == bufs[f][i]) {
+        lines++;
+        bufs[f][i] = '\0';
+      }
+    if (!lines_api) {
+      free(bufs[f]);
+      bufs[f] = NULL;
+    }
+  }
+
+  eini_init();
+  ctx = eini_ctx_new();
+  eini_ctx_handlers(ctx, bench_handler, bench_error);
+  eini_ctx_max_depth(ctx, DEEP_FILES);
+  for (unsigned r = 0; r < repeat; r++) {
+    unsigned long allocs = bench_allocs; // allocations before this run
+    double start = now();                // start time
+    double t;                            // time taken
+
+    if (lines_api) {
+      // Parse every line of every file, one at a time
+      for (unsigned f = 0; f < n; f++)
+        for (char *ln = bufs[f]; ln < ends[f]; ln += strlen(ln) + 1)
+          eini_parse(ln);
+    } else {
+      // Parse the root file(s), following includes
+      for (unsigned f = 0; f < n; f++)
+        if (c->many || 0 == f)
+          eini_ctx_file(ctx, files[f]);
+    }
+
+    t = now() - start;
+    if (0 == r || t < best) {
+      best = t;
+      res->allocs = bench_allocs - allocs;
+    }
+  }
+  eini_ctx_free(ctx);
+  eini_winddown();
+
+  getrusage(RUSAGE_SELF, &ru);
+  snprintf(res->name, EINI_SHORT, "%s/%s", c->name,
+           lines_api ? "eini_parse" : "eini");
+  res->lps = lines / best;
+  res->mbps = bytes / best / 1048576;
+  res->rss = ru.ru_maxrss;
+}
+
+// Run the benchmark described by `c`, `dir`, `lines_api`, and `repeat` (see
+// `run()`) in a child process, and store the results in `res`. Return false if
+// the child process failed.
+bool run_child(const corpus_t *c, const char *dir, bool lines_api,
+               unsigned repeat, result_t *res) {
+  int fds[2]; // pipe used to pass the results
+  pid_t pid;  // child process ID
+  int status; // child process exit status
+  bool ret;   // return value
+
+  if (0 != pipe(fds))
+    return false;
+
+  fflush(stdout);
+  pid = fork();
+  if (0 == pid) {
+    close(fds[0]);
+    run(c, dir, lines_api, repeat, res);
+    _exit(sizeof(result_t) == write(fds[1], res, sizeof(result_t)) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  ret = pid > 0 && sizeof(result_t) == read(fds[0], res, sizeof(result_t));
+  close(fds[0]);
+  if (pid > 0)
+    waitpid(pid, &status, 0);
+
+  return ret && WIFEXITED(status) && 0 == WEXITSTATUS(status);
+}
+
+// Look for benchmark `name` in baseline file `fp`, and store its results in
+// `res`. Return false if it wasn't found.
+bool find_baseline(FILE *fp, const char *name, result_t *res) {
+  char ln[EINI_LONG]; // current line
+
+  rewind(fp);
+  while (NULL != fgets(ln, EINI_LONG, fp)) {
+    if (5 == sscanf(ln, "%127s %lf %lf %lu %ld", res->name, &res->lps,
+                    &res->mbps, &res->allocs, &res->rss) &&
+        0 == strcmp(res->name, name))
+      return true;
+  }
+
+  return false;
+}
+
+// Remove directory `dir`, and all files in it
+void remove_dir(const char *dir) {
+  unsigned n;                         // number of files
+  char **files = list_files(dir, &n); // the files
+
+  for (unsigned f = 0; f < n; f++) {
+    unlink(files[f]);
+    free(files[f]);
+  }
+  free(files);
+  rmdir(dir);
+}
+
+//
+// Main function
+//
+
+int main(int argc, char **argv) {
+  unsigned scale = 1;                   // corpus size multiplier
+  unsigned repeat = 3;                  // number of times each benchmark runs
+  double threshold = 10;                // regression threshold (percent)
+  const char *save = NULL;              // file to save the results to
+  FILE *base = NULL;                    // baseline file
+  FILE *out = NULL;                     // `save` file pointer
+  char tmp[] = "/tmp/eini_benchXXXXXX"; // corpora directory
+  char dir[EINI_LONG];                  // directory of the current corpus
+  int regressions = 0;                  // number of regressions
+  int opt;                              // current option
+
+  while (-1 != (opt = getopt(argc, argv, "s:r:o:b:t:"))) {
+    switch (opt) {
+    case 's':
+      scale = atoi(optarg);
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      break;
+    case 'o':
+      save = optarg;
+      break;
+    case 'b':
+      // A missing baseline file is not an error; there's nothing to compare to
+      base = fopen(optarg, "r");
+      if (NULL == base)
+        fprintf(stderr, "No baseline in '%s'\n", optarg);
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [-s scale] [-r repeat] [-o save_file] "
+              "[-b baseline_file] [-t threshold]\n",
+              argv[0]);
+      return -1;
+    }
+  }
+  if (0 == scale || 0 == repeat) {
+    fprintf(stderr, "Scale and repeat must be positive\n");
+    return -1;
+  }
+
+  if (NULL == mkdtemp(tmp)) {
+    perror(tmp);
+    return -1;
+  }
+  if (NULL != save && NULL == (out = fopen(save, "w"))) {
+    perror(save);
+    return -1;
+  }
+
+  printf("%-20s %12s %9s %10s %10s\n", "benchmark", "lines/s", "MB/s",
+         "allocs", "peak RSS");
+  for (unsigned c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+    snprintf(dir, EINI_LONG, "%s/%s", tmp, corpora[c].name);
+    mkdir(dir, 0700);
+    corpora[c].gen(dir, scale);
+
+    for (int lines_api = 0; lines_api < 2; lines_api++) {
+      result_t res, old; // results, and baseline results
+
+      if (!run_child(&corpora[c], dir, lines_api, repeat, &res)) {
+        fprintf(stderr, "%s: benchmark failed\n", corpora[c].name);
+        remove_dir(dir);
+        remove_dir(tmp);
+        return -1;
+      }
+
+      printf("%-20s %12.0f %9.1f %10lu %6ld KiB", res.name, res.lps, res.mbps,
+             res.allocs, res.rss);
+      if (NULL != base && find_baseline(base, res.name, &old)) {
+        double change = 100 * (res.lps - old.lps) / old.lps; // speed change
+        bool slower = -change > threshold;
+        bool more_allocs = res.allocs > old.allocs;
+        printf("  %+6.1f%%%s%s", change, slower ? "  SLOWER" : "",
+               more_allocs ? "  MORE ALLOCS" : "");
+        if (slower || more_allocs)
+          regressions++;
+      }
+      printf("\n");
+      fflush(stdout);
+
+      if (NULL != out)
+        fprintf(out, "%s %.0f %.2f %lu %ld\n", res.name, res.lps, res.mbps,
+                res.allocs, res.rss);
+    }
+
+    remove_dir(dir);
+  }
+  remove_dir(tmp);
+
+  if (NULL != out)
+    fclose(out);
+  if (NULL != base) {
+    fclose(base);
+    printf("%d regression(s)\n", regressions);
+  }
+
+  return regressions;
+}
@@ -0,0 +1 @@
+../src/eini.c
\ No newline at end of file
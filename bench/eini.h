@@ -0,0 +1 @@
+../src/eini.h
\ No newline at end of file
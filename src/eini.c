@@ -1,16 +1,24 @@
 // eINI (implementation)
 
-#include <alloca.h>
 #include <errno.h>
+#include <fcntl.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 #include <libgen.h>
-#include <regex.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <wchar.h>
-#include <wctype.h>
 
 #include "eini.h"
 
@@ -24,294 +32,785 @@ typedef struct {
   unsigned end; // end
 } range_t;
 
+// A growable buffer, reused from one line to the next
+typedef struct {
+  char *ptr;  // contents, or NULL
+  size_t cap; // capacity of `ptr` (in bytes)
+} buf_t;
+
+// Positions of the characters `tokenize()` cares about in a block of
+// `BLOCK_SIZE` characters (bit `i` is set if the `i`th character is one of
+// them)
+typedef struct {
+  uint64_t semi;   // `;`
+  uint64_t dquote; // `"`
+  uint64_t squote; // `'`
+  uint64_t bslash; // `\`
+} masks_t;
+
+// Kind of handler functions set in a parser context
+typedef enum {
+  HANDLERS_WIDE,  // `eini_handler_t` and `eini_error_t`
+  HANDLERS_UTF8,  // `eini_handler_utf8_t` and `eini_error_utf8_t`
+  HANDLERS_SPAN,  // `eini_handler_span_t` and `eini_error_utf8_t`
+  HANDLERS_BATCH, // `eini_handler_batch_t` and `eini_error_utf8_t`
+  HANDLERS_SCHEMA // `eini_handler_schema_t` and `eini_error_utf8_t`
+} handlers_t;
+
+// Parsed contents of a line in a .ini file, as spans into the line itself (or
+// into static/context storage, for error messages). `value` has not been
+// unescaped yet.
+typedef struct {
+  eini_type_t type;  // line type
+  eini_span_t key;   // key name (or `{NULL, 0}`)
+  eini_span_t value; // error message, include path, section name, or value (or
+                     // `{NULL, 0}`)
+  bool escaped;      // true if `value` might contain escape sequences
+} line_t;
+
+// What `tokenize()` finds in a line (all positions are relative to the
+// beginning of the line, and 0 means none)
+typedef struct {
+  size_t len;   // length of the line, minus any comment
+  size_t quote; // position just after the last unescaped quote
+  size_t bs;    // position just after the last `\` (before any comment)
+} tokens_t;
+
+// Identity of a .ini file: its device and inode number, or its path, if it's
+// read from memory (in which case both numbers are 0)
+typedef struct {
+  dev_t dev;        // device
+  ino_t ino;        // inode number
+  const char *path; // file path
+} file_id_t;
+
+// Key of a record (see `record_t`): the identity of its .ini file, and of the
+// directory the files it includes are found in (through the path it was
+// reached by). Both are 0 if the record is keyed by path.
+typedef struct {
+  file_id_t file; // identity of the .ini file
+  dev_t ddev;     // device of its directory
+  ino_t dino;     // inode number of its directory
+} rec_key_t;
+
+// A .ini file being parsed or replayed (see `frame_t`)
+typedef struct frame frame_t;
+
+// Parsed contents of a .ini file, recorded for later replay (see `record_t`)
+typedef struct record record_t;
+
+// Worker pool used to parse include trees concurrently (see `pool_t`)
+typedef struct pool pool_t;
+
+// Parser context. Holds everything `eini_ctx_parse()` and friends need, so that
+// separate contexts can be used concurrently.
+struct eini_ctx {
+  handlers_t kind;           // which of the handler functions below are used
+  eini_handler_t hf;         // handler function
+  eini_error_t ef;           // error handler function
+  eini_handler_utf8_t hf8;   // UTF-8 handler function
+  eini_handler_span_t hfs;   // span handler function
+  eini_handler_batch_t hfb;  // batch handler function
+  eini_handler_schema_t hfk; // schema handler function
+  eini_schema_t *schema;     // schema used by `hfk()`
+  eini_error_utf8_t ef8;     // UTF-8 error handler function (used together
+                             // with `hf8`, `hfs`, `hfb`, or `hfk`)
+  void *data;                // user data passed to `hf8()`, `hfs()`, `hfb()`,
+                             // `hfk()`, `ef8()`
+  eini_batch_entry_t *batch; // key/value pairs not yet passed to `hfb()`
+  unsigned nbatch;           // number of `batch`
+  unsigned batch_size;       // capacity of `batch`
+  eini_arena_t *batch_arena; // memory for the strings in `batch`
+  eini_span_t *sections;     // section names passed to `hfb()`, by id
+  unsigned nsections;        // number of `sections`
+  unsigned csections;        // capacity of `sections`
+  const char **paths;        // .ini file paths passed to `hfb()`, by id
+  unsigned npaths;           // number of `paths`
+  unsigned cpaths;           // capacity of `paths`
+  eini_arena_t *names;       // memory for `sections` and `paths`
+  eini_resolver_t rf;        // include resolver function
+  void *rdata;               // user data passed to `rf()`
+  bool mmap;                 // true if files are to be memory-mapped
+  eini_arena_t *arena;       // arena for strings, or NULL
+  size_t max_line;           // maximum line length
+  buf_t key;                 // `key` contents of parsed line
+  buf_t value;               // `value` contents of parsed line
+  buf_t errmsg;              // error message
+  buf_t wkey;                // `wchar_t*` version of `key`
+  buf_t wvalue;              // `wchar_t*` version of `value`
+  unsigned threads;          // number of worker threads (0 if none)
+  eini_cache_t *cache;       // cache of records, or NULL
+  record_t *rec;             // record to store results in (instead of passing
+                             // them to the handlers), or NULL
+  pool_t *pool;              // worker pool that `rec` belongs to, or NULL
+  bool include_once;         // true if files are to be parsed only once
+  unsigned max_depth;        // maximum depth of nested includes
+  frame_t *frames;           // stack of files being parsed (outermost first)
+  unsigned nframes;          // number of `frames`
+  unsigned cframes;          // capacity of `frames` (beyond `nframes`, unused
+                             // frames keep their buffers for reuse)
+  file_id_t *seen;           // files parsed so far (hash table, keyed by
+                             // identity, with paths of their own), or NULL
+  unsigned nseen;            // number of `seen`
+  unsigned cseen;            // capacity of `seen` (a power of 2)
+#ifdef EINI_REGEX
+  regex_t *re_include, *re_section, *re_value; // regular expressions in use
+  regex_t re_own[3]; // regular expressions compiled by `eini_ctx_new()`
+#endif
+};
+
+// Something found in a .ini file, recorded for later replay
+typedef struct {
+  eini_type_t type;  // `EINI_SECTION`, `EINI_VALUE`, `EINI_INCLUDE`, or
+                     // `EINI_ERROR`
+  unsigned line;     // .ini file line
+  const char *key;   // key name (`EINI_VALUE`), or included file path, as
+                     // written (`EINI_INCLUDE`)
+  const char *value; // section name, value, included file path, or error
+                     // message
+  record_t *inc;     // included file (`EINI_INCLUDE` only)
+} event_t;
+
+struct record {
+  char *path;          // .ini file path
+  eini_span_t cont;    // .ini file contents (from the resolver), or `nospan`
+  bool resolved;       // true if `cont` is to be used
+  eini_arena_t *arena; // memory for the strings in `events`
+  event_t *events;     // everything found in the .ini file, in order
+  unsigned nevents;    // number of `events`
+  unsigned cevents;    // capacity of `events`
+  bool parsed;         // true if `events` are up to date
+  bool uncacheable;    // true if `events` must not be reused
+  bool missing;        // true if the .ini file couldn't be opened
+  dev_t dev;           // key of the record (see `rec_key_t`)
+  ino_t ino;           // (ditto)
+  dev_t ddev;          // (ditto)
+  ino_t dino;          // (ditto)
+  struct stat st;      // status of the .ini file when it was parsed
+  uint64_t hash;       // hash of the .ini file when it was parsed
+  unsigned gen;        // generation (see `eini_cache`) that last needed it
+  unsigned qgen;       // generation that last queued it to be brought up to
+                       // date
+  unsigned depth;      // least depth it's included at, in generation `gen`
+                       // (the .ini file being 1)
+  bool done;           // true once it's been brought up to date, in
+                       // generation `qgen`
+};
+
+// Records of parsed .ini files, kept from one parse to the next
+struct eini_cache {
+  bool hash;         // true if files are identified by the hash of their
+                     // contents (instead of their status)
+  record_t **recs;   // records (hash table, keyed by `rec_key_t`)
+  unsigned nrecs;    // number of `recs`
+  unsigned crecs;    // capacity of `recs` (a power of 2)
+  unsigned gen;      // generation (incremented every time it's used)
+  bool utf8;         // UTF-8 validation setting the records were parsed with
+  size_t max_line;   // maximum line length the records were parsed with
+};
+
+// Known sections and keys, with perfect hash tables to look them up
+struct eini_schema {
+  eini_arena_t *arena;    // memory for `t`, or NULL if it isn't its own
+  eini_schema_tables_t t; // names and hash tables
+};
+
+struct pool {
+  const eini_ctx_t *ctx; // context that started it all
+  eini_cache_t *cache;   // records
+  pthread_mutex_t lock;  // lock for the fields below (and for `cache`)
+  pthread_cond_t cond;   // signalled when `queue` or `busy` change
+  record_t **queue;      // records waiting to be parsed
+  unsigned nqueue;       // number of `queue`
+  unsigned cqueue;       // capacity of `queue`
+  unsigned busy;         // number of records being parsed
+  record_t **stack;      // records whose depth went down, waiting for the
+                         // files they include to follow (see `relax()`)
+  unsigned nstack;       // number of `stack`
+  unsigned cstack;       // capacity of `stack`
+  bool oom;              // true if memory ran out while queueing records
+};
+
+// An include tree parsed into records, waiting to be replayed (see
+// `tree_parse()`)
+typedef struct {
+  eini_cache_t tmp; // cache to use if the context has none
+  pool_t pool;      // worker pool
+  eini_ctx_t *w;    // worker context for the parsing thread
+  record_t *root;   // record for the .ini file
+} tree_t;
+
+struct eini_async {
+  eini_ctx_t *ctx; // context whose handler functions are called
+  char *path;      // path of the .ini file
+  tree_t tree;     // records
+  bool parsed;     // true if `tree` holds the records (false if out of memory)
+  bool done;       // true once the records have been replayed
+  pthread_t thr;   // thread parsing the .ini file
+  int fds[2];      // pipe, written to by `thr` when it's done
+};
+
+// A block of memory in an arena
+typedef struct arena_block {
+  struct arena_block *next; // next (older) block
+  size_t size;              // size of `mem`
+  size_t used;              // number of bytes of `mem` in use
+  max_align_t mem[];        // memory
+} arena_block_t;
+
+// Arena allocator
+struct eini_arena {
+  arena_block_t *head; // current block (followed by older ones)
+};
+
+// Line reader used by `parse()`. Reads lines from a file either in chunks of
+// `CHUNK_SIZE` bytes (so that pipes and such can be read, using constant
+// memory) or using `mmap()`, or from a memory buffer.
+typedef struct {
+  int fd;          // file descriptor, or -1
+  const char *map; // file contents (`mmap()` or memory buffer), or NULL
+  size_t size;     // size of `map`
+  size_t pos;      // position of the next line in `map` (or in the chunk
+                   // buffer, if there's no `map`)
+  size_t end;      // end of the data in the chunk buffer
+  bool eof;        // true once `fd` has been read up to its end
+  bool mapped;     // true if `map` must be unmapped when done
+  dev_t dev;       // device of the file (0 for memory buffers)
+  ino_t ino;       // inode number of the file (0 for memory buffers)
+} reader_t;
+
+struct frame {
+  file_id_t id;     // identity of the .ini file
+  const char *path; // .ini file path (as passed to the handlers)
+  reader_t rd;      // reader for the .ini file (`parse()` only)
+  record_t *rec;    // record of the .ini file (`replay()` only)
+  unsigned i;       // current line number (`parse()`), or index of the next
+                    // event (`replay()`)
+  eini_span_t ssec; // current section
+  unsigned sid;     // id of `ssec` (batch and schema handler functions only)
+  unsigned pid;     // id of `path` (batch handler functions only)
+  buf_t secbuf;     // buffer for `ssec` (if there's no arena)
+  wchar_t *wsec;    // `wchar_t*` version of `ssec` (`eini()` only)
+  buf_t wsecbuf;    // buffer for `wsec`
+  buf_t ibuf;       // buffer for included file paths
+  buf_t chunk;      // chunk buffer for `rd` (if the file isn't mapped)
+};
+
+//
+// Constants
+//
+
+// Number of bytes read at once from files that aren't mapped
+#define CHUNK_SIZE 65536
+
+// Number of characters `tokenize()` scans at once (one bit each in a
+// `masks_t`)
+#define BLOCK_SIZE 64
+
+// Empty slot of a `eini_phf_t`
+#define PHF_EMPTY EINI_PHF_EMPTY
+
+// Number of seeds `phf_build()` tries before giving up
+#define PHF_SEEDS 64
+
 //
 // Global variables
 //
 
+#ifdef EINI_REGEX
 regex_t eini_re_include, eini_re_section, eini_re_value;
+#endif
+
+// An empty span
+static const eini_span_t nospan = {NULL, 0};
+
+// Default context, used by `eini()`, `eini_parse()`, and friends
+eini_ctx_t eini_ctx_default = {
+    .max_line = EINI_MAX_LINE,
+    .max_depth = EINI_MAX_DEPTH,
+#ifdef EINI_REGEX
+    .re_include = &eini_re_include,
+    .re_section = &eini_re_section,
+    .re_value = &eini_re_value
+#endif
+};
 
 //
 // Helper functions and macros
 //
 
-// Helper of `wsrc_strip` and `eini_parse()`. Set the `type`, `key`, and `value`
-// fields of `ret` to `mytype`, `mykey`, and `myvalue` respectively.
+// Helpers of `eini_parse_utf8()` and friends. Test whether character `c` is
+// whitespace (as in `[[:space:]]`), whether it can begin an identifier (as in
+// `[a-zA-Z]`), and whether it can be part of an identifier (as in
+// `[a-zA-Z0-9_]`).
+#define isws(c) (' ' == (c) || ('\t' <= (c) && '\r' >= (c)))
+#define isidbeg(c) (('a' <= (c) && 'z' >= (c)) || ('A' <= (c) && 'Z' >= (c)))
+#define isidchr(c) (isidbeg(c) || ('0' <= (c) && '9' >= (c)) || '_' == (c))
+
+// Helper of `parse_line()`. Set the `type`, `key`, and `value` fields of `ret`
+// to `mytype`, `mykey`, and `myvalue` respectively.
 #define set_ret(mytype, mykey, myvalue)                                        \
   ret.type = mytype;                                                           \
-  if (NULL == mykey)                                                           \
-    ret.key = NULL;                                                            \
-  else {                                                                       \
-    wcslcpy(ret_key, NULL != mykey ? mykey : L"", EINI_SHORT);                 \
-    ret.key = ret_key;                                                         \
-  }                                                                            \
-  if (NULL == myvalue)                                                         \
-    ret.value = NULL;                                                          \
-  else {                                                                       \
-    wcslcpy(ret_value, NULL != myvalue ? myvalue : L"", EINI_LONG);            \
-    wunescape(ret_value);                                                      \
-    ret.value = ret_value;                                                     \
-  }
+  ret.key = mykey;                                                             \
+  ret.value = myvalue;                                                         \
+  ret.escaped = NULL != myvalue.ptr && tok.bs > (size_t)(myvalue.ptr - src);
+
+// Helper of `parse_line()`. Make `ret` an error, with `msg` (a string literal)
+// as its error message, and return it.
+#define return_error(msg)                                                      \
+  ret.type = EINI_ERROR;                                                       \
+  ret.key = nospan;                                                            \
+  ret.value.ptr = msg;                                                         \
+  ret.value.len = sizeof(msg) - 1;                                             \
+  ret.escaped = false;                                                         \
+  return ret;
 
-// Helper of `eini_parse()`. Strip trailing whitespace from `wsrc`. If it's
+// Helper of `parse_line()`. Strip trailing whitespace from `val`. If it's
 // surrounded by single or double quotes, strip those as well. Return any syntax
-// errors pertaining to non-terminated quotes.
-#define wsrc_strip                                                             \
-  wlen = wmargtrim(wsrc, NULL);                                                \
-  if (L'"' == wsrc[0]) {                                                       \
-    /* wsrc begins with a `"` */                                               \
-    if (wlen < 2) {                                                            \
-      /* wsrc equals `"`; accept it as it is */                                \
-    } else if (L'"' == wsrc[wlen - 1]) {                                       \
-      /* wsrc ends in '"' */                                                   \
-      if (wescaped(wsrc, wlen - 1)) {                                          \
-        /* the ending `"` is escaped; reject it */                             \
-        set_ret(EINI_ERROR, NULL, L"Non-terminated quote");                    \
-        return ret;                                                            \
-      } else {                                                                 \
-        /* the ending `"` is not escaped; remove the `"`s and accept it */     \
-        wsrc[wlen - 1] = L'\0';                                                \
-        wsrc = &wsrc[1];                                                       \
-      }                                                                        \
-    } else {                                                                   \
-      /* wsrc does not end in `"`; reject it */                                \
-      set_ret(EINI_ERROR, NULL, L"Non-terminated quote");                      \
-      return ret;                                                              \
-    }                                                                          \
-  } else if (L'\'' == wsrc[0]) {                                               \
-    /* wsrc begins with a `'` */                                               \
-    if (wlen < 2) {                                                            \
-      /* wsrc equals `'`; accept it as it is */                                \
-    } else if (L'\'' == wsrc[wlen - 1]) {                                      \
-      /* wsrc ends in `'` */                                                   \
-      if (wescaped(wsrc, wlen - 1)) {                                          \
-        /* the ending `'` is escaped; reject it */                             \
-        set_ret(EINI_ERROR, NULL, L"Non-terminated quote");                    \
-        return ret;                                                            \
+// errors pertaining to non-terminated quotes. (The ending quote is unescaped
+// only if it's the last one `tokenize()` found.)
+#define val_strip                                                              \
+  val = span_rtrim(val, NULL);                                                 \
+  if (val.len > 0 && ('"' == val.ptr[0] || '\'' == val.ptr[0])) {              \
+    /* val begins with a `"` or a `'` */                                       \
+    if (val.len < 2) {                                                         \
+      /* val equals `"` or `'`; accept it as it is */                          \
+    } else if (val.ptr[0] == val.ptr[val.len - 1]) {                           \
+      /* val ends in the same kind of quote */                                 \
+      if (&val.ptr[val.len] != &src[tok.quote]) {                              \
+        /* the ending quote is escaped; reject it */                           \
+        return_error("Non-terminated quote");                                  \
       } else {                                                                 \
-        /* the ending `"` is not escaped; remove the `"`s and accept it */     \
-        wsrc[wlen - 1] = L'\0';                                                \
-        wsrc = &wsrc[1];                                                       \
+        /* the ending quote is not escaped; remove the quotes and accept it */ \
+        val.ptr++;                                                             \
+        val.len -= 2;                                                          \
       }                                                                        \
     } else {                                                                   \
-      /* wsrc does not end in `'`; reject it */                                \
-      set_ret(EINI_ERROR, NULL, L"Non-terminated quote");                      \
-      return ret;                                                              \
+      /* val does not end in the same kind of quote; reject it */              \
+      return_error("Non-terminated quote");                                    \
     }                                                                          \
   }
 
-// Helper of `populate_ipath` and `eini()`. Call `ef(errmsg, path, i)`, wind
-// down, and return.
+// Helper of `populate_ipath` and `parse()`. Call `emit_error(ctx, errmsg,
+// f->path, f->i)`, and wind `f` down.
 #define call_ef_and_return                                                     \
-  ef(errmsg, path, i);                                                         \
-  if (NULL != fp)                                                              \
-    fclose(fp);                                                                \
-  return;
-
-// Helper of `eini()`, called when handling an inclusion. Populate `ipath` with
-// the correct path of the included file. In case of error (such as file not
-// found), call `em()` and return.
+  emit_error(ctx, errmsg, f->path, f->i);                                      \
+  goto wind_down;
+
+// Helper of `parse()`, called when handling an inclusion. Populate `ipath` with
+// the correct path of the included file. If there's an include resolver, ask it
+// for the file's contents, and store them in `icont`. If the resolver reports
+// that the file doesn't exist (or memory runs out), call `emit_error()` and
+// return. (Otherwise, whether the file exists is only found out when it's
+// opened for parsing.)
 #define populate_ipath                                                         \
-  if (L'/' == lne.value[0]) {                                                  \
-    /* Absolute path */                                                        \
-    if (-1 == wcstombs(ipath, lne.value, EINI_LONG)) {                         \
-      wcslcpy(errmsg, L"wcstombs() failed", EINI_LONG);                        \
-      call_ef_and_return;                                                      \
-    }                                                                          \
-  } else {                                                                     \
-    /* Relative path */                                                        \
-    char svalue[EINI_LONG];                                                    \
-    if (-1 == wcstombs(svalue, lne.value, EINI_LONG)) {                        \
-      wcslcpy(errmsg, L"wcstombs() failed", EINI_LONG);                        \
-      call_ef_and_return;                                                      \
-    }                                                                          \
-    strlcpy(ipath, path, EINI_LONG);                                           \
-    strlcpy(ipath, dirname(ipath), EINI_LONG);                                 \
-    strlcat(ipath, "/", EINI_LONG);                                            \
-    strlcat(ipath, svalue, EINI_LONG);                                         \
-  }                                                                            \
-  /* Error out if file was not found */                                        \
-  ifp = fopen(ipath, "r");                                                     \
-  if (NULL == ifp) {                                                           \
-    swprintf(errmsg, EINI_LONG, L"Unable to open '%s'", ipath);                \
+  ipath = include_path(ctx, f, str.value);                                     \
+  if (NULL == ipath) {                                                         \
+    errmsg = "Out of memory";                                                  \
     call_ef_and_return;                                                        \
   }                                                                            \
-  fclose(ifp);
-
-// Helper of `wsrc_strip()` and `decomment()`, i.e. `eini_parse()` ultimately.
-// Test whether the character in `src[pos]` is escaped.
-bool wescaped(wchar_t *src, unsigned pos) {
-  int c = 0;   // number of '\'s before `pos`
-  int i = pos; // iterator
-
-  while (i > 0) {
-    i--;
-    if (L'\\' == src[i])
-      c++;
+  /* Ask the resolver first, and error out if it says the file is missing */   \
+  ires = NULL == ctx->rf ? 0 : ctx->rf(ipath, &icont, ctx->rdata);             \
+  if (-1 == ires) {                                                            \
+    errmsg = errorf(ctx, "Unable to open '%s'", ipath);                        \
+    call_ef_and_return;                                                        \
+  }
+
+// Helper of `parse()`. Call `emit_error()` and return, if `to_str()` ran out
+// of memory while converting `lne` to `str`.
+#define check_str                                                              \
+  if (EINI_ERROR == str.type && EINI_ERROR != lne.type) {                      \
+    errmsg = str.value;                                                        \
+    call_ef_and_return;                                                        \
+  }
+
+// Helper of `to_str()`, `parse()`, and friends. Make room for `size` bytes in
+// `buf`, and return its contents (or NULL on memory allocation failure).
+static char *buf_reserve(buf_t *buf, size_t size) {
+  if (size > buf->cap) {
+    size_t cap = buf->cap < EINI_SHORT ? EINI_SHORT : buf->cap; // new capacity
+    char *ptr;                                                  // new contents
+
+    while (cap < size)
+      cap *= 2;
+    ptr = realloc(buf->ptr, cap);
+    if (NULL == ptr)
+      return NULL;
+    buf->ptr = ptr;
+    buf->cap = cap;
+  }
+
+  return buf->ptr;
+}
+
+// Helper of `populate_ipath` and `replay()`. Return the path of the file that
+// the file of `f` includes as `name` (allocated from the arena of `ctx`, or
+// held in the include buffer of `f`), or NULL on memory allocation failure.
+static char *include_path(eini_ctx_t *ctx, frame_t *f, const char *name) {
+  size_t icap = strlen(f->path) + strlen(name) + 2; // capacity of `ipath`
+  char *ipath = NULL == ctx->arena ? buf_reserve(&f->ibuf, icap)
+                                   : eini_arena_alloc(ctx->arena, icap);
+
+  if (NULL == ipath)
+    return NULL;
+  if ('/' == name[0]) {
+    // Absolute path
+    strlcpy(ipath, name, icap);
+  } else {
+    // Relative path
+    strlcpy(ipath, f->path, icap);
+    strlcpy(ipath, dirname(ipath), icap);
+    strlcat(ipath, "/", icap);
+    strlcat(ipath, name, icap);
+  }
+  return ipath;
+}
+
+// Helper of `parse()` and friends. Format an error message (as `printf()`
+// would), store it in `ctx`, and return it. The message is valid until the next
+// call.
+static const char *errorf(eini_ctx_t *ctx, const char *fmt, ...) {
+  va_list ap; // arguments
+  int len;    // length of the message
+
+  va_start(ap, fmt);
+  len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (len < 0 || NULL == buf_reserve(&ctx->errmsg, len + 1))
+    return "Out of memory";
+
+  va_start(ap, fmt);
+  vsnprintf(ctx->errmsg.ptr, len + 1, fmt, ap);
+  va_end(ap);
+  return ctx->errmsg.ptr;
+}
+
+// Helper of `parse_line()`. Test whether the `len` characters in `src` are
+// valid UTF-8 (no overlong encodings, surrogates, or code points beyond
+// U+10FFFF).
+static bool utf8valid(const char *src, size_t len) {
+  const unsigned char *s = (const unsigned char *)src; // iterator
+  const unsigned char *end = s + len;                  // end of `src`
+  unsigned n;                                          // continuation bytes
+
+  while (s < end) {
+    if (*s < 0x80) {
+      s++;
+      continue;
+    } else if (*s >= 0xc2 && *s <= 0xdf)
+      n = 1;
+    else if (*s >= 0xe0 && *s <= 0xef)
+      n = 2;
+    else if (*s >= 0xf0 && *s <= 0xf4)
+      n = 3;
     else
-      break;
+      return false;
+
+    if (end - s <= n)
+      return false;
+    if ((0xe0 == *s && s[1] < 0xa0) || (0xed == *s && s[1] > 0x9f) ||
+        (0xf0 == *s && s[1] < 0x90) || (0xf4 == *s && s[1] > 0x8f))
+      return false;
+
+    for (s++; n > 0; s++, n--)
+      if (0x80 != (*s & 0xc0))
+        return false;
   }
 
-  return c % 2;
+  return true;
 }
 
-// Helper of `set_ret()`, i.e. `eini_parse()` ultimately. Unescape the string in
-// `src`. `\a`, `\b`, `\t`, `\n`, `\v`, `\f`, and `\r` are unescaped into
-// character codes 7 to 13, `\e` to character code 27 (ESC), `\\` to `\`, `\"`
-// to `"`, and `\'` to `'`. All other escaped characters are discarded.
-void wunescape(wchar_t *src) {
-  int i = 0, j = 0; // iterators
+// Helper of `to_str()`. Unescape the `len` characters in `src`, and store the
+// result (plus a terminating NULL character) in `dst`, which must be at least
+// `len + 1` characters long. Return the length of the result. `\a`, `\b`, `\t`,
+// `\n`, `\v`, `\f`, and `\r` are unescaped into character codes 7 to 13, `\e`
+// to character code 27 (ESC), `\\` to `\`, `\"` to `"`, and `\'` to `'`. All
+// other escaped characters are discarded.
+static size_t unescape(char *dst, const char *src, size_t len) {
+  size_t i = 0, j = 0; // iterators
 
-  while (L'\0' != src[i]) {
-    if (L'\\' == src[i]) {
+  while (i < len) {
+    if ('\\' == src[i]) {
+      if (i + 1 == len)
+        // A lone `\` at the end of the string
+        break;
       switch (src[i + 1]) {
-      case L'a':
-        src[j++] = L'\a';
+      case 'a':
+        dst[j++] = '\a';
         break;
-      case L'b':
-        src[j++] = L'\b';
+      case 'b':
+        dst[j++] = '\b';
         break;
-      case L't':
-        src[j++] = L'\t';
+      case 't':
+        dst[j++] = '\t';
         break;
-      case L'n':
-        src[j++] = L'\n';
+      case 'n':
+        dst[j++] = '\n';
         break;
-      case L'v':
-        src[j++] = L'\v';
+      case 'v':
+        dst[j++] = '\v';
         break;
-      case L'f':
-        src[j++] = L'\f';
+      case 'f':
+        dst[j++] = '\f';
         break;
-      case L'r':
-        src[j++] = L'\r';
+      case 'r':
+        dst[j++] = '\r';
         break;
-      case L'e':
-        src[j++] = L'\e';
+      case 'e':
+        dst[j++] = '\e';
         break;
-      case L'\\':
-        src[j++] = L'\\';
+      case '\\':
+        dst[j++] = '\\';
         break;
-      case L'"':
-        src[j++] = L'"';
+      case '"':
+        dst[j++] = '"';
         break;
-      case L'\'':
-        src[j++] = L'\'';
+      case '\'':
+        dst[j++] = '\'';
         break;
       }
       i += 2;
     } else {
-      src[j++] = src[i];
+      dst[j++] = src[i];
       i++;
     }
   }
 
-  src[j] = L'\0';
+  dst[j] = '\0';
+  return j;
 }
 
-// Helper of `eini_parse()`. Return the position of the first character in `src`
-// that is not whitespace, and not one of the characters in `extras`. (If
-// `extras` is NULL then it is ignored.)
-unsigned wmargend(const wchar_t *src, const wchar_t *extras) {
-  bool ws;       // whether current character is whitespace or in extras
-  unsigned i, j; // iterators
+// Helper of `parse_line()`. Return `src`, minus all leading characters that are
+// either whitespace or one of the characters in `extras`. (If `extras` is NULL
+// then it is ignored.)
+static eini_span_t span_ltrim(eini_span_t src, const char *extras) {
+  if (NULL == extras)
+    extras = "";
+
+  while (src.len > 0 &&
+         (isws(src.ptr[0]) || NULL != strchr(extras, src.ptr[0]))) {
+    src.ptr++;
+    src.len--;
+  }
+
+  return src;
+}
 
+// Helper of `val_strip` and `parse_line()`. Return `src`, minus all trailing
+// characters that are either whitespace or one of the characters in `extras`.
+// (If `extras` is NULL then it is ignored.)
+static eini_span_t span_rtrim(eini_span_t src, const char *extras) {
   if (NULL == extras)
-    extras = L"";
+    extras = "";
+
+  while (src.len > 0 && (isws(src.ptr[src.len - 1]) ||
+                         NULL != strchr(extras, src.ptr[src.len - 1])))
+    src.len--;
+
+  return src;
+}
+
+// Helper of `block_masks()`. Store the positions of `;`, `"`, `'`, and `\` in
+// the `BLOCK_SIZE` characters of `src` into `m`, one character at a time. (Only
+// used without SSE2, but kept as the reference for the vector versions.)
+__attribute__((unused)) static void block_scalar(const char *src, masks_t *m) {
+  memset(m, 0, sizeof(masks_t));
+  for (unsigned i = 0; i < BLOCK_SIZE; i++) {
+    uint64_t bit = (uint64_t)1 << i; // bit for `src[i]`
+    switch (src[i]) {
+    case ';':
+      m->semi |= bit;
+      break;
+    case '"':
+      m->dquote |= bit;
+      break;
+    case '\'':
+      m->squote |= bit;
+      break;
+    case '\\':
+      m->bslash |= bit;
+      break;
+    }
+  }
+}
 
-  for (i = 0; L'\0' != src[i]; i++) {
-    ws = false;
-    if (iswspace(src[i]))
-      ws = true;
-    for (j = 0; L'\0' != extras[j]; j++)
-      if (src[i] == extras[j])
-        ws = true;
+#ifdef __SSE2__
 
-    if (!ws)
-      return i;
+// Helper of `block_sse2()` and `block_avx2()`. Add the positions of character
+// `c` in vector `v` (of characters `i` onwards of the block) to mask `mask`,
+// using comparison function `cmp`, splat function `set1`, and mask extraction
+// function `movemask` (which returns `type`).
+#define add_mask(mask, v, c, i, cmp, set1, movemask, type)                     \
+  mask |= (uint64_t)(type)movemask(cmp(v, set1(c))) << (i)
+
+// Same as `block_scalar()`, but 16 characters at a time, with SSE2
+static void block_sse2(const char *src, masks_t *m) {
+  memset(m, 0, sizeof(masks_t));
+  for (unsigned i = 0; i < BLOCK_SIZE; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i]); // 16 characters
+    add_mask(m->semi, v, ';', i, _mm_cmpeq_epi8, _mm_set1_epi8,
+             _mm_movemask_epi8, uint16_t);
+    add_mask(m->dquote, v, '"', i, _mm_cmpeq_epi8, _mm_set1_epi8,
+             _mm_movemask_epi8, uint16_t);
+    add_mask(m->squote, v, '\'', i, _mm_cmpeq_epi8, _mm_set1_epi8,
+             _mm_movemask_epi8, uint16_t);
+    add_mask(m->bslash, v, '\\', i, _mm_cmpeq_epi8, _mm_set1_epi8,
+             _mm_movemask_epi8, uint16_t);
   }
+}
 
-  return 0;
+// Same as `block_scalar()`, but 32 characters at a time, with AVX2
+__attribute__((target("avx2"))) static void
+block_avx2(const char *src, masks_t *m) {
+  memset(m, 0, sizeof(masks_t));
+  for (unsigned i = 0; i < BLOCK_SIZE; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&src[i]); // 32 characters
+    add_mask(m->semi, v, ';', i, _mm256_cmpeq_epi8, _mm256_set1_epi8,
+             _mm256_movemask_epi8, uint32_t);
+    add_mask(m->dquote, v, '"', i, _mm256_cmpeq_epi8, _mm256_set1_epi8,
+             _mm256_movemask_epi8, uint32_t);
+    add_mask(m->squote, v, '\'', i, _mm256_cmpeq_epi8, _mm256_set1_epi8,
+             _mm256_movemask_epi8, uint32_t);
+    add_mask(m->bslash, v, '\\', i, _mm256_cmpeq_epi8, _mm256_set1_epi8,
+             _mm256_movemask_epi8, uint32_t);
+  }
 }
 
-// Helper of `wsrc_strip` and `eini_parse()`. Trim all characters at the end of
-// `trgt` that are either whitespace or one of the charactes in `extras`. (If
-// `extras` is NULL then it is ignored.) Trimming is done by inserting 0 or more
-// NULL characters at the end of `trgt`. Return the new length of `trgt`.
-unsigned wmargtrim(wchar_t *trgt, const wchar_t *extras) {
-  int i;      // iterator
-  unsigned j; // iterator
-  bool trim;  // true if we'll be trimming `trgt[i]`
+#endif
 
-  if (NULL == extras)
-    extras = L"";
+#ifdef __SSE2__
 
-  for (i = 0; L'\0' != trgt[i]; i++)
-    ;
+// Helper of `tokenize()`. Store the positions of `;`, `"`, `'`, and `\` in
+// the `BLOCK_SIZE` characters of `src` into `m`, using the widest vector
+// instructions the CPU supports (as found once, by `block_pick()`).
+static void (*block_masks)(const char *src, masks_t *m) = block_sse2;
+
+// Helper of `block_masks()`. Use AVX2 if the CPU supports it. Called when eINI
+// is loaded, so that the hot path doesn't have to check.
+__attribute__((constructor)) static void block_pick() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    block_masks = block_avx2;
+}
 
-  i--;
-  while (i >= 0) {
-    trim = false;
+#else
 
-    if (iswspace(trgt[i]))
-      trim = true;
-    else
-      for (j = 0; L'\0' != extras[j]; j++)
-        if (trgt[i] == extras[j])
-          trim = true;
+// Helper of `tokenize()`. Store the positions of `;`, `"`, `'`, and `\` in
+// the `BLOCK_SIZE` characters of `src` into `m`.
+#define block_masks block_scalar
 
-    if (!trim) {
-      trgt[i + 1] = L'\0';
-      return i + 1;
-    }
+#endif
 
-    i--;
-  }
+// Helper of `tokenize()`. Return the positions of the characters in a block
+// that are escaped, i.e. preceded by an odd number of `\`s, given the positions
+// of the `\`s in `bs`. `*carry` is 1 if the block begins after an odd number
+// of `\`s (and 0 otherwise), and is updated for the next block. (`\`s
+// themselves are never reported as escaped, since they don't matter.)
+//
+// Every run of `\`s is added to its first bit, which carries past the end of
+// the run; whether the run was odd follows from the parity of its beginning and
+// end.
+static uint64_t escape_mask(uint64_t bs, uint64_t *carry) {
+  const uint64_t even = 0x5555555555555555u; // bits in even positions
+  uint64_t starts = bs & ~(bs << 1);          // beginnings of runs
+  uint64_t even_mask = even ^ *carry; // positions where runs begin "evenly"
+  uint64_t even_starts = starts & even_mask;  // runs beginning evenly
+  uint64_t odd_starts = starts & ~even_mask;  // runs beginning oddly
+  uint64_t even_ends = (bs + even_starts) & ~bs; // ends of even runs
+  uint64_t odd_ends;                             // ends of odd runs
+  bool overflow = __builtin_add_overflow(bs, odd_starts, &odd_ends);
 
-  trgt[0] = L'\0';
-  return 0;
+  odd_ends = (odd_ends | *carry) & ~bs;
+  *carry = overflow;
+  return (even_ends & ~even) | (odd_ends & even);
 }
 
-// Helper of `eini_parse()`. Discard all comments in `src`.
-void decomment(wchar_t *src) {
-  unsigned i = 0;       // iterator
-  bool inq = false;     // true if `src[i]` is inside a quoted string
-  wchar_t qtype = L'?'; // quote type: `'` or `"`
+// Helper of `parse_line()`. Find the comment (if any) in the `len` characters
+// of `src`, the last unescaped quote before it, and the last `\` before it,
+// and store their positions in `tok`, in a single pass.
+//
+// `src` is scanned in blocks of `BLOCK_SIZE` characters, finding all the `;`s,
+// quotes, and `\`s in each at once; unescaped quotes are then told apart with
+// bit arithmetic, without ever scanning backwards. Only `;`s and unescaped
+// quotes need to be looked at one by one, to keep track of whether they are
+// inside a quoted string.
+static void tokenize(const char *src, size_t len, tokens_t *tok) {
+  char tail[BLOCK_SIZE]; // last (partial) block, padded with NULs
+  masks_t m;             // positions of interesting characters in a block
+  uint64_t carry = 0;    // 1 if the block begins with an escaped character
+  uint64_t todo;         // positions left to look at in a block
+  bool inq = false;      // true if inside a quoted string
+  char qtype = '?';      // quote type: `'` or `"`
 
-  while (L'\0' != src[i]) {
-    if (inq) {
-      // `src[i]` is inside a quoted string
-      if (qtype == src[i] && !wescaped(src, i)) {
-        // `src[i]` is an unescaped `"` or `'`, thus the quoted string ends
-        inq = false;
+  tok->len = len;
+  tok->quote = 0;
+  tok->bs = 0;
+  for (size_t b = 0; b < len; b += BLOCK_SIZE) {
+    const char *blk = &src[b]; // current block
+    if (len - b < BLOCK_SIZE) {
+      // Don't read past the end of `src`
+      memset(tail, 0, BLOCK_SIZE);
+      memcpy(tail, blk, len - b);
+      blk = tail;
+    }
+    block_masks(blk, &m);
+
+    // Comments begin at any `;` outside a quoted string, but quoted strings
+    // begin and end at unescaped quotes only
+    todo = m.semi | ((m.dquote | m.squote) & ~escape_mask(m.bslash, &carry));
+    for (; 0 != todo; todo &= todo - 1) {
+      unsigned i = __builtin_ctzll(todo); // position of `blk[i]`
+      if (';' == blk[i]) {
+        if (inq)
+          continue;
+        // A comment to the end of line
+        tok->len = b + i;
+        m.bslash &= ((uint64_t)1 << i) - 1;
+        break;
       }
-    } else {
-      // `src[i]` isn't inside a quoted string
-      if (L';' == src[i]) {
-        // `src[i]` is `;`, thus we have a comment to the end of line
-        src[i] = L'\0';
-        return;
-      } else if (L'"' == src[i] && !wescaped(src, i)) {
-        // `src[i]` is an unescaped `"`, thus a double-quoted string begins
-        inq = true;
-        qtype = L'"';
-      } else if (L'\'' == src[i] && !wescaped(src, i)) {
-        // src[i] is an unescaped `'`, thus a single-quoted string begins
+      tok->quote = b + i + 1;
+      if (!inq) {
+        // A quoted string begins
         inq = true;
-        qtype = L'\'';
-      }
+        qtype = blk[i];
+      } else if (qtype == blk[i])
+        // The quoted string ends
+        inq = false;
     }
-    i++;
+
+    if (0 != m.bslash)
+      tok->bs = b + BLOCK_SIZE - __builtin_clzll(m.bslash);
+    if (tok->len < len)
+      break;
   }
 }
 
-// Helper of `eini_parse()`. Find the first match of `re` in `src` and return
-// its location.
-range_t match(regex_t re, char *src) {
+#ifdef EINI_REGEX
+
+// Helper of `eini_init()` and `eini_ctx_new()`. Compile the regular expressions
+// for an include directive, a section header, and a key/value pair into
+// `include`, `section`, and `value` respectively.
+void compile_regexes(regex_t *include, regex_t *section, regex_t *value) {
+  regcomp(include, "[[:space:]]*include[[:space:]]*", REG_EXTENDED);
+  regcomp(section,
+          "[[:space:]]*\\[[[:space:]]*[a-zA-Z][a-zA-Z0-9_]*[[:space:]]*\\][[:"
+          "space:]]*",
+          REG_EXTENDED);
+  regcomp(value,
+          "[[:space:]]*[a-zA-Z][a-zA-Z0-9_]*[[:space:]]*=[[:space:]]*",
+          REG_EXTENDED);
+}
+
+// Helper of `classify()`. Find the first match of `re` in the `len` characters
+// of `src` and return its location.
+range_t match(const regex_t *re, const char *src, size_t len) {
   regmatch_t pmatch[1]; // regex match
   range_t res;          // return value
 
   // Try to match `src`
-  int err = regexec(&re, src, 1, pmatch, 0);
+  pmatch[0].rm_so = 0;
+  pmatch[0].rm_eo = len;
+  int err = regexec(re, src, 1, pmatch, REG_STARTEND);
 
   if (0 == err) {
     // A match was found
@@ -326,166 +825,2471 @@ range_t match(regex_t re, char *src) {
   return res;
 }
 
-//
-// Functions
-//
+// Helper of `parse_line()`. Classify the (decommented) line in the `len`
+// characters of `src` as an include directive, a section header, or a
+// key/value pair, using the regular expressions in `ctx`. Store the location of
+// the match in `loc`, and return the line type. Return `EINI_NONE` if `src` is
+// none of the above.
+static eini_type_t classify(const eini_ctx_t *ctx, const char *src, size_t len,
+                            range_t *loc) {
+  *loc = match(ctx->re_include, src, len);
+  if (0 == loc->beg && loc->end > loc->beg)
+    return EINI_INCLUDE;
 
-void eini_init() {
-  regcomp(&eini_re_include, "[[:space:]]*include[[:space:]]*", REG_EXTENDED);
-  regcomp(&eini_re_section,
-          "[[:space:]]*\\[[[:space:]]*[a-zA-Z][a-zA-Z0-9_]*[[:space:]]*\\][[:"
-          "space:]]*",
-          REG_EXTENDED);
-  regcomp(&eini_re_value,
-          "[[:space:]]*[a-zA-Z][a-zA-Z0-9_]*[[:space:]]*=[[:space:]]*",
-          REG_EXTENDED);
+  *loc = match(ctx->re_section, src, len);
+  if (!(0 == loc->beg && 0 == loc->end))
+    return EINI_SECTION;
+
+  *loc = match(ctx->re_value, src, len);
+  if (!(0 == loc->beg && 0 == loc->end))
+    return EINI_VALUE;
+
+  return EINI_NONE;
 }
 
-eini_t eini_parse(char *src) {
-  wchar_t *wsrc =
-      alloca((EINI_LONG + 1) * sizeof(wchar_t)); // `wchar_t*` version of `src`
-  char *csrc = alloca(
-      (EINI_LONG + 1) *
-      sizeof(char)); // `char*` version of `src` (after removing comments)
-  int wlen;          // length of `wsrc`
-  range_t loc;       // location of regex match in `wsrc`
-  eini_t ret;        // return value
-  static wchar_t ret_key[EINI_SHORT];  // `key` contents of `ret`
-  static wchar_t ret_value[EINI_LONG]; // `value` contents of `ret`
-
-  wlen = mbstowcs(wsrc, src, EINI_LONG);
-  if (-1 == wlen) {
-    // Couldn't convert `src`
-    set_ret(EINI_ERROR, NULL, L"Non-string data");
-    return ret;
+#else
+
+// Helper of `parse_line()`. Classify the (decommented) line in the `len`
+// characters of `src` as an include directive, a section header, or a
+// key/value pair, in a single left to right pass. Store the location of the
+// match in `loc`, and return the line type. Return `EINI_NONE` if `src` is none
+// of the above. (`ctx` is not used.)
+//
+// The results are identical to those of the regular expressions used when
+// eINI is built with `EINI_REGEX`, i.e.:
+//   include:   `^[[:space:]]*include[[:space:]]*`
+//   section:   `[[:space:]]*\[[[:space:]]*<ident>[[:space:]]*\][[:space:]]*`
+//   key/value: `[[:space:]]*<ident>[[:space:]]*=[[:space:]]*`
+// where `<ident>` is `[a-zA-Z][a-zA-Z0-9_]*`. Section headers take precedence
+// over key/value pairs, and the leftmost match of each is the one reported.
+static eini_type_t classify(const eini_ctx_t *ctx, const char *src, size_t len,
+                            range_t *loc) {
+  unsigned i = 0;      // iterator
+  int wsb = -1;        // beginning of the current run of whitespace, or -1
+  int sst = 0;         // section header state: 0 = none, 1 = after `[`, 2 =
+                       // inside the identifier, 3 = after the identifier
+  int sbeg = 0;        // beginning of the current section header candidate
+  int vst = 0;         // key state: 0 = none, 1 = inside the identifier, 2 =
+                       // after the identifier
+  int vbeg = 0;        // beginning of the current key candidate
+  int rbeg = 0;        // beginning of the current run of identifier characters
+  bool vfound = false; // true if a key/value pair has been found
+  range_t vloc;        // location of the key/value pair
+  char c;              // current character
+
+  // `ctx` only holds the regular expressions of the other implementation
+  (void)ctx;
+
+  // Include directive (must be at the beginning of the line)
+  while (i < len && isws(src[i]))
+    i++;
+  if (len - i >= 7 && 0 == strncmp(&src[i], "include", 7)) {
+    i += 7;
+    while (i < len && isws(src[i]))
+      i++;
+    loc->beg = 0;
+    loc->end = i;
+    return EINI_INCLUDE;
   }
-  wsrc[EINI_LONG - 1] = L'\0';
+  if (i > 0)
+    wsb = 0;
+
+  for (; i < len; i++) {
+    c = src[i];
 
-  decomment(wsrc);
-  wcstombs(csrc, wsrc, EINI_LONG);
+    // Section header
+    if ('[' == c) {
+      sst = 1;
+      sbeg = -1 == wsb ? i : wsb;
+    } else if (1 == sst) {
+      if (isidbeg(c))
+        sst = 2;
+      else if (!isws(c))
+        sst = 0;
+    } else if (2 == sst || 3 == sst) {
+      if (']' == c) {
+        // Found one; it takes precedence over any key/value pair
+        for (loc->beg = sbeg, i++; i < len && isws(src[i]); i++)
+          ;
+        loc->end = i;
+        return EINI_SECTION;
+      } else if (isws(c))
+        sst = 3;
+      else if (!(2 == sst && isidchr(c)))
+        sst = 0;
+    }
 
-  loc = match(eini_re_include, csrc);
+    // Key/value pair (only the first one counts)
+    if (!vfound) {
+      if (isidchr(c)) {
+        if (i > 0 && !isidchr(src[i - 1])) {
+          // A new run of identifier characters begins
+          vst = 0;
+          rbeg = i;
+        }
+        if (0 == vst && isidbeg(c)) {
+          // The key begins at the run's first letter
+          vst = 1;
+          vbeg = i == rbeg && -1 != wsb ? wsb : i;
+        }
+      } else if (isws(c)) {
+        if (1 == vst)
+          vst = 2;
+      } else if ('=' == c && 0 != vst) {
+        vfound = true;
+        vloc.beg = vbeg;
+        for (vloc.end = i + 1; vloc.end < len && isws(src[vloc.end]);
+             vloc.end++)
+          ;
+      } else
+        vst = 0;
+    }
 
-  if (0 == loc.beg && loc.end > loc.beg) {
-    // Include directive
-    wsrc = &wsrc[loc.end];
-    wsrc_strip;
-    set_ret(EINI_INCLUDE, NULL, wsrc);
-    return ret;
+    // Keep track of whitespace runs
+    if (isws(c)) {
+      if (-1 == wsb)
+        wsb = i;
+    } else
+      wsb = -1;
   }
 
-  loc = match(eini_re_section, csrc);
-  if (!(0 == loc.beg && 0 == loc.end)) {
-    // Section
-    wsrc = &wsrc[wmargend(wsrc, L"[")];
-    wmargtrim(wsrc, L"]");
-    set_ret(EINI_SECTION, NULL, wsrc);
-    return ret;
+  if (vfound) {
+    *loc = vloc;
+    return EINI_VALUE;
+  }
+
+  return EINI_NONE;
+}
+
+#endif
+
+// Parse .ini file line in the `len` characters of `src` and return the result,
+// as spans into `src`. `src` is not modified. If `utf8` is true, lines that are
+// not valid UTF-8 are rejected. Error messages may be stored in `ctx`, and are
+// valid until the next call.
+static line_t parse_line(eini_ctx_t *ctx, const char *src, size_t len,
+                         bool utf8) {
+  eini_span_t ln = {src, len}; // the line
+  eini_span_t val;             // value part of the line
+  range_t loc;                 // location of syntax element in `ln`
+  tokens_t tok;                // comments, quotes, and escapes in `ln`
+  line_t ret;                  // return value
+
+  if (utf8 && !utf8valid(src, len)) {
+    // `src` is not UTF-8
+    return_error("Non-string data");
   }
 
-  loc = match(eini_re_value, csrc);
-  if (!(0 == loc.beg && 0 == loc.end)) {
+  tokenize(src, len, &tok);
+  ln.len = tok.len;
+
+  switch (classify(ctx, ln.ptr, ln.len, &loc)) {
+  case EINI_INCLUDE:
+    // Include directive
+    val.ptr = &ln.ptr[loc.end];
+    val.len = ln.len - loc.end;
+    val_strip;
+    set_ret(EINI_INCLUDE, nospan, val);
+    return ret;
+  case EINI_SECTION:
+    // Section
+    val = span_rtrim(span_ltrim(ln, "["), "]");
+    set_ret(EINI_SECTION, nospan, val);
+    return ret;
+  case EINI_VALUE: {
     // Key/value pair
-    wchar_t *wkey = wsrc;
-    wkey[loc.end - 1] = L'\0';
-    wkey = &wkey[wmargend(wkey, NULL)];
-    wmargtrim(wkey, L"=");
-    wsrc = &wsrc[loc.end];
-    wsrc_strip;
-    set_ret(EINI_VALUE, wkey, wsrc);
+    eini_span_t key = {ln.ptr, loc.end - 1};
+    key = span_rtrim(span_ltrim(key, NULL), "=");
+    val.ptr = &ln.ptr[loc.end];
+    val.len = ln.len - loc.end;
+    val_strip;
+    set_ret(EINI_VALUE, key, val);
     return ret;
   }
+  default:
+    break;
+  }
 
-  wlen = wmargtrim(wsrc, NULL);
-  if (0 == wlen) {
+  ln = span_rtrim(ln, NULL);
+  if (0 == ln.len) {
     // Empty line
-    set_ret(EINI_NONE, NULL, NULL);
+    set_ret(EINI_NONE, nospan, nospan);
     return ret;
   }
 
   // None of the above
-  wchar_t errmsg[EINI_LONG];
-  swprintf(errmsg, EINI_LONG, L"Unable to parse '%ls'", wsrc);
-  set_ret(EINI_ERROR, NULL, errmsg);
+  val.ptr = errorf(ctx, "Unable to parse '%.*s'", (int)ln.len, ln.ptr);
+  val.len = strlen(val.ptr);
+  ret.type = EINI_ERROR;
+  ret.key = nospan;
+  ret.value = val;
+  ret.escaped = true;
   return ret;
 }
 
-void eini(eini_handler_t hf, eini_error_t ef, const char *path) {
-  unsigned i = 0;                // current line number in .ini file
-  FILE *fp = NULL;               // file pointer for .ini file
-  char ln[EINI_LONG];            // current .ini file line text
-  eini_t lne;                    // current .ini file line parsed contents
-  wchar_t sec[EINI_SHORT] = L""; // current section
-  wchar_t errmsg[EINI_LONG];     // error message
-
-  fp = fopen(path, "r");
-  if (NULL == fp) {
-    swprintf(errmsg, EINI_LONG, L"Unable to open '%s'", path);
-    call_ef_and_return;
-  }
-
-  // If this is an empty file, do nothing
-  fseek(fp, 0, SEEK_END);
-  if (0 == ftell(fp))
-    return;
-  rewind(fp);
+// Helper of `eini_ctx_parse_utf8()` and `parse()`. Convert the spans in
+// `lne` to strings stored in `ctx` (or in its arena, if it has one), unescaping
+// the value. If memory runs out, return an error instead.
+static eini_utf8_t to_str(eini_ctx_t *ctx, line_t lne) {
+  eini_utf8_t ret; // return value
 
-  while (!feof(fp)) {
-    // Read next line into `ln`, and parse it into `lne`
-    if (NULL == fgets(ln, EINI_LONG, fp)) {
-      if (feof(fp))
-        break;
-      else {
-        wcslcpy(errmsg, L"Unable to read line", EINI_LONG);
-        printf("%s", strerror(errno));
-        call_ef_and_return;
-      }
+  ret.type = lne.type;
+  ret.key = NULL;
+  ret.value = NULL;
+
+  if (NULL != lne.key.ptr) {
+    ret.key = NULL == ctx->arena
+                  ? buf_reserve(&ctx->key, lne.key.len + 1)
+                  : eini_arena_alloc(ctx->arena, lne.key.len + 1);
+    if (NULL == ret.key)
+      goto out_of_memory;
+    memcpy(ret.key, lne.key.ptr, lne.key.len);
+    ret.key[lne.key.len] = '\0';
+  }
+  if (NULL != lne.value.ptr) {
+    ret.value = NULL == ctx->arena
+                    ? buf_reserve(&ctx->value, lne.value.len + 1)
+                    : eini_arena_alloc(ctx->arena, lne.value.len + 1);
+    if (NULL == ret.value)
+      goto out_of_memory;
+    if (lne.escaped)
+      unescape(ret.value, lne.value.ptr, lne.value.len);
+    else {
+      memcpy(ret.value, lne.value.ptr, lne.value.len);
+      ret.value[lne.value.len] = '\0';
     }
-    i++;
-    lne = eini_parse(ln);
+  }
 
-    // Perform different actions, epending on what we got
-    switch (lne.type) {
-    case EINI_INCLUDE: {
-      // Call `eini()` to parse included .ini file
-      char ipath[EINI_LONG]; // included file path
-      FILE *ifp;             // included file pointer
-      populate_ipath;
-      eini(hf, ef, ipath);
-      break;
+  return ret;
+
+out_of_memory:
+  // Couldn't allocate memory
+  ret.type = EINI_ERROR;
+  ret.key = NULL;
+  ret.value = "Out of memory";
+  return ret;
+}
+
+// Helper of `eini_ctx_parse()` and `parse()`. Convert `src` to `wchar_t*`
+// and store the result in `dst`, which can hold up to `n` characters. Unlike
+// `mbstowcs()`, this is thread-safe. Return false if `src` couldn't be
+// converted.
+static bool towcs(wchar_t *dst, const char *src, size_t n) {
+  mbstate_t st; // conversion state
+
+  memset(&st, 0, sizeof(st));
+  if ((size_t)-1 == mbsrtowcs(dst, &src, n, &st))
+    return false;
+  dst[n - 1] = L'\0';
+
+  return true;
+}
+
+// Helper of `parse()` and `eini_ctx_parse()`. Convert `src` to `wchar_t*`,
+// storing the result in the arena of `ctx` if it has one, or in `buf`
+// otherwise. Return NULL if `src` couldn't be converted.
+static wchar_t *to_wcs(eini_ctx_t *ctx, const char *src, buf_t *buf) {
+  size_t n = strlen(src) + 1; // maximum number of characters
+  wchar_t *ret = NULL == ctx->arena
+                     ? (wchar_t *)buf_reserve(buf, n * sizeof(wchar_t))
+                     : eini_arena_alloc(ctx->arena, n * sizeof(wchar_t));
+
+  if (NULL == ret)
+    return NULL;
+
+  return towcs(ret, src, n) ? ret : NULL;
+}
+
+// Helper of `emit_error()` and `parse()`. Add an event (with `type`, `line`,
+// `key`, `value`, and `inc`) to the record of `ctx`. Return false on memory
+// allocation failure.
+static bool record(eini_ctx_t *ctx, eini_type_t type, unsigned line,
+                   const char *key, const char *value, record_t *inc) {
+  record_t *rec = ctx->rec; // the record
+  event_t *e;               // the new event
+
+  if (rec->nevents == rec->cevents) {
+    unsigned cevents = 0 == rec->cevents ? EINI_SHORT : 2 * rec->cevents;
+    e = realloc(rec->events, cevents * sizeof(event_t));
+    if (NULL == e)
+      return false;
+    rec->events = e;
+    rec->cevents = cevents;
+  }
+
+  e = &rec->events[rec->nevents++];
+  e->type = type;
+  e->line = line;
+  e->key = key;
+  e->value = value;
+  e->inc = inc;
+  return true;
+}
+
+// Helper of `phf_build()` and `phf_find()`. Hash the `len` characters in
+// `str`, with numeric prefix `prefix`, using seed `seed`.
+static uint64_t phf_hash(uint32_t seed, unsigned prefix, const char *str,
+                         size_t len) {
+  uint64_t h = 14695981039346656037u ^ seed; // return value
+
+  h = (h ^ prefix) * 1099511628211u;
+  for (size_t j = 0; j < len; j++)
+    h = (h ^ (unsigned char)str[j]) * 1099511628211u;
+
+  // Mix the bits, so that every one of them depends on all of the input
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdu;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53u;
+  h ^= h >> 33;
+  return h;
+}
+
+// Helper of `phf_build()` and `phf_find()`. Return the bucket of hash `h`.
+static unsigned phf_bucket(const eini_phf_t *phf, uint64_t h) {
+  return (unsigned)((h * 0x9e3779b97f4a7c15u) >> 32) & phf->bmask;
+}
+
+// Helper of `phf_place()` and `phf_find()`. Return the slot of hash `h` with
+// displacement `d`. (The step is odd, so every slot is tried once as `d`
+// grows.)
+static unsigned phf_slot(const eini_phf_t *phf, uint64_t h, uint32_t d) {
+  return ((uint32_t)h + d * ((uint32_t)(h >> 32) | 1)) & phf->mask;
+}
+
+// Helper of `phf_build()`. Find a displacement that gives each of the `k`
+// strings in `items` (bucket `b`, with hashes in `h`) a free slot of its own,
+// and take the slots (in `slots`, the slots of `phf`). Store it into `disp`
+// (the displacements of `phf`). Return false if there's none.
+static bool phf_place(const eini_phf_t *phf, unsigned *slots, uint32_t *disp,
+                      const uint64_t *h, const unsigned *items, unsigned k,
+                      unsigned b) {
+  for (uint32_t d = 0; d < 4 * (phf->mask + 1); d++) {
+    unsigned j; // iterator
+
+    for (j = 0; j < k; j++) {
+      unsigned slot = phf_slot(phf, h[items[j]], d); // slot of `items[j]`
+      if (PHF_EMPTY != slots[slot])
+        break;
+      slots[slot] = items[j];
     }
-    case EINI_SECTION: {
-      // Populate `sec`
-      wcslcpy(sec, lne.value, EINI_SHORT);
-      break;
+    if (j == k) {
+      disp[b] = d;
+      return true;
     }
-    case EINI_VALUE: {
-      // Call `hf()` (but if `sec` hasn't been populated yet, call `ef()`)
-      if (0 == wcslen(sec)) {
-        swprintf(errmsg, EINI_LONG, L"Option '%ls' does not have a section",
-                 lne.key);
-        call_ef_and_return;
-      } else
-        hf(sec, lne.key, lne.value, path, i);
-      break;
+
+    // Give the slots taken so far back
+    while (j-- > 0)
+      slots[phf_slot(phf, h[items[j]], d)] = PHF_EMPTY;
+  }
+
+  return false;
+}
+
+// Helper of `eini_schema_new()`. Build a perfect hash table over the `n`
+// strings in `strs`, with numeric prefixes `prefixes`, into `phf` (allocating
+// it from `arena`): the strings are hashed into buckets, and each bucket gets a
+// displacement that sends all of its strings to free slots, largest buckets
+// first (so that a string is always found with a single probe). Return false
+// on memory allocation failure, or if two of the strings (and their prefixes)
+// are the same.
+static bool phf_build(eini_phf_t *phf, eini_arena_t *arena,
+                      const unsigned *prefixes, const eini_span_t *strs,
+                      unsigned n) {
+  unsigned m = 1;  // number of slots
+  unsigned nb;     // number of buckets
+  uint32_t *disp;  // displacements of `phf`
+  unsigned *slots; // slots of `phf`
+  uint64_t *h;     // hashes of `strs`
+  unsigned *order; // `strs`, grouped by bucket
+  unsigned *start; // start of each bucket in `order`
+  unsigned *fill;  // end of each bucket in `order` (while grouping)
+  unsigned max;    // size of the largest bucket
+  bool ok = false; // return value
+
+  // Leave some slots free, or the last buckets might not find a place
+  while (m < n + n / 4)
+    m *= 2;
+  nb = m < 4 ? 1 : m / 4;
+  phf->mask = m - 1;
+  phf->bmask = nb - 1;
+  phf->disp = disp = eini_arena_alloc(arena, nb * sizeof(uint32_t));
+  phf->slots = slots = eini_arena_alloc(arena, m * sizeof(unsigned));
+  h = malloc((n + 1) * sizeof(uint64_t));
+  order = malloc((n + 1) * sizeof(unsigned));
+  start = malloc((nb + 1) * sizeof(unsigned));
+  fill = malloc(nb * sizeof(unsigned));
+  if (NULL == disp || NULL == slots || NULL == h || NULL == order ||
+      NULL == start || NULL == fill)
+    goto wind_down;
+
+  for (phf->seed = 0; phf->seed < PHF_SEEDS; phf->seed++) {
+    // Group the strings by bucket
+    memset(fill, 0, nb * sizeof(unsigned));
+    for (unsigned j = 0; j < n; j++) {
+      h[j] = phf_hash(phf->seed, prefixes[j], strs[j].ptr, strs[j].len);
+      fill[phf_bucket(phf, h[j])]++;
     }
-    case EINI_ERROR: {
-      // Call `ef()`
-      wcslcpy(errmsg, lne.value, EINI_LONG);
-      call_ef_and_return;
-      break;
+    max = 0;
+    start[0] = 0;
+    for (unsigned b = 0; b < nb; b++) {
+      max = fill[b] > max ? fill[b] : max;
+      start[b + 1] = start[b] + fill[b];
+      fill[b] = start[b];
     }
-    case EINI_NONE:
-    default:
+    for (unsigned j = 0; j < n; j++)
+      order[fill[phf_bucket(phf, h[j])]++] = j;
+
+    // Place the buckets, largest first
+    for (unsigned j = 0; j < m; j++)
+      slots[j] = PHF_EMPTY;
+    memset(disp, 0, nb * sizeof(uint32_t));
+    ok = true;
+    for (unsigned k = max; k > 0 && ok; k--)
+      for (unsigned b = 0; b < nb && ok; b++)
+        if (start[b + 1] - start[b] == k)
+          ok = phf_place(phf, slots, disp, h, &order[start[b]], k, b);
+    if (ok)
       break;
-    }
   }
 
-  fclose(fp);
+wind_down:
+  free(h);
+  free(order);
+  free(start);
+  free(fill);
+  return ok;
+}
+
+// Helper of `schema_section()` and `schema_key()`. Return the index of the only
+// string in `phf` that might be the `len` characters in `str` (with numeric
+// prefix `prefix`), or `PHF_EMPTY`.
+static unsigned phf_find(const eini_phf_t *phf, unsigned prefix,
+                         const char *str, size_t len) {
+  uint64_t h = phf_hash(phf->seed, prefix, str, len); // hash of `str`
+
+  return phf->slots[phf_slot(phf, h, phf->disp[phf_bucket(phf, h)])];
+}
+
+// Helper of `schema_section()`, `schema_key()`, and `eini_schema_new()`. Test
+// whether spans `a` and `b` hold the same characters.
+static bool same_span(eini_span_t a, eini_span_t b) {
+  return a.len == b.len && 0 == memcmp(a.ptr, b.ptr, a.len);
+}
+
+// Helper of `section_id()` and `eini_schema_section()`. Return the id of
+// section `name` in `schema`, or -1 if it isn't there.
+static int schema_section(const eini_schema_t *schema, eini_span_t name) {
+  unsigned j = phf_find(&schema->t.sphf, 0, name.ptr, name.len); // candidate
+
+  return PHF_EMPTY != j && same_span(schema->t.sections[j], name) ? (int)j
+                                                                  : -1;
+}
+
+// Helper of `schema_dispatch()` and `eini_schema_key()`. Return the id of key
+// `key` in section `sid` of `schema`, or -1 if it isn't there.
+static int schema_key(const eini_schema_t *schema, unsigned sid,
+                      eini_span_t key) {
+  unsigned j = phf_find(&schema->t.kphf, sid, key.ptr, key.len); // candidate
+
+  return PHF_EMPTY != j && sid == schema->t.key_sections[j] &&
+                 same_span(schema->t.keys[j], key)
+             ? (int)j
+             : -1;
+}
+
+static void emit_error(eini_ctx_t *ctx, const char *error, const char *path,
+                       const unsigned line);
+
+// Helper of `dispatch()` and `parse()`. Pass key/value pair `key`=`value`,
+// found on line `line` of the file of `f` (in its current section), to the
+// schema handler function of `ctx`, by id. If it isn't in the schema, call the
+// error handler function instead (and go on parsing).
+static void schema_dispatch(eini_ctx_t *ctx, const frame_t *f, eini_span_t key,
+                            eini_span_t value, const unsigned line) {
+  int id = (unsigned)-1 == f->sid ? -1 : schema_key(ctx->schema, f->sid, key);
+
+  if (-1 == id)
+    emit_error(ctx,
+               errorf(ctx, "Unknown key '%.*s' in section '%.*s'",
+                      (int)key.len, key.ptr, (int)f->ssec.len, f->ssec.ptr),
+               f->path, line);
+  else if (NULL != ctx->hfk)
+    ctx->hfk(f->sid, id, value, f->path, line, ctx->data);
+}
+
+// Helper of `batch_add()`, `emit_error()`, and `batch_end()`. Pass the
+// key/value pairs in the batch of `ctx` to its batch handler function, and
+// empty the batch.
+static void batch_flush(eini_ctx_t *ctx) {
+  if (0 == ctx->nbatch)
+    return;
+
+  if (NULL != ctx->hfb)
+    ctx->hfb(ctx->batch, ctx->nbatch, ctx->sections, ctx->paths, ctx->data);
+  ctx->nbatch = 0;
+  eini_arena_reset(ctx->batch_arena);
+}
+
+// Helper of `parse_root()`. Pass what's left in the batch of `ctx` to its batch
+// handler function, and forget the section names and paths passed along with
+// it.
+static void batch_end(eini_ctx_t *ctx) {
+  batch_flush(ctx);
+  ctx->nsections = 0;
+  ctx->npaths = 0;
+  if (NULL != ctx->names)
+    eini_arena_reset(ctx->names);
+}
+
+// Helper of `section_id()` and `batch_path()`. Copy the `len` characters in
+// `name` into the arena for section names and paths of `ctx`, and return the
+// copy (or NULL on memory allocation failure).
+static char *batch_name(eini_ctx_t *ctx, const char *name, size_t len) {
+  if (NULL == ctx->names && NULL == (ctx->names = eini_arena_new()))
+    return NULL;
+  return eini_arena_strndup(ctx->names, name, len);
+}
+
+// Helper of `parse()` and `replay()`. If `ctx` has a batch or schema handler
+// function (and isn't recording), give the section of `f` an id (which is -1
+// for sections that aren't in the schema). Return false on memory allocation
+// failure.
+static bool section_id(eini_ctx_t *ctx, frame_t *f) {
+  char *name; // copy of the section name
+
+  if (NULL != ctx->rec)
+    return true;
+  if (HANDLERS_SCHEMA == ctx->kind) {
+    f->sid = (unsigned)schema_section(ctx->schema, f->ssec);
+    return true;
+  }
+  if (HANDLERS_BATCH != ctx->kind)
+    return true;
+
+  if (ctx->nsections == ctx->csections) {
+    unsigned csections = 0 == ctx->csections ? EINI_SHORT : 2 * ctx->csections;
+    eini_span_t *sections =
+        realloc(ctx->sections, csections * sizeof(eini_span_t));
+    if (NULL == sections)
+      return false;
+    ctx->sections = sections;
+    ctx->csections = csections;
+  }
+
+  name = batch_name(ctx, f->ssec.ptr, f->ssec.len);
+  if (NULL == name)
+    return false;
+  f->sid = ctx->nsections;
+  ctx->sections[ctx->nsections++] = (eini_span_t){name, f->ssec.len};
+  return true;
+}
+
+// Helper of `parse()` and `replay_push()`. If `ctx` has a batch handler
+// function (and isn't recording), give the path of `f` an id. Return false on
+// memory allocation failure.
+static bool batch_path(eini_ctx_t *ctx, frame_t *f) {
+  char *path; // copy of the path
+
+  if (HANDLERS_BATCH != ctx->kind || NULL != ctx->rec)
+    return true;
+
+  if (ctx->npaths == ctx->cpaths) {
+    unsigned cpaths = 0 == ctx->cpaths ? EINI_SHORT : 2 * ctx->cpaths;
+    const char **paths = realloc(ctx->paths, cpaths * sizeof(char *));
+    if (NULL == paths)
+      return false;
+    ctx->paths = paths;
+    ctx->cpaths = cpaths;
+  }
+
+  path = batch_name(ctx, f->path, strlen(f->path));
+  if (NULL == path)
+    return false;
+  f->pid = ctx->npaths;
+  ctx->paths[ctx->npaths++] = path;
+  return true;
+}
+
+// Helper of `dispatch()` and `parse()`. Add key/value pair `key`=`value`, found
+// on line `line` of the file of `f`, to the batch of `ctx`, and pass the batch
+// to the batch handler function once it's full. Return false on memory
+// allocation failure.
+static bool batch_add(eini_ctx_t *ctx, const frame_t *f, eini_span_t key,
+                      eini_span_t value, const unsigned line) {
+  char *k, *v; // copies of `key` and `value`
+
+  if (NULL == ctx->batch &&
+      NULL == (ctx->batch = malloc(ctx->batch_size * sizeof(*ctx->batch))))
+    return false;
+  if (NULL == ctx->batch_arena && NULL == (ctx->batch_arena = eini_arena_new()))
+    return false;
+  k = eini_arena_strndup(ctx->batch_arena, key.ptr, key.len);
+  v = eini_arena_strndup(ctx->batch_arena, value.ptr, value.len);
+  if (NULL == k || NULL == v)
+    return false;
+
+  ctx->batch[ctx->nbatch++] = (eini_batch_entry_t){
+      f->sid, {k, key.len}, {v, value.len}, f->pid, line};
+  if (ctx->nbatch == ctx->batch_size)
+    batch_flush(ctx);
+  return true;
+}
+
+// Helper of `parse()` and `replay()`. Pass key/value pair `key`=`value`, found
+// on line `line` of the file of `f` (in its current section), to the handler
+// function in `ctx`. Return NULL, or an error message if the key/value pair
+// couldn't be converted to `wchar_t*` or added to the batch.
+static const char *dispatch(eini_ctx_t *ctx, const frame_t *f, const char *key,
+                            const char *value, const unsigned line) {
+  switch (ctx->kind) {
+  case HANDLERS_SCHEMA: {
+    eini_span_t skey = {key, strlen(key)};       // `key` as a span
+    eini_span_t svalue = {value, strlen(value)}; // `value` as a span
+    schema_dispatch(ctx, f, skey, svalue, line);
+    break;
+  }
+  case HANDLERS_BATCH: {
+    eini_span_t skey = {key, strlen(key)};       // `key` as a span
+    eini_span_t svalue = {value, strlen(value)}; // `value` as a span
+    if (!batch_add(ctx, f, skey, svalue, line))
+      return "Out of memory";
+    break;
+  }
+  case HANDLERS_SPAN: {
+    eini_span_t skey = {key, strlen(key)};       // `key` as a span
+    eini_span_t svalue = {value, strlen(value)}; // `value` as a span
+    if (NULL != ctx->hfs)
+      ctx->hfs(f->ssec, skey, svalue, f->path, line, ctx->data);
+    break;
+  }
+  case HANDLERS_UTF8:
+    if (NULL != ctx->hf8)
+      ctx->hf8(f->ssec.ptr, key, value, f->path, line, ctx->data);
+    break;
+  case HANDLERS_WIDE:
+  default: {
+    wchar_t *wkey = to_wcs(ctx, key, &ctx->wkey);       // `wchar_t*` `key`
+    wchar_t *wvalue = to_wcs(ctx, value, &ctx->wvalue); // `wchar_t*` `value`
+    if (NULL == wkey || NULL == wvalue)
+      return "Non-string data";
+    if (NULL != ctx->hf)
+      ctx->hf(f->wsec, wkey, wvalue, f->path, line);
+    break;
+  }
+  }
+
+  return NULL;
+}
+
+// Helper of `parse()` and friends. Call the error handler in `ctx`, converting
+// `error` to `wchar_t*` if necessary. If `ctx` has an arena, copy `error` into
+// it first. If `ctx` is recording, record the error instead. If `ctx` has a
+// batch handler function, pass the key/value pairs found before the error to
+// it first.
+static void emit_error(eini_ctx_t *ctx, const char *error, const char *path,
+                       const unsigned line) {
+  if (NULL != ctx->arena) {
+    char *copy = eini_arena_strndup(ctx->arena, error, strlen(error));
+    if (NULL != copy)
+      error = copy;
+  }
+
+  if (NULL != ctx->rec) {
+    record(ctx, EINI_ERROR, line, NULL, error, NULL);
+    return;
+  }
+
+  if (HANDLERS_BATCH == ctx->kind)
+    batch_flush(ctx);
+  if (HANDLERS_WIDE != ctx->kind) {
+    if (NULL != ctx->ef8)
+      ctx->ef8(error, path, line, ctx->data);
+  } else if (NULL != ctx->ef) {
+    buf_t buf = {NULL, 0};                      // buffer for `werror`
+    wchar_t *werror = to_wcs(ctx, error, &buf); // `wchar_t*` version of `error`
+
+    ctx->ef(NULL == werror ? L"Non-string data" : werror, path, line);
+    free(buf.ptr);
+  }
+}
+
+// Helper of `reader_open()` and `reader_fd()`. Set up `rd` to read from `fd`,
+// mapping the file into memory if `map` is true (and the file can be mapped).
+// Only a file read from the start can be mapped: `start` is true if `fd` has
+// just been opened, so that there's no need to ask where it is (which pipes
+// can't tell anyway).
+static void reader_init(reader_t *rd, int fd, bool map, bool start) {
+  struct stat st; // file status
+
+  rd->fd = fd;
+  rd->map = NULL;
+  rd->size = 0;
+  rd->pos = 0;
+  rd->end = 0;
+  rd->eof = false;
+  rd->mapped = false;
+  rd->dev = 0;
+  rd->ino = 0;
+
+  if (0 != fstat(fd, &st))
+    return;
+  rd->dev = st.st_dev;
+  rd->ino = st.st_ino;
+
+  if (map && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (start || 0 == lseek(fd, 0, SEEK_CUR))) {
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd,
+                      0); // mapped file contents
+    if (MAP_FAILED != addr) {
+      madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      rd->map = addr;
+      rd->size = st.st_size;
+      rd->mapped = true;
+    }
+  }
+}
+
+// Helper of `parse()`, `parse_file()`, and `rec_parse()`. Open .ini file in
+// `path` for reading with `rd`, mapping it into memory if `map` is true. Return
+// false if the file couldn't be opened.
+static bool reader_open(reader_t *rd, const char *path, bool map) {
+  int fd = open(path, O_RDONLY); // file descriptor
+
+  if (-1 == fd)
+    return false;
+
+  reader_init(rd, fd, map, true);
+  return true;
+}
+
+// Helper of `eini_ctx_fd()`. Set up `rd` to read from (a duplicate of) file
+// descriptor `fd`, mapping the file into memory if `map` is true. Return false
+// if `fd` couldn't be used.
+static bool reader_fd(reader_t *rd, int fd, bool map) {
+  int dfd = dup(fd); // duplicate of `fd`
+
+  if (-1 == dfd)
+    return false;
+
+  reader_init(rd, dfd, map, false);
+  return true;
+}
+
+// Helper of `eini_ctx_buffer()` and `parse()`. Set up `rd` to read from the
+// `len` characters in `data`.
+static void reader_buffer(reader_t *rd, const char *data, size_t len) {
+  rd->fd = -1;
+  rd->map = data;
+  rd->size = len;
+  rd->pos = 0;
+  rd->end = 0;
+  rd->eof = true;
+  rd->mapped = false;
+  rd->dev = 0;
+  rd->ino = 0;
+}
+
+// Helper of `parse()`. Read the next line from `rd` (into chunk buffer `buf`,
+// unless the file is mapped), and store its location in `ln`. Return 1 if a
+// line was read, 0 on end of file, -1 on error, or -2 if the line is longer
+// than `max` characters.
+static int reader_next(reader_t *rd, eini_span_t *ln, buf_t *buf, size_t max) {
+  if (NULL != rd->map) {
+    // Mapped file; just locate the line
+    const char *nl; // newline at the end of the line
+
+    if (rd->pos >= rd->size)
+      return 0;
+    ln->ptr = &rd->map[rd->pos];
+    nl = memchr(ln->ptr, '\n', rd->size - rd->pos);
+    ln->len = NULL == nl ? rd->size - rd->pos : (size_t)(nl - ln->ptr);
+    rd->pos += ln->len + 1;
+    return ln->len > max ? -2 : 1;
+  }
+
+  // Chunked file; look for the end of the line in what has been read, and read
+  // more until it's found (lines can span any number of chunks)
+  while (true) {
+    size_t avail = rd->end - rd->pos; // bytes left in `buf`
+    const char *nl = 0 == avail ? NULL
+                                : memchr(&buf->ptr[rd->pos], '\n', avail);
+    ssize_t len;                      // return value of `read()`
+
+    if (NULL != nl || (rd->eof && 0 != avail)) {
+      ln->ptr = &buf->ptr[rd->pos];
+      ln->len = NULL == nl ? avail : (size_t)(nl - ln->ptr);
+      rd->pos += NULL == nl ? avail : ln->len + 1;
+      return ln->len > max ? -2 : 1;
+    }
+    if (rd->eof)
+      return 0;
+
+    // No need to read the rest of a line that's already too long
+    if (avail > max)
+      return -2;
+
+    // Move the start of the line to the start of `buf`, and make room for
+    // another chunk (growing `buf` only for lines longer than a chunk)
+    if (0 != rd->pos)
+      memmove(buf->ptr, &buf->ptr[rd->pos], avail);
+    rd->pos = 0;
+    rd->end = avail;
+    if (NULL == buf_reserve(buf, avail + (avail < CHUNK_SIZE / 2
+                                              ? CHUNK_SIZE - avail
+                                              : CHUNK_SIZE / 2)))
+      return -1;
+
+    len = read(rd->fd, &buf->ptr[rd->end], buf->cap - rd->end);
+    if (-1 == len && EINTR == errno)
+      continue;
+    if (-1 == len)
+      return -1;
+    rd->eof = 0 == len;
+    rd->end += len;
+  }
+}
+
+// Helper of `parse()`. Close `rd`.
+static void reader_close(reader_t *rd) {
+  if (rd->mapped)
+    munmap((void *)rd->map, rd->size);
+  if (-1 != rd->fd)
+    close(rd->fd);
+  rd->map = NULL;
+  rd->fd = -1;
+}
+
+// Helper of `hash_file()`. Hash `path`.
+static uint64_t hash_path(const char *path) {
+  uint64_t h = 14695981039346656037u; // return value
+
+  for (; '\0' != *path; path++) {
+    h ^= (unsigned char)*path;
+    h *= 1099511628211u;
+  }
+
+  return h;
+}
+
+// Helper of `frame_find()` and `seen_find()`. Test whether `a` and `b` are the
+// same file.
+static bool same_file(file_id_t a, file_id_t b) {
+  if (0 == a.dev && 0 == a.ino)
+    return 0 == b.dev && 0 == b.ino && 0 == strcmp(a.path, b.path);
+  return a.dev == b.dev && a.ino == b.ino;
+}
+
+// Helper of `seen_slot()` and `hash_key()`. Hash the identity of `id`.
+static uint64_t hash_file(file_id_t id) {
+  if (0 == id.dev && 0 == id.ino)
+    return hash_path(id.path);
+  return ((uint64_t)id.dev * 1099511628211u) ^ (uint64_t)id.ino;
+}
+
+// Helper of `parse()` and `replay()`. Return the position of `id` in the stack
+// of files of `ctx`, or -1 if it isn't being parsed.
+static int frame_find(const eini_ctx_t *ctx, file_id_t id) {
+  for (unsigned j = 0; j < ctx->nframes; j++)
+    if (same_file(ctx->frames[j].id, id))
+      return j;
+  return -1;
+}
+
+// Helper of `seen_find()` and `seen_insert()`. Return the slot for `id` in the
+// `seen` hash table of `ctx` (which is empty if `id` hasn't been seen).
+static file_id_t *seen_slot(const eini_ctx_t *ctx, file_id_t id) {
+  unsigned j = hash_file(id) & (ctx->cseen - 1); // iterator
+
+  while (NULL != ctx->seen[j].path && !same_file(ctx->seen[j], id))
+    j = (j + 1) & (ctx->cseen - 1);
+  return &ctx->seen[j];
+}
+
+// Helper of `parse()` and `replay()`. Test whether `id` has already been
+// parsed (`include_once` mode only).
+static bool seen_find(const eini_ctx_t *ctx, file_id_t id) {
+  return 0 != ctx->cseen && NULL != seen_slot(ctx, id)->path;
+}
+
+// Helper of `frame_push()`. Remember `id` as seen. Return false on memory
+// allocation failure.
+static bool seen_insert(eini_ctx_t *ctx, file_id_t id) {
+  file_id_t *slot; // slot for `id`
+
+  if (2 * (ctx->nseen + 1) > ctx->cseen) {
+    // Grow the hash table, keeping it at most half full
+    unsigned cseen = 0 == ctx->cseen ? EINI_SHORT : 2 * ctx->cseen;
+    file_id_t *seen = ctx->seen;  // old hash table
+    unsigned old = ctx->cseen;    // capacity of `seen`
+    ctx->seen = calloc(cseen, sizeof(file_id_t));
+    if (NULL == ctx->seen) {
+      ctx->seen = seen;
+      return false;
+    }
+    ctx->cseen = cseen;
+    for (unsigned j = 0; j < old; j++)
+      if (NULL != seen[j].path)
+        *seen_slot(ctx, seen[j]) = seen[j];
+    free(seen);
+  }
+
+  slot = seen_slot(ctx, id);
+  if (NULL != slot->path)
+    return true;
+  id.path = strdup(id.path);
+  if (NULL == id.path)
+    return false;
+  *slot = id;
+  ctx->nseen++;
+  return true;
+}
+
+// Helper of `parse_root()` and `free_buffers()`. Forget every file seen so far.
+static void seen_clear(eini_ctx_t *ctx) {
+  for (unsigned j = 0; j < ctx->cseen; j++)
+    free((char *)ctx->seen[j].path);
+  free(ctx->seen);
+  ctx->seen = NULL;
+  ctx->nseen = 0;
+  ctx->cseen = 0;
+}
+
+// Helper of `parse()` and `replay()`. Push a frame for the file `id` onto the
+// stack of files of `ctx` (and, in `include_once` mode, remember it as seen),
+// and return it. Frames already on the stack may move. Return NULL on memory
+// allocation failure (in which case nothing moves).
+static frame_t *frame_push(eini_ctx_t *ctx, file_id_t id) {
+  frame_t *f; // return value
+
+  if (ctx->include_once && !seen_insert(ctx, id))
+    return NULL;
+
+  if (ctx->nframes == ctx->cframes) {
+    unsigned cframes = 0 == ctx->cframes ? EINI_SHORT / 8 : 2 * ctx->cframes;
+    frame_t *frames = realloc(ctx->frames, cframes * sizeof(frame_t));
+    if (NULL == frames)
+      return NULL;
+    memset(&frames[ctx->cframes], 0,
+           (cframes - ctx->cframes) * sizeof(frame_t));
+    ctx->frames = frames;
+    ctx->cframes = cframes;
+  }
+
+  f = &ctx->frames[ctx->nframes++];
+  f->id = id;
+  f->path = id.path;
+  f->rec = NULL;
+  f->i = 0;
+  f->ssec = (eini_span_t){"", 0};
+  f->sid = 0;
+  f->pid = 0;
+  f->wsec = NULL;
+  return f;
+}
+
+// Helper of `parse()` and `replay()`. Return an error message for the
+// inclusion of `path` from the file on top of the stack of files of `ctx`,
+// which starts a cycle at position `j` of the stack. The message lists the
+// whole cycle, and is valid until the next call.
+static const char *circular(eini_ctx_t *ctx, unsigned j, const char *path) {
+  const char *head = "Circular inclusion of '%s': "; // message start
+  size_t len = strlen(head) + strlen(path);           // message length
+  char *ret;                                          // return value
+
+  // Count "'<path>' -> " for every file in the cycle, and "'<path>'" for
+  // `path` (the "%s" in `head` makes up for its quotes)
+  for (unsigned k = j; k < ctx->nframes; k++)
+    len += strlen(ctx->frames[k].id.path) + 6;
+  len += strlen(path);
+  ret = buf_reserve(&ctx->errmsg, len + 1);
+  if (NULL == ret)
+    return "Out of memory";
+
+  snprintf(ret, len + 1, head, path);
+  for (unsigned k = j; k < ctx->nframes; k++) {
+    strlcat(ret, "'", len + 1);
+    strlcat(ret, ctx->frames[k].id.path, len + 1);
+    strlcat(ret, "' -> ", len + 1);
+  }
+  strlcat(ret, "'", len + 1);
+  strlcat(ret, path, len + 1);
+  strlcat(ret, "'", len + 1);
+  return ret;
+}
+
+static record_t *submit(pool_t *pool, const record_t *from, const char *path,
+                        eini_span_t cont, bool resolved);
+// Parse the .ini file that `rd` reads from, passing whatever is found to the
+// handlers in `ctx`. `path` is the path of the .ini file, used for error
+// reporting and include resolution. Close `rd` when done. Whenever an `include`
+// directive is encountered, push the included file onto the stack of files of
+// `ctx` (up to `max_depth` levels deep), and go on with it; thus, the C stack
+// isn't used up by deep include trees. Cycles are caught (and, in
+// `include_once` mode, files already parsed are skipped). If `ctx` is
+// recording, record everything instead, and submit included files to its
+// worker pool.
+static void parse(eini_ctx_t *ctx, reader_t *rd, const char *path) {
+  frame_t *f;         // file being parsed (on top of the stack)
+  eini_span_t ln;     // current .ini file line text
+  line_t lne;         // current .ini file line parsed contents
+  eini_utf8_t str;    // `lne`, converted to strings
+  const char *errmsg; // error message
+  int res;            // return value of `reader_next()`
+
+  f = frame_push(ctx, (file_id_t){rd->dev, rd->ino, path});
+  if (NULL == f || !batch_path(ctx, f)) {
+    if (NULL != f)
+      ctx->nframes--;
+    emit_error(ctx, "Out of memory", path, 0);
+    reader_close(rd);
+    return;
+  }
+  f->rd = *rd;
+
+  while (0 != ctx->nframes) {
+    // Read the next line of the file on top of the stack
+    f = &ctx->frames[ctx->nframes - 1];
+    res = reader_next(&f->rd, &ln, &f->chunk, ctx->max_line);
+    if (-2 == res) {
+      f->i++;
+      errmsg = "Line too long";
+      call_ef_and_return;
+    } else if (-1 == res) {
+      if (NULL != ctx->rec)
+        ctx->rec->uncacheable = true;
+      errmsg = "Unable to read line";
+      call_ef_and_return;
+    } else if (0 == res)
+      goto wind_down;
+
+    // Parse it into `lne`
+    f->i++;
+    lne = parse_line(ctx, ln.ptr, ln.len, HANDLERS_WIDE != ctx->kind);
+
+    // Perform different actions, epending on what we got
+    switch (lne.type) {
+    case EINI_INCLUDE: {
+      // Push included .ini file onto the stack
+      char *ipath;       // included file path
+      eini_span_t icont; // included file contents (from the resolver)
+      int ires;          // return value of the resolver
+      reader_t ird;      // reader for the included file
+      file_id_t iid;     // identity of the included file
+      int j;             // position of `iid` in the stack
+      str = to_str(ctx, lne);
+      check_str;
+      populate_ipath;
+      if (NULL != ctx->rec) {
+        // Have the worker pool parse the included file, and record it
+        record_t *inc = submit(ctx->pool, ctx->rec, ipath, icont, 1 == ires);
+        if (NULL == inc ||
+            !record(ctx, EINI_INCLUDE, f->i, str.value, ipath, inc)) {
+          errmsg = "Out of memory";
+          call_ef_and_return;
+        }
+        break;
+      }
+      if (ctx->nframes > ctx->max_depth) {
+        errmsg = errorf(ctx, "Inclusion of '%s' nested too deeply", ipath);
+        call_ef_and_return;
+      }
+      if (1 == ires)
+        reader_buffer(&ird, icont.ptr, icont.len);
+      else if (!reader_open(&ird, ipath, ctx->mmap)) {
+        errmsg = errorf(ctx, "Unable to open '%s'", ipath);
+        call_ef_and_return;
+      }
+      iid = (file_id_t){ird.dev, ird.ino, ipath};
+      if (-1 != (j = frame_find(ctx, iid))) {
+        reader_close(&ird);
+        errmsg = circular(ctx, j, ipath);
+        call_ef_and_return;
+      }
+      if (ctx->include_once && seen_find(ctx, iid)) {
+        reader_close(&ird);
+        break;
+      }
+      if (NULL == frame_push(ctx, iid)) {
+        reader_close(&ird);
+        errmsg = "Out of memory";
+        call_ef_and_return;
+      }
+      f = &ctx->frames[ctx->nframes - 1];
+      f->rd = ird;
+      if (!batch_path(ctx, f)) {
+        errmsg = "Out of memory";
+        call_ef_and_return;
+      }
+      break;
+    }
+    case EINI_SECTION: {
+      // Populate `f->ssec` (which points to `f->secbuf`, unless the file is
+      // mapped and there's no arena)
+      if (HANDLERS_SPAN == ctx->kind && NULL != f->rd.map &&
+          NULL == ctx->arena && !lne.escaped) {
+        f->ssec = lne.value;
+        break;
+      }
+      str = to_str(ctx, lne);
+      check_str;
+      if (NULL != ctx->arena)
+        f->ssec.ptr = str.value;
+      else {
+        char *sec = buf_reserve(&f->secbuf, strlen(str.value) + 1);
+        if (NULL == sec) {
+          errmsg = "Out of memory";
+          call_ef_and_return;
+        }
+        strcpy(sec, str.value);
+        f->ssec.ptr = sec;
+      }
+      f->ssec.len = strlen(f->ssec.ptr);
+      if (NULL != ctx->rec) {
+        if (!record(ctx, EINI_SECTION, f->i, NULL, f->ssec.ptr, NULL)) {
+          errmsg = "Out of memory";
+          call_ef_and_return;
+        }
+      } else if (!section_id(ctx, f)) {
+        errmsg = "Out of memory";
+        call_ef_and_return;
+      } else if (HANDLERS_WIDE == ctx->kind &&
+                 NULL == (f->wsec = to_wcs(ctx, f->ssec.ptr, &f->wsecbuf))) {
+        errmsg = "Non-string data";
+        call_ef_and_return;
+      }
+      break;
+    }
+    case EINI_VALUE: {
+      // Call `hf()` (but if `f->ssec` hasn't been populated yet, call `ef()`)
+      if (0 == f->ssec.len) {
+        errmsg = errorf(ctx, "Option '%.*s' does not have a section",
+                        (int)lne.key.len, lne.key.ptr);
+        call_ef_and_return;
+      }
+      if ((HANDLERS_SPAN == ctx->kind || HANDLERS_BATCH == ctx->kind ||
+           HANDLERS_SCHEMA == ctx->kind) &&
+          NULL == ctx->arena && NULL == ctx->rec) {
+        // Pass spans as they are, unless the value needs unescaping
+        if (lne.escaped) {
+          str = to_str(ctx, lne);
+          check_str;
+          lne.value.ptr = str.value;
+          lne.value.len = strlen(str.value);
+        }
+        if (HANDLERS_BATCH == ctx->kind) {
+          if (!batch_add(ctx, f, lne.key, lne.value, f->i)) {
+            errmsg = "Out of memory";
+            call_ef_and_return;
+          }
+        } else if (HANDLERS_SCHEMA == ctx->kind)
+          schema_dispatch(ctx, f, lne.key, lne.value, f->i);
+        else if (NULL != ctx->hfs)
+          ctx->hfs(f->ssec, lne.key, lne.value, f->path, f->i, ctx->data);
+        break;
+      }
+      str = to_str(ctx, lne);
+      check_str;
+      if (NULL != ctx->rec) {
+        if (!record(ctx, EINI_VALUE, f->i, str.key, str.value, NULL)) {
+          errmsg = "Out of memory";
+          call_ef_and_return;
+        }
+      } else if (NULL !=
+                 (errmsg = dispatch(ctx, f, str.key, str.value, f->i))) {
+        call_ef_and_return;
+      }
+      break;
+    }
+    case EINI_ERROR: {
+      // Call `ef()`
+      str = to_str(ctx, lne);
+      errmsg = str.value;
+      call_ef_and_return;
+      break;
+    }
+    case EINI_NONE:
+    default:
+      break;
+    }
+    continue;
+
+  wind_down:
+    // Close the file, and go back to the one that included it (its buffers are
+    // kept for reuse, except for a chunk buffer grown by a long line)
+    reader_close(&f->rd);
+    if (f->chunk.cap > CHUNK_SIZE) {
+      free(f->chunk.ptr);
+      f->chunk = (buf_t){NULL, 0};
+    }
+    ctx->nframes--;
+  }
+}
+
+// Parse .ini file in `path`, passing whatever is found to the handlers in
+// `ctx`.
+static void parse_file(eini_ctx_t *ctx, const char *path) {
+  reader_t rd; // reader for .ini file
+
+  if (!reader_open(&rd, path, ctx->mmap)) {
+    emit_error(ctx, errorf(ctx, "Unable to open '%s'", path), path, 0);
+    return;
+  }
+
+  parse(ctx, &rd, path);
+}
+
+// Helper of `rec_update()`. Hash the `len` characters in `src`.
+static uint64_t hash_data(const char *src, size_t len) {
+  uint64_t h = 14695981039346656037u; // return value
+
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)src[i];
+    h *= 1099511628211u;
+  }
+
+  return h;
+}
+
+// Helper of `cache_insert()` and `cache_find()`. Return the key of `rec`.
+static rec_key_t rec_key(const record_t *rec) {
+  return (rec_key_t){{rec->dev, rec->ino, rec->path}, rec->ddev, rec->dino};
+}
+
+// Helper of `cache_insert()` and `cache_find()`. Hash `key`.
+static uint64_t hash_key(rec_key_t key) {
+  return hash_file(key.file) ^ ((uint64_t)key.ddev * 1099511628211u) ^
+         ((uint64_t)key.dino << 17);
+}
+
+// Helper of `cache_find()`. Test whether `a` and `b` are the same key.
+static bool same_key(rec_key_t a, rec_key_t b) {
+  return same_file(a.file, b.file) && a.ddev == b.ddev && a.dino == b.dino;
+}
+
+// Helper of `submit()` and `tree_parse()`. Return the key of the record for the
+// file in `path` (read from `rd`, unless it's NULL). Files given by the
+// resolver, and missing ones, are keyed by path (as is every file, if `ctx`
+// has a resolver, since it may tell paths of the same file apart).
+static rec_key_t key_of(const eini_ctx_t *ctx, const char *path,
+                        const reader_t *rd) {
+  rec_key_t key = {{0, 0, path}, 0, 0}; // return value
+  struct stat st;                       // file status
+  char *dir;                            // copy of `path`, for `dirname()`
+
+  if (NULL != ctx->rf)
+    return key;
+  if (NULL != rd)
+    key.file = (file_id_t){rd->dev, rd->ino, path};
+  else if (0 == stat(path, &st))
+    key.file = (file_id_t){st.st_dev, st.st_ino, path};
+  if (0 == key.file.dev && 0 == key.file.ino)
+    return key;
+
+  dir = strdup(path);
+  if (NULL != dir && 0 == stat(dirname(dir), &st)) {
+    key.ddev = st.st_dev;
+    key.dino = st.st_ino;
+  }
+  free(dir);
+  return key;
+}
+
+// Helper of `cache_find()` and `cache_prune()`. Insert `rec` into the hash
+// table of `cache`, which must have room for it.
+static void cache_insert(eini_cache_t *cache, record_t *rec) {
+  unsigned j = hash_key(rec_key(rec)) & (cache->crecs - 1); // iterator
+
+  while (NULL != cache->recs[j])
+    j = (j + 1) & (cache->crecs - 1);
+  cache->recs[j] = rec;
+  cache->nrecs++;
+}
+
+// Helper of `cache_find()`, `cache_prune()`, and `eini_cache_free()`. Free
+// record `rec`.
+static void rec_free(record_t *rec) {
+  eini_arena_free(rec->arena);
+  free(rec->events);
+  free(rec->path);
+  free(rec);
+}
+
+// Helper of `submit()` and `tree_parse()`. Return the record for `key` in
+// `cache`, creating it if necessary (or NULL on memory allocation failure).
+// Records are keyed by file identity, so that the paths of a file that
+// `parse()` would treat the same (such as `a.ini` and `./a.ini`) lead to the
+// same record.
+static record_t *cache_find(eini_cache_t *cache, rec_key_t key) {
+  record_t *rec; // return value
+  unsigned j;    // iterator
+
+  if (0 != cache->crecs) {
+    j = hash_key(key) & (cache->crecs - 1);
+    while (NULL != (rec = cache->recs[j])) {
+      if (same_key(rec_key(rec), key))
+        return rec;
+      j = (j + 1) & (cache->crecs - 1);
+    }
+  }
+
+  // Not found; make room for a new record, and create it
+  if (2 * (cache->nrecs + 1) > cache->crecs) {
+    unsigned crecs = 0 == cache->crecs ? EINI_SHORT : 2 * cache->crecs;
+    record_t **recs = cache->recs; // old hash table
+    unsigned old = cache->crecs;   // capacity of `recs`
+    cache->recs = calloc(crecs, sizeof(record_t *));
+    if (NULL == cache->recs) {
+      cache->recs = recs;
+      return NULL;
+    }
+    cache->crecs = crecs;
+    cache->nrecs = 0;
+    for (j = 0; j < old; j++)
+      if (NULL != recs[j])
+        cache_insert(cache, recs[j]);
+    free(recs);
+  }
+
+  rec = calloc(1, sizeof(record_t));
+  if (NULL == rec)
+    return NULL;
+  rec->path = strdup(key.file.path);
+  rec->dev = key.file.dev;
+  rec->ino = key.file.ino;
+  rec->ddev = key.ddev;
+  rec->dino = key.dino;
+  rec->arena = eini_arena_new();
+  if (NULL == rec->path || NULL == rec->arena) {
+    rec_free(rec);
+    return NULL;
+  }
+  cache_insert(cache, rec);
+
+  return rec;
+}
+
+// Helper of `submit()` and `tree_parse()`. Make `rec`, first needed in this
+// generation, open its file through `path` (the old path might lead elsewhere
+// by now). Return false on memory allocation failure.
+static bool rec_rename(record_t *rec, const char *path) {
+  char *copy; // copy of `path`
+
+  if (0 == strcmp(rec->path, path))
+    return true;
+  if (NULL == (copy = strdup(path)))
+    return false;
+  free(rec->path);
+  rec->path = copy;
+  return true;
+}
+
+// Helper of `parse_tree()`. Free the records in `cache` that weren't needed by
+// the latest parse, or all records if `all` is true.
+static void cache_prune(eini_cache_t *cache, bool all) {
+  record_t **recs = cache->recs; // old hash table
+  unsigned old = cache->crecs;   // capacity of `recs`
+
+  if (0 == old)
+    return;
+
+  cache->recs = calloc(old, sizeof(record_t *));
+  if (NULL == cache->recs) {
+    // Out of memory; keep everything
+    cache->recs = recs;
+    return;
+  }
+  cache->nrecs = 0;
+  for (unsigned j = 0; j < old; j++) {
+    if (NULL == recs[j])
+      continue;
+    if (all || recs[j]->gen != cache->gen)
+      rec_free(recs[j]);
+    else
+      cache_insert(cache, recs[j]);
+  }
+  free(recs);
+}
+
+// Helper of `rec_update()` and `parse_tree()`. Forget everything recorded in
+// `rec`.
+static void rec_reset(record_t *rec) {
+  eini_arena_reset(rec->arena);
+  rec->nevents = 0;
+  rec->parsed = false;
+  rec->uncacheable = false;
+  rec->missing = false;
+  rec->hash = 0;
+  memset(&rec->st, 0, sizeof(struct stat));
+}
+
+// Helper of `rec_lower()`. Queue `rec` to be brought up to date by a worker of
+// `pool`, unless that's already been taken care of in this generation. Return
+// false on memory allocation failure. `pool` must be locked.
+static bool enqueue(pool_t *pool, record_t *rec) {
+  if (rec->qgen == pool->cache->gen)
+    return true;
+
+  if (pool->nqueue == pool->cqueue) {
+    unsigned cqueue = 0 == pool->cqueue ? EINI_SHORT : 2 * pool->cqueue;
+    record_t **queue = realloc(pool->queue, cqueue * sizeof(record_t *));
+    if (NULL == queue)
+      return false;
+    pool->queue = queue;
+    pool->cqueue = cqueue;
+  }
+
+  rec->qgen = pool->cache->gen;
+  rec->done = false;
+  pool->queue[pool->nqueue++] = rec;
+  pthread_cond_signal(&pool->cond);
+  return true;
+}
+
+// Helper of `relax()`. Note that `rec` is included `depth` files deep. If it
+// wasn't known to be included that close to the .ini file, queue it to be
+// brought up to date (unless it's too deep to be parsed at all), or, if it's
+// been brought up to date already, push it onto the stack of `pool`, so that
+// the files it includes follow. Return false on memory allocation failure.
+// `pool` must be locked.
+static bool rec_lower(pool_t *pool, record_t *rec, unsigned depth) {
+  if (depth >= rec->depth)
+    return true;
+  rec->depth = depth;
+
+  // `parse()` only opens files up to one level past the maximum depth
+  if (rec->qgen != pool->cache->gen)
+    return depth - 1 > pool->ctx->max_depth || enqueue(pool, rec);
+  if (!rec->done)
+    return true;
+
+  if (pool->nstack == pool->cstack) {
+    unsigned cstack = 0 == pool->cstack ? EINI_SHORT : 2 * pool->cstack;
+    record_t **stack = realloc(pool->stack, cstack * sizeof(record_t *));
+    if (NULL == stack)
+      return false;
+    pool->stack = stack;
+    pool->cstack = cstack;
+  }
+  pool->stack[pool->nstack++] = rec;
+  return true;
+}
+
+// Helper of `submit()` and `rec_done()`. Note that `rec` is included `depth`
+// files deep, and pass the news on to the files it includes (and so on), so
+// that a file is brought up to date exactly when `parse()` would open it,
+// whichever way it's reached first. Included files are followed without
+// recursion. Return false on memory allocation failure. `pool` must be locked.
+static bool relax(pool_t *pool, record_t *rec, unsigned depth) {
+  if (!rec_lower(pool, rec, depth))
+    return false;
+
+  while (0 != pool->nstack) {
+    record_t *r = pool->stack[--pool->nstack]; // record whose depth went down
+    for (unsigned j = 0; j < r->nevents; j++)
+      if (EINI_INCLUDE == r->events[j].type &&
+          !rec_lower(pool, r->events[j].inc, r->depth + 1)) {
+        pool->nstack = 0;
+        return false;
+      }
+  }
+
+  return true;
+}
+
+// Helper of `parse()` and `rec_update()`. Return the record for file `path`
+// (with contents `cont`, if `resolved` is true), included by the file of
+// record `from`, queueing it to be brought up to date by a worker, if that
+// hasn't already happened and it isn't nested too deeply. A file already on
+// the include chain of `from` has the same identity, hence the same record,
+// which is queued already; thus, cycles don't cause any more parsing. Return
+// NULL on memory allocation failure.
+static record_t *submit(pool_t *pool, const record_t *from, const char *path,
+                        eini_span_t cont, bool resolved) {
+  rec_key_t key = key_of(pool->ctx, path, NULL); // key of the record
+  record_t *ret;                                 // return value
+
+  pthread_mutex_lock(&pool->lock);
+  ret = cache_find(pool->cache, key);
+  if (NULL != ret && ret->gen != pool->cache->gen) {
+    // First needed in this generation
+    if (!rec_rename(ret, path)) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    ret->gen = pool->cache->gen;
+    ret->cont = resolved ? cont : nospan;
+    ret->resolved = resolved;
+    ret->depth = UINT_MAX;
+  }
+  if (NULL != ret && !relax(pool, ret, from->depth + 1))
+    ret = NULL;
+  pthread_mutex_unlock(&pool->lock);
+
+  return ret;
+}
+
+// Helper of `worker()` and `parse_tree()`. Create a context for a worker of
+// `pool`, with the same settings as the context that started it. Return NULL
+// on memory allocation failure.
+static eini_ctx_t *worker_ctx(pool_t *pool) {
+  eini_ctx_t *w = eini_ctx_new(); // return value
+
+  if (NULL == w)
+    return NULL;
+
+  w->kind = pool->ctx->kind;
+  w->rf = pool->ctx->rf;
+  w->rdata = pool->ctx->rdata;
+  w->mmap = pool->ctx->mmap;
+  w->max_line = pool->ctx->max_line;
+  w->pool = pool;
+  return w;
+}
+
+// Helper of `rec_update()` and `parse_tree()`. Parse the .ini file of `rec`
+// (or the one `rd` reads from, if it isn't NULL) into `rec`, using worker
+// context `w`. If the file can't be opened, mark `rec` as missing, so that
+// `replay()` reports it where it's included.
+static void rec_parse(eini_ctx_t *w, record_t *rec, reader_t *rd) {
+  reader_t ird; // reader for file contents
+
+  w->rec = rec;
+  w->arena = rec->arena;
+  if (NULL == rd) {
+    rd = &ird;
+    if (rec->resolved)
+      reader_buffer(rd, rec->cont.ptr, rec->cont.len);
+    else if (!reader_open(rd, rec->path, w->mmap)) {
+      rec->missing = true;
+      emit_error(w, errorf(w, "Unable to open '%s'", rec->path), rec->path, 0);
+      rd = NULL;
+    }
+  }
+  if (NULL != rd)
+    parse(w, rd, rec->path);
+  rec->parsed = true;
+  w->rec = NULL;
+  w->arena = NULL;
+}
+
+// Helper of `rec_update()`. Read all of the file in `path` into memory, store
+// its size in `size` and its status in `st`, and return its contents (or NULL
+// on failure).
+static char *read_file(const char *path, size_t *size, struct stat *st) {
+  int fd = open(path, O_RDONLY); // file descriptor
+  char *ret = NULL;              // return value
+  ssize_t len;                   // return value of `read()`
+
+  if (-1 == fd)
+    return NULL;
+
+  if (0 == fstat(fd, st) && S_ISREG(st->st_mode) &&
+      NULL != (ret = malloc(st->st_size + 1))) {
+    for (*size = 0; *size < (size_t)st->st_size; *size += len) {
+      len = read(fd, &ret[*size], st->st_size - *size);
+      if (len <= 0)
+        break;
+    }
+    if (*size < (size_t)st->st_size) {
+      free(ret);
+      ret = NULL;
+    }
+  }
+
+  close(fd);
+  return ret;
+}
+
+// Helper of `work()` and `parse_tree()`. Bring `rec` up to date, using worker
+// context `w`. If its .ini file hasn't changed since it was last parsed, keep
+// what was recorded, and just make sure that the files it includes are up to
+// date as well. Otherwise, parse it again.
+static void rec_update(eini_ctx_t *w, record_t *rec) {
+  eini_cache_t *cache = w->pool->cache; // cache
+  bool cacheable = !rec->resolved && NULL == w->rf; // true if `rec` may be kept
+  struct stat st;                       // file status
+  char *data = NULL;                    // file contents (hash mode only)
+  size_t size = 0;                      // size of `data`
+  uint64_t hash = 0;                    // hash of `data`
+  reader_t rd;                          // reader for `data`
+
+  // Identify the file
+  if (cacheable && cache->hash) {
+    data = read_file(rec->path, &size, &st);
+    cacheable = NULL != data;
+    if (cacheable)
+      hash = hash_data(data, size);
+  } else if (cacheable)
+    cacheable = 0 == stat(rec->path, &st);
+
+  if (cacheable && rec->parsed && !rec->uncacheable &&
+      (cache->hash ? hash == rec->hash
+                   : st.st_dev == rec->st.st_dev &&
+                         st.st_ino == rec->st.st_ino &&
+                         st.st_size == rec->st.st_size &&
+                         st.st_mtim.tv_sec == rec->st.st_mtim.tv_sec &&
+                         st.st_mtim.tv_nsec == rec->st.st_mtim.tv_nsec)) {
+    // Unchanged; keep it, but check the files it includes
+    unsigned j; // iterator
+    for (j = 0; j < rec->nevents; j++)
+      if (EINI_INCLUDE == rec->events[j].type &&
+          NULL == (rec->events[j].inc = submit(w->pool, rec,
+                                               rec->events[j].value, nospan,
+                                               false)))
+        break;
+    if (j == rec->nevents) {
+      free(data);
+      return;
+    }
+  }
+
+  // Changed (or never parsed); parse it again
+  rec_reset(rec);
+  if (NULL != data) {
+    reader_buffer(&rd, data, size);
+    rd.dev = st.st_dev;
+    rd.ino = st.st_ino;
+    rec_parse(w, rec, &rd);
+    free(data);
+  } else
+    rec_parse(w, rec, NULL);
+  rec->uncacheable |= !cacheable;
+  rec->hash = hash;
+  if (cacheable && !cache->hash)
+    rec->st = st;
+}
+
+// Helper of `work()` and `tree_parse()`. Mark `rec` as brought up to date, and
+// pass its depth on to the files it includes (which were submitted while it
+// might have been deeper). Take note if memory runs out. `pool` must be
+// locked.
+static void rec_done(pool_t *pool, record_t *rec) {
+  rec->done = true;
+  for (unsigned j = 0; j < rec->nevents; j++)
+    if (EINI_INCLUDE == rec->events[j].type &&
+        !relax(pool, rec->events[j].inc, rec->depth + 1))
+      pool->oom = true;
+}
+
+// Helper of `worker()` and `tree_parse()`. Bring queued records of `pool` up
+// to date using worker context `w`, until there's nothing left to do.
+static void work(pool_t *pool, eini_ctx_t *w) {
+  record_t *rec; // current record
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (0 == pool->nqueue && pool->busy > 0)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (0 == pool->nqueue)
+      break;
+
+    rec = pool->queue[--pool->nqueue];
+    pool->busy++;
+    pthread_mutex_unlock(&pool->lock);
+    rec_update(w, rec);
+    pthread_mutex_lock(&pool->lock);
+    rec_done(pool, rec);
+    pool->busy--;
+    if (0 == pool->busy && 0 == pool->nqueue)
+      pthread_cond_broadcast(&pool->cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Worker thread body. Call `work()` for `arg` (a worker pool).
+static void *worker(void *arg) {
+  pool_t *pool = arg;               // worker pool
+  eini_ctx_t *w = worker_ctx(pool); // worker context
+
+  if (NULL != w) {
+    work(pool, w);
+    eini_ctx_free(w);
+  }
+
+  return NULL;
+}
+
+// Helper of `replay()`. Return `str`, or a copy of it allocated from the arena
+// of `ctx`, if it has one (or NULL on memory allocation failure).
+static const char *keep(eini_ctx_t *ctx, const char *str) {
+  return NULL == ctx->arena ? str
+                            : eini_arena_strndup(ctx->arena, str, strlen(str));
+}
+
+// Helper of `replay()`. Push a frame for `rec`, reached through `path` (which
+// must outlive the frame), onto the stack of files of `ctx`, and return it (or
+// NULL on memory allocation failure).
+static frame_t *replay_push(eini_ctx_t *ctx, record_t *rec, const char *path) {
+  frame_t *f; // return value
+
+  if (NULL == (f = frame_push(ctx, (file_id_t){rec->dev, rec->ino, path})))
+    return NULL;
+  f->rec = rec;
+  if (!batch_path(ctx, f)) {
+    ctx->nframes--;
+    return NULL;
+  }
+  return f;
+}
+
+// Helper of `parse_tree()`. Pass everything recorded in `rec`, the record of
+// `path` (and in the records of the files it includes) to the handlers in
+// `ctx`, exactly as `parse()` would have. Included records are pushed onto the
+// stack of files of `ctx`, just like `parse()` pushes included files, with
+// their paths as `parse()` would have found them (a record is shared by every
+// path that leads to its file).
+static void replay(eini_ctx_t *ctx, record_t *rec, const char *path) {
+  frame_t *f;              // record being replayed (on top of the stack)
+  const event_t *e;        // current event
+  const char *key, *value; // current key/value pair
+  const char *errmsg;      // error message
+  const char *ipath;       // path of an included file
+  file_id_t iid;           // identity of an included file
+  int k;                   // position of `iid` in the stack
+
+  if (NULL == (path = keep(ctx, path)) || NULL == replay_push(ctx, rec, path)) {
+    emit_error(ctx, "Out of memory", rec->path, 0);
+    return;
+  }
+
+  while (0 != ctx->nframes) {
+    f = &ctx->frames[ctx->nframes - 1];
+    if (f->i == f->rec->nevents)
+      goto wind_down;
+    e = &f->rec->events[f->i++];
+
+    switch (e->type) {
+    case EINI_SECTION:
+      f->ssec.ptr = keep(ctx, e->value);
+      f->ssec.len = strlen(e->value);
+      if (NULL == f->ssec.ptr) {
+        emit_error(ctx, "Out of memory", f->path, e->line);
+        goto wind_down;
+      }
+      if (!section_id(ctx, f)) {
+        emit_error(ctx, "Out of memory", f->path, e->line);
+        goto wind_down;
+      }
+      if (HANDLERS_WIDE == ctx->kind &&
+          NULL == (f->wsec = to_wcs(ctx, f->ssec.ptr, &f->wsecbuf))) {
+        emit_error(ctx, "Non-string data", f->path, e->line);
+        goto wind_down;
+      }
+      break;
+    case EINI_VALUE:
+      key = keep(ctx, e->key);
+      value = keep(ctx, e->value);
+      if (NULL == key || NULL == value) {
+        emit_error(ctx, "Out of memory", f->path, e->line);
+        goto wind_down;
+      }
+      if (NULL != (errmsg = dispatch(ctx, f, key, value, e->line))) {
+        emit_error(ctx, errmsg, f->path, e->line);
+        goto wind_down;
+      }
+      break;
+    case EINI_INCLUDE:
+      if (NULL == (ipath = include_path(ctx, f, e->key))) {
+        emit_error(ctx, "Out of memory", f->path, e->line);
+        goto wind_down;
+      }
+      if (ctx->nframes > ctx->max_depth) {
+        emit_error(ctx,
+                   errorf(ctx, "Inclusion of '%s' nested too deeply", ipath),
+                   f->path, e->line);
+        goto wind_down;
+      }
+      if (e->inc->missing) {
+        emit_error(ctx, errorf(ctx, "Unable to open '%s'", ipath), f->path,
+                   e->line);
+        goto wind_down;
+      }
+      iid = (file_id_t){e->inc->dev, e->inc->ino, ipath};
+      if (-1 != (k = frame_find(ctx, iid))) {
+        emit_error(ctx, circular(ctx, k, ipath), f->path, e->line);
+        goto wind_down;
+      }
+      if (ctx->include_once && seen_find(ctx, iid))
+        break;
+      if (NULL == replay_push(ctx, e->inc, ipath)) {
+        emit_error(ctx, "Out of memory", f->path, e->line);
+        goto wind_down;
+      }
+      break;
+    case EINI_ERROR:
+    default:
+      emit_error(ctx, e->value, f->path, e->line);
+      break;
+    }
+    continue;
+
+  wind_down:
+    ctx->nframes--;
+  }
+}
+
+// Helper of `parse_tree()` and `async_parse()`. Parse `path` (read from `rd`,
+// unless it is NULL) and every file it includes into records of `t`, to be
+// replayed to the handlers in `ctx`. Included files are parsed concurrently, if
+// `ctx` has worker threads: the .ini file itself is parsed by the calling
+// thread, which then helps the workers out. If `ctx` has a cache, files that
+// haven't changed since they were last parsed aren't parsed again. Nothing in
+// `ctx` is modified. Return false (with nothing left to free) on memory
+// allocation failure.
+static bool tree_parse(const eini_ctx_t *ctx, tree_t *t, reader_t *rd,
+                       const char *path) {
+  unsigned nthr = ctx->threads > 1 ? ctx->threads - 1 : 0; // worker threads
+  pthread_t *thr = calloc(nthr + 1, sizeof(pthread_t)); // worker threads
+
+  // Set things up
+  *t = (tree_t){.pool = {.ctx = ctx}};
+  t->pool.cache = NULL == ctx->cache ? &t->tmp : ctx->cache;
+  if (t->pool.cache->utf8 != (HANDLERS_WIDE != ctx->kind) ||
+      t->pool.cache->max_line != ctx->max_line) {
+    // The records were parsed differently; forget them
+    cache_prune(t->pool.cache, true);
+    t->pool.cache->utf8 = HANDLERS_WIDE != ctx->kind;
+    t->pool.cache->max_line = ctx->max_line;
+  }
+  t->pool.cache->gen++;
+  t->w = worker_ctx(&t->pool);
+  if (NULL != t->w &&
+      (NULL == (t->root = cache_find(t->pool.cache, key_of(ctx, path, rd))) ||
+       !rec_rename(t->root, path)))
+    t->root = NULL;
+  if (NULL == thr || NULL == t->root) {
+    free(thr);
+    eini_ctx_free(t->w);
+    cache_prune(&t->tmp, true);
+    free(t->tmp.recs);
+    return false;
+  }
+  pthread_mutex_init(&t->pool.lock, NULL);
+  pthread_cond_init(&t->pool.cond, NULL);
+
+  // Parse `path`, and everything it includes
+  t->root->gen = t->pool.cache->gen;
+  t->root->qgen = t->pool.cache->gen;
+  t->root->depth = 1;
+  t->root->done = false;
+  t->root->resolved = false;
+  t->pool.busy = 1;
+  for (unsigned j = 0; j < nthr;)
+    if (0 == pthread_create(&thr[j], NULL, worker, &t->pool))
+      j++;
+    else
+      nthr = j;
+  if (NULL != rd) {
+    // `rd` can only be read once; don't keep the results
+    rec_reset(t->root);
+    rec_parse(t->w, t->root, rd);
+    t->root->uncacheable = true;
+  } else
+    rec_update(t->w, t->root);
+  pthread_mutex_lock(&t->pool.lock);
+  rec_done(&t->pool, t->root);
+  t->pool.busy--;
+  pthread_cond_broadcast(&t->pool.cond);
+  pthread_mutex_unlock(&t->pool.lock);
+  work(&t->pool, t->w);
+  for (unsigned j = 0; j < nthr; j++)
+    pthread_join(thr[j], NULL);
+
+  if (t->pool.oom) {
+    // Some included files may not have been parsed; don't replay anything
+    rec_reset(t->root);
+    t->root->uncacheable = true;
+    t->w->rec = t->root;
+    emit_error(t->w, "Out of memory", path, 0);
+    t->w->rec = NULL;
+  }
+
+  free(thr);
+  return true;
+}
+
+// Helper of `parse_tree()` and friends. Free the records of `t` that `ctx`
+// doesn't keep in its cache, along with everything else in `t`.
+static void tree_free(const eini_ctx_t *ctx, tree_t *t) {
+  cache_prune(t->pool.cache, NULL == ctx->cache);
+  free(t->tmp.recs);
+  free(t->pool.queue);
+  free(t->pool.stack);
+  eini_ctx_free(t->w);
+  pthread_mutex_destroy(&t->pool.lock);
+  pthread_cond_destroy(&t->pool.cond);
+}
+
+// Same as `parse()` (or `parse_file()`, if `rd` is NULL), but parse every file
+// into a record (see `tree_parse()`), and then replay the records in order
+static void parse_tree(eini_ctx_t *ctx, reader_t *rd, const char *path) {
+  tree_t t; // records
+
+  if (!tree_parse(ctx, &t, rd, path)) {
+    // Out of memory; parse everything in this thread instead
+    if (NULL != rd)
+      parse(ctx, rd, path);
+    else
+      parse_file(ctx, path);
+    return;
+  }
+
+  replay(ctx, t.root, path);
+  tree_free(ctx, &t);
+}
+
+// Helper of `eini_ctx_file()` and friends. Same as `parse()` (or
+// `parse_file()`, if `rd` is NULL), but use worker threads and the cache, if
+// `ctx` has them. Files seen are only remembered until it returns.
+static void parse_root(eini_ctx_t *ctx, reader_t *rd, const char *path) {
+  if (ctx->threads > 1 || NULL != ctx->cache)
+    parse_tree(ctx, rd, path);
+  else if (NULL != rd)
+    parse(ctx, rd, path);
+  else
+    parse_file(ctx, path);
+  batch_end(ctx);
+  seen_clear(ctx);
+}
+
+// Helper of `eini_async_new()`. Thread function parsing the .ini file of
+// `arg`, an `eini_async_t*`, into records, and then making its pipe readable.
+static void *async_parse(void *arg) {
+  eini_async_t *async = arg; // parse
+
+  async->parsed = tree_parse(async->ctx, &async->tree, NULL, async->path);
+  while (-1 == write(async->fds[1], "", 1) && EINTR == errno)
+    ;
+  return NULL;
+}
+
+// Helper of `eini_ctx_free()` and `eini_winddown()`. Free the buffers in `ctx`.
+static void free_buffers(eini_ctx_t *ctx) {
+  buf_t *bufs[] = {&ctx->key,  &ctx->value,  &ctx->errmsg,
+                   &ctx->wkey, &ctx->wvalue}; // the buffers
+
+  for (unsigned i = 0; i < sizeof(bufs) / sizeof(bufs[0]); i++) {
+    free(bufs[i]->ptr);
+    bufs[i]->ptr = NULL;
+    bufs[i]->cap = 0;
+  }
+  for (unsigned j = 0; j < ctx->cframes; j++) {
+    free(ctx->frames[j].secbuf.ptr);
+    free(ctx->frames[j].wsecbuf.ptr);
+    free(ctx->frames[j].ibuf.ptr);
+    free(ctx->frames[j].chunk.ptr);
+  }
+  free(ctx->frames);
+  ctx->frames = NULL;
+  ctx->cframes = 0;
+  seen_clear(ctx);
+  free(ctx->batch);
+  free(ctx->sections);
+  free(ctx->paths);
+  eini_arena_free(ctx->batch_arena);
+  eini_arena_free(ctx->names);
+  ctx->batch = NULL;
+  ctx->nbatch = 0;
+  ctx->sections = NULL;
+  ctx->nsections = 0;
+  ctx->csections = 0;
+  ctx->paths = NULL;
+  ctx->npaths = 0;
+  ctx->cpaths = 0;
+  ctx->batch_arena = NULL;
+  ctx->names = NULL;
+}
+
+//
+// Functions
+//
+
+void eini_init() {
+#ifdef EINI_REGEX
+  compile_regexes(&eini_re_include, &eini_re_section, &eini_re_value);
+#endif
+}
+
+eini_ctx_t *eini_ctx_new() {
+  eini_ctx_t *ctx = calloc(1, sizeof(eini_ctx_t)); // return value
+
+  if (NULL == ctx)
+    return NULL;
+
+  ctx->max_line = EINI_MAX_LINE;
+  ctx->max_depth = EINI_MAX_DEPTH;
+#ifdef EINI_REGEX
+  compile_regexes(&ctx->re_own[0], &ctx->re_own[1], &ctx->re_own[2]);
+  ctx->re_include = &ctx->re_own[0];
+  ctx->re_section = &ctx->re_own[1];
+  ctx->re_value = &ctx->re_own[2];
+#endif
+
+  return ctx;
+}
+
+void eini_ctx_handlers(eini_ctx_t *ctx, eini_handler_t hf, eini_error_t ef) {
+  ctx->kind = HANDLERS_WIDE;
+  ctx->hf = hf;
+  ctx->ef = ef;
+  ctx->data = NULL;
+}
+
+void eini_ctx_handlers_utf8(eini_ctx_t *ctx, eini_handler_utf8_t hf,
+                            eini_error_utf8_t ef, void *data) {
+  ctx->kind = HANDLERS_UTF8;
+  ctx->hf8 = hf;
+  ctx->ef8 = ef;
+  ctx->data = data;
+}
+
+void eini_ctx_handlers_span(eini_ctx_t *ctx, eini_handler_span_t hf,
+                            eini_error_utf8_t ef, void *data) {
+  ctx->kind = HANDLERS_SPAN;
+  ctx->hfs = hf;
+  ctx->ef8 = ef;
+  ctx->data = data;
+}
+
+void eini_ctx_handlers_schema(eini_ctx_t *ctx, eini_schema_t *schema,
+                              eini_handler_schema_t hf, eini_error_utf8_t ef,
+                              void *data) {
+  ctx->kind = HANDLERS_SCHEMA;
+  ctx->schema = schema;
+  ctx->hfk = hf;
+  ctx->ef8 = ef;
+  ctx->data = data;
+}
+
+void eini_ctx_handlers_batch(eini_ctx_t *ctx, eini_handler_batch_t hf,
+                             eini_error_utf8_t ef, unsigned size, void *data) {
+  ctx->kind = HANDLERS_BATCH;
+  ctx->hfb = hf;
+  ctx->ef8 = ef;
+  ctx->data = data;
+  if (0 == size)
+    size = EINI_BATCH_SIZE;
+  if (size != ctx->batch_size) {
+    free(ctx->batch);
+    ctx->batch = NULL;
+    ctx->batch_size = size;
+  }
+}
+
+void eini_ctx_mmap(eini_ctx_t *ctx, bool enable) { ctx->mmap = enable; }
+
+void eini_ctx_max_line(eini_ctx_t *ctx, size_t len) { ctx->max_line = len; }
+
+void eini_ctx_max_depth(eini_ctx_t *ctx, unsigned depth) {
+  ctx->max_depth = depth;
+}
+
+void eini_ctx_threads(eini_ctx_t *ctx, unsigned n) { ctx->threads = n; }
+
+void eini_ctx_include_once(eini_ctx_t *ctx, bool enable) {
+  ctx->include_once = enable;
+}
+
+void eini_ctx_cache(eini_ctx_t *ctx, eini_cache_t *cache) {
+  ctx->cache = cache;
+}
+
+void eini_ctx_resolver(eini_ctx_t *ctx, eini_resolver_t rf, void *data) {
+  ctx->rf = rf;
+  ctx->rdata = data;
+}
+
+eini_utf8_t eini_ctx_parse_utf8(eini_ctx_t *ctx, char *src) {
+  return to_str(ctx, parse_line(ctx, src, strlen(src), true));
+}
+
+eini_t eini_ctx_parse(eini_ctx_t *ctx, char *src) {
+  eini_utf8_t lne; // parsed contents of `src`
+  eini_t ret;      // return value
+
+  // Parse `src` as it is (no matter the encoding, as long as it's a superset
+  // of ASCII), and then convert the results to `wchar_t*`
+  lne = to_str(ctx, parse_line(ctx, src, strlen(src), false));
+  ret.type = lne.type;
+  ret.key = NULL;
+  ret.value = NULL;
+
+  if (NULL != lne.key) {
+    ret.key = to_wcs(ctx, lne.key, &ctx->wkey);
+    if (NULL == ret.key)
+      goto non_string;
+  }
+  if (NULL != lne.value) {
+    ret.value = to_wcs(ctx, lne.value, &ctx->wvalue);
+    if (NULL == ret.value)
+      goto non_string;
+  }
+
+  return ret;
+
+non_string:
+  // Couldn't convert `src`
+  ret.type = EINI_ERROR;
+  ret.key = NULL;
+  ret.value = L"Non-string data";
+  return ret;
+}
+
+void eini_ctx_file(eini_ctx_t *ctx, const char *path) {
+  parse_root(ctx, NULL, path);
+}
+
+void eini_ctx_buffer(eini_ctx_t *ctx, const char *data, size_t len,
+                     const char *virtual_path) {
+  reader_t rd; // reader for `data`
+
+  reader_buffer(&rd, data, len);
+  parse_root(ctx, &rd, virtual_path);
+}
+
+void eini_ctx_fd(eini_ctx_t *ctx, int fd, const char *virtual_path) {
+  reader_t rd; // reader for `fd`
+
+  if (!reader_fd(&rd, fd, ctx->mmap)) {
+    emit_error(ctx, errorf(ctx, "Unable to open '%s'", virtual_path),
+               virtual_path, 0);
+    return;
+  }
+
+  parse_root(ctx, &rd, virtual_path);
+}
+
+eini_async_t *eini_async_new(eini_ctx_t *ctx, const char *path) {
+  eini_async_t *async = calloc(1, sizeof(eini_async_t)); // return value
+
+  if (NULL == async)
+    return NULL;
+  async->ctx = ctx;
+  async->fds[0] = async->fds[1] = -1;
+  if (NULL == (async->path = strdup(path)) || 0 != pipe(async->fds))
+    goto fail;
+  fcntl(async->fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(async->fds[1], F_SETFD, FD_CLOEXEC);
+  if (0 != pthread_create(&async->thr, NULL, async_parse, async))
+    goto fail;
+  return async;
+
+fail:
+  if (-1 != async->fds[0]) {
+    close(async->fds[0]);
+    close(async->fds[1]);
+  }
+  free(async->path);
+  free(async);
+  return NULL;
+}
+
+int eini_async_fd(const eini_async_t *async) { return async->fds[0]; }
+
+int eini_async_wait(eini_async_t *async, int timeout, eini_async_handler_t hf,
+                    void *data) {
+  struct pollfd pfd = {async->fds[0], POLLIN, 0}; // pipe to wait on
+  eini_ctx_t *ctx = async->ctx;                   // context
+
+  if (async->done)
+    return -1;
+  switch (poll(&pfd, 1, timeout)) {
+  case -1:
+    return EINTR == errno ? 0 : -1;
+  case 0:
+    return 0;
+  }
+
+  // The records are ready; pass them to the handlers
+  pthread_join(async->thr, NULL);
+  async->done = true;
+  if (async->parsed) {
+    replay(ctx, async->tree.root, async->path);
+    tree_free(ctx, &async->tree);
+  } else
+    // Out of memory; parse everything in this thread instead
+    parse_file(ctx, async->path);
+  batch_end(ctx);
+  seen_clear(ctx);
+
+  if (NULL != hf)
+    hf(async->path, data);
+  return 1;
+}
+
+void eini_async_free(eini_async_t *async) {
+  if (NULL == async)
+    return;
+
+  if (!async->done) {
+    // Let the parse finish, and drop its results
+    pthread_join(async->thr, NULL);
+    if (async->parsed)
+      tree_free(async->ctx, &async->tree);
+  }
+  close(async->fds[0]);
+  close(async->fds[1]);
+  free(async->path);
+  free(async);
+}
+
+void eini_ctx_arena(eini_ctx_t *ctx, eini_arena_t *arena) {
+  ctx->arena = arena;
+}
+
+void eini_ctx_free(eini_ctx_t *ctx) {
+  if (NULL == ctx)
+    return;
+
+#ifdef EINI_REGEX
+  regfree(&ctx->re_own[0]);
+  regfree(&ctx->re_own[1]);
+  regfree(&ctx->re_own[2]);
+#endif
+  free_buffers(ctx);
+  free(ctx);
+}
+
+eini_arena_t *eini_arena_new() { return calloc(1, sizeof(eini_arena_t)); }
+
+void *eini_arena_alloc(eini_arena_t *arena, size_t size) {
+  arena_block_t *b = arena->head; // current block
+  void *ret;                      // return value
+
+  // Keep everything aligned to `max_align_t`
+  size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+
+  if (NULL == b || b->size - b->used < size) {
+    // Start a new block, large enough for `size` bytes
+    size_t bsize = size > EINI_ARENA_BLOCK ? size : EINI_ARENA_BLOCK;
+    b = malloc(sizeof(arena_block_t) + bsize);
+    if (NULL == b)
+      return NULL;
+    b->next = arena->head;
+    b->size = bsize;
+    b->used = 0;
+    arena->head = b;
+  }
+
+  ret = (char *)b->mem + b->used;
+  b->used += size;
+  return ret;
+}
+
+char *eini_arena_strndup(eini_arena_t *arena, const char *src, size_t len) {
+  char *ret = eini_arena_alloc(arena, len + 1); // return value
+
+  if (NULL == ret)
+    return NULL;
+
+  memcpy(ret, src, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+void eini_arena_reset(eini_arena_t *arena) {
+  arena_block_t *b, *next; // iterators
+
+  if (NULL == arena->head)
+    return;
+
+  // Free every block but the oldest one, which is reused
+  for (b = arena->head; NULL != b->next; b = next) {
+    next = b->next;
+    free(b);
+  }
+  b->used = 0;
+  arena->head = b;
+}
+
+eini_cache_t *eini_cache_new(bool hash) {
+  eini_cache_t *cache = calloc(1, sizeof(eini_cache_t)); // return value
+
+  if (NULL != cache)
+    cache->hash = hash;
+  return cache;
+}
+
+void eini_cache_free(eini_cache_t *cache) {
+  if (NULL == cache)
+    return;
+
+  cache_prune(cache, true);
+  free(cache->recs);
+  free(cache);
+}
+
+eini_schema_t *eini_schema_new(const eini_schema_key_t *keys,
+                               unsigned nkeys) {
+  eini_schema_t *schema = calloc(1, sizeof(eini_schema_t)); // return value
+  unsigned n = nkeys > 0 ? nkeys : 1;                        // capacity
+  eini_span_t *sections;                                     // section names
+  eini_span_t *names;                                        // key names
+  unsigned *key_sections;                                    // section ids
+  unsigned *prefixes;                                        // for sections
+  bool ok = false; // true if `schema` is complete
+
+  if (NULL == schema)
+    return NULL;
+
+  // Everything but `prefixes` goes into the arena
+  schema->arena = eini_arena_new();
+  if (NULL == schema->arena) {
+    free(schema);
+    return NULL;
+  }
+  sections = eini_arena_alloc(schema->arena, n * sizeof(eini_span_t));
+  names = eini_arena_alloc(schema->arena, n * sizeof(eini_span_t));
+  key_sections = eini_arena_alloc(schema->arena, n * sizeof(unsigned));
+  prefixes = calloc(n, sizeof(unsigned));
+  if (NULL == sections || NULL == names || NULL == key_sections ||
+      NULL == prefixes)
+    goto wind_down;
+  schema->t.version = EINI_SCHEMA_VERSION;
+  schema->t.sections = sections;
+  schema->t.keys = names;
+  schema->t.key_sections = key_sections;
+
+  for (unsigned i = 0; i < nkeys; i++) {
+    eini_span_t sec = {keys[i].section, strlen(keys[i].section)}; // section
+    eini_span_t key = {keys[i].key, strlen(keys[i].key)};         // key
+    unsigned sid = schema->t.nsections; // id of `sec`
+
+    // Keys are usually grouped by section, so look backwards
+    for (unsigned j = schema->t.nsections; j-- > 0;)
+      if (same_span(sections[j], sec)) {
+        sid = j;
+        break;
+      }
+    if (sid == schema->t.nsections) {
+      sec.ptr = eini_arena_strndup(schema->arena, sec.ptr, sec.len);
+      if (NULL == sec.ptr)
+        goto wind_down;
+      sections[schema->t.nsections++] = sec;
+    }
+
+    key.ptr = eini_arena_strndup(schema->arena, key.ptr, key.len);
+    if (NULL == key.ptr)
+      goto wind_down;
+    names[i] = key;
+    key_sections[i] = sid;
+    schema->t.nkeys++;
+  }
+
+  // Keys are hashed together with the id of their section
+  ok = phf_build(&schema->t.sphf, schema->arena, prefixes, sections,
+                 schema->t.nsections) &&
+       phf_build(&schema->t.kphf, schema->arena, key_sections, names, nkeys);
+
+wind_down:
+  free(prefixes);
+  if (!ok) {
+    eini_schema_free(schema);
+    return NULL;
+  }
+  return schema;
+}
+
+eini_schema_t *eini_schema_import(const eini_schema_tables_t *tables) {
+  eini_schema_t *schema; // return value
+
+  // The hash tables would be of no use if hashing had changed since
+  if (EINI_SCHEMA_VERSION != tables->version)
+    return NULL;
+  schema = calloc(1, sizeof(eini_schema_t));
+  if (NULL != schema)
+    schema->t = *tables;
+  return schema;
+}
+
+const eini_schema_tables_t *eini_schema_export(const eini_schema_t *schema) {
+  return &schema->t;
+}
+
+int eini_schema_section(const eini_schema_t *schema, const char *section) {
+  eini_span_t sec = {section, strlen(section)}; // `section` as a span
+
+  return schema_section(schema, sec);
+}
+
+int eini_schema_key(const eini_schema_t *schema, const char *section,
+                    const char *key) {
+  int sid = eini_schema_section(schema, section); // id of `section`
+  eini_span_t k = {key, strlen(key)};             // `key` as a span
+
+  return -1 == sid ? -1 : schema_key(schema, sid, k);
+}
+
+void eini_schema_free(eini_schema_t *schema) {
+  if (NULL == schema)
+    return;
+
+  eini_arena_free(schema->arena);
+  free(schema);
+}
+
+void eini_arena_free(eini_arena_t *arena) {
+  arena_block_t *b, *next; // iterators
+
+  if (NULL == arena)
+    return;
+
+  for (b = arena->head; NULL != b; b = next) {
+    next = b->next;
+    free(b);
+  }
+  free(arena);
+}
+
+eini_utf8_t eini_parse_utf8(char *src) {
+  return eini_ctx_parse_utf8(&eini_ctx_default, src);
+}
+
+eini_t eini_parse(char *src) { return eini_ctx_parse(&eini_ctx_default, src); }
+
+void eini(eini_handler_t hf, eini_error_t ef, const char *path) {
+  eini_ctx_handlers(&eini_ctx_default, hf, ef);
+  eini_ctx_file(&eini_ctx_default, path);
+}
+
+void eini_buffer(const char *data, size_t len, const char *virtual_path,
+                 eini_handler_t hf, eini_error_t ef) {
+  eini_ctx_handlers(&eini_ctx_default, hf, ef);
+  eini_ctx_buffer(&eini_ctx_default, data, len, virtual_path);
+}
+
+void eini_fd(int fd, const char *virtual_path, eini_handler_t hf,
+             eini_error_t ef) {
+  eini_ctx_handlers(&eini_ctx_default, hf, ef);
+  eini_ctx_fd(&eini_ctx_default, fd, virtual_path);
+}
+
+void eini_resolver(eini_resolver_t rf, void *data) {
+  eini_ctx_resolver(&eini_ctx_default, rf, data);
+}
+
+void eini_utf8(eini_handler_utf8_t hf, eini_error_utf8_t ef, const char *path,
+               void *data) {
+  eini_ctx_handlers_utf8(&eini_ctx_default, hf, ef, data);
+  eini_ctx_file(&eini_ctx_default, path);
+}
+
+void eini_span(eini_handler_span_t hf, eini_error_utf8_t ef, const char *path,
+               void *data) {
+  bool mmap = eini_ctx_default.mmap; // previous mmap setting
+
+  eini_ctx_handlers_span(&eini_ctx_default, hf, ef, data);
+  eini_ctx_mmap(&eini_ctx_default, true);
+  eini_ctx_file(&eini_ctx_default, path);
+  eini_ctx_mmap(&eini_ctx_default, mmap);
 }
 
 void eini_winddown() {
+  free_buffers(&eini_ctx_default);
+#ifdef EINI_REGEX
   regfree(&eini_re_include);
   regfree(&eini_re_section);
   regfree(&eini_re_value);
+#endif
 }
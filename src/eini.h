@@ -4,8 +4,11 @@
 
 #define EINI_H
 
+#ifdef EINI_REGEX
 #include <regex.h>
+#endif
 #include <stddef.h>
+#include <stdint.h>
 
 //
 // Types
@@ -37,6 +40,71 @@ typedef struct {
                     // NULL, otherwise
 } eini_t;
 
+// Parsed contents of a line in a .ini file, as UTF-8 strings (see `eini_t`)
+typedef struct {
+  eini_type_t type; // line type
+  char *key;        // key name, or NULL
+  char *value;      // error message, path of file to include, section name,
+                    // value, or NULL
+} eini_utf8_t;
+
+// A string that is not necessarily NULL-terminated
+typedef struct {
+  const char *ptr; // first character
+  size_t len;      // length
+} eini_span_t;
+
+// Parser context (see `eini_ctx_new()`)
+typedef struct eini_ctx eini_ctx_t;
+
+// Arena allocator (see `eini_arena_new()`)
+typedef struct eini_arena eini_arena_t;
+
+// Parsed-result cache (see `eini_cache_new()`)
+typedef struct eini_cache eini_cache_t;
+
+// Set of known sections and keys (see `eini_schema_new()`)
+typedef struct eini_schema eini_schema_t;
+
+// Parse running in the background (see `eini_async_new()`)
+typedef struct eini_async eini_async_t;
+
+// A key known to a schema
+typedef struct {
+  const char *section; // section name
+  const char *key;     // key name
+} eini_schema_key_t;
+
+// Empty slot of an `eini_phf_t`
+#define EINI_PHF_EMPTY ((unsigned)-1)
+
+// Perfect hash table of a schema. Holds the indices of its strings, rather
+// than the strings themselves.
+typedef struct {
+  unsigned mask;         // number of `slots`, minus 1 (a power of 2, minus 1)
+  unsigned bmask;        // number of `disp`, minus 1 (a power of 2, minus 1)
+  uint32_t seed;         // seed of the hash function
+  const uint32_t *disp;  // displacement of each bucket
+  const unsigned *slots; // index of the string in each slot, or
+                         // `EINI_PHF_EMPTY`
+} eini_phf_t;
+
+// Version of the layout of `eini_schema_tables_t` and of its hash function,
+// bumped whenever either changes (see `eini_schema_import()`)
+#define EINI_SCHEMA_VERSION 1
+
+// Names and perfect hash tables of a schema (see `eini_schema_export()`)
+typedef struct {
+  unsigned version;             // `EINI_SCHEMA_VERSION` of the tables
+  const eini_span_t *sections;  // section names, by id
+  unsigned nsections;           // number of `sections`
+  const eini_span_t *keys;      // key names, by id
+  const unsigned *key_sections; // section id of each of `keys`
+  unsigned nkeys;               // number of `keys`
+  eini_phf_t sphf;              // perfect hash table of `sections`
+  eini_phf_t kphf;              // perfect hash table of `keys` (by section)
+} eini_schema_tables_t;
+
 // Handler function
 typedef void (*eini_handler_t)(const wchar_t *section, // current section name
                                const wchar_t *key,     // key name
@@ -51,6 +119,77 @@ typedef void (*eini_error_t)(const wchar_t *error, // error message
                              const unsigned line   // .ini file line
 );
 
+// UTF-8 handler function
+typedef void (*eini_handler_utf8_t)(const char *section, // current section name
+                                    const char *key,     // key name
+                                    const char *value,   // value
+                                    const char *path,    // .ini file path
+                                    const unsigned line, // .ini file line
+                                    void *data           // user data
+);
+
+// Span handler function. The spans are valid only until it returns.
+typedef void (*eini_handler_span_t)(eini_span_t section, // current section name
+                                    eini_span_t key,     // key name
+                                    eini_span_t value,   // value
+                                    const char *path,    // .ini file path
+                                    const unsigned line, // .ini file line
+                                    void *data           // user data
+);
+
+// A key/value pair, as passed to batch handler functions
+typedef struct {
+  unsigned section;  // current section name (index into `sections`)
+  eini_span_t key;   // key name
+  eini_span_t value; // value
+  unsigned path;     // .ini file path (index into `paths`)
+  unsigned line;     // .ini file line
+} eini_batch_entry_t;
+
+// Batch handler function (see `eini_ctx_handlers_batch()`). The spans in
+// `entries` are NUL-terminated, and valid only until it returns. `sections` and
+// `paths` remain valid until parsing is over.
+typedef void (*eini_handler_batch_t)(
+    const eini_batch_entry_t *entries, // key/value pairs, in order
+    unsigned nentries,                 // number of `entries`
+    const eini_span_t *sections,       // section names, by id
+    const char *const *paths,          // .ini file paths, by id
+    void *data                         // user data
+);
+
+// Schema handler function (see `eini_ctx_handlers_schema()`). The value is
+// valid only until it returns.
+typedef void (*eini_handler_schema_t)(
+    unsigned section,    // current section id
+    unsigned key,        // key id
+    eini_span_t value,   // value
+    const char *path,    // .ini file path
+    const unsigned line, // .ini file line
+    void *data           // user data
+);
+
+// Include resolver function. Called with the path of every file that is about
+// to be included. To provide the file's contents from memory, the resolver
+// should point `contents` to them and return 1. The contents must remain valid
+// until parsing is over. To let eINI read the file as usual, it should return
+// 0. To report that the file does not exist, it should return -1.
+typedef int (*eini_resolver_t)(const char *path,      // included file path
+                               eini_span_t *contents, // included file contents
+                               void *data             // user data
+);
+
+// UTF-8 error handler function
+typedef void (*eini_error_utf8_t)(const char *error,   // error message
+                                  const char *path,    // .ini file path
+                                  const unsigned line, // .ini file line
+                                  void *data           // user data
+);
+
+// Completion handler function of a parse running in the background
+typedef void (*eini_async_handler_t)(const char *path, // .ini file path
+                                     void *data        // user data
+);
+
 //
 // Constants
 //
@@ -64,17 +203,31 @@ typedef void (*eini_error_t)(const wchar_t *error, // error message
 #endif
 
 // Buffer sizes
-#define EINI_SHORT 128 // length of a short array (suitable for a token)
-#define EINI_LONG 1024 // length of a longer array (suitable for a line of text)
+#define EINI_SHORT 128         // length of a short array (suitable for a token)
+#define EINI_LONG 1024         // length of a longer array (suitable for a line)
+#define EINI_ARENA_BLOCK 65536 // size of an arena block
+
+// Default maximum length of a line (see `eini_ctx_max_line()`)
+#define EINI_MAX_LINE 1048576
+
+// Default number of key/value pairs passed to batch handler functions at once
+// (see `eini_ctx_handlers_batch()`)
+#define EINI_BATCH_SIZE 256
+
+// Default maximum depth of nested includes (see `eini_ctx_max_depth()`)
+#define EINI_MAX_DEPTH 64
 
 //
 // Global variables
 //
 
-// Regular expressions for...
+#ifdef EINI_REGEX
+// Regular expressions for... (only used if eINI has been built with
+// `EINI_REGEX`; otherwise, a hand-written scanner is used instead)
 extern regex_t eini_re_include, // an include directive
     eini_re_section,            // a section header
     eini_re_value;              // a key/value pair
+#endif
 
 //
 // Functions
@@ -86,12 +239,255 @@ extern void eini_init();
 // Parse .ini file line in `src` and return the result
 extern eini_t eini_parse(char *src);
 
+// Same as `eini_parse()`, but return UTF-8 strings instead. Lines that are not
+// valid UTF-8 result in an error. No locale-dependent conversion takes place.
+extern eini_utf8_t eini_parse_utf8(char *src);
+
 // Parse .ini file in `path`, calling `hf()` whenever a key/value pair is found,
 // or `ef()` in case of error. `eini()` will recursively call itself whenever it
 // encounters an `include` directive.
 extern void eini(eini_handler_t hf, eini_error_t ef, const char *path);
 
+// Same as `eini()`, but pass UTF-8 strings to `hf()` and `ef()`, together with
+// `data`. The .ini file must be valid UTF-8. No locale-dependent conversion
+// takes place.
+extern void eini_utf8(eini_handler_utf8_t hf, eini_error_utf8_t ef,
+                      const char *path, void *data);
+
+// Same as `eini()`, but parse the `len` characters in `data`, as if they were
+// the contents of a file in `virtual_path`. Included files are located
+// relative to `virtual_path`.
+extern void eini_buffer(const char *data, size_t len, const char *virtual_path,
+                        eini_handler_t hf, eini_error_t ef);
+
+// Same as `eini()`, but parse the file open in file descriptor `fd` (from its
+// current position, which needn't be seekable: pipes work), as if it was in
+// `virtual_path`. `fd` is not closed.
+extern void eini_fd(int fd, const char *virtual_path, eini_handler_t hf,
+                    eini_error_t ef);
+
+// Make `eini()` and friends use `rf()` (with user data `data`) to resolve
+// included files. Pass NULL as `rf` to stop using a resolver.
+extern void eini_resolver(eini_resolver_t rf, void *data);
+
+// Same as `eini_utf8()`, but memory-map the .ini file, and pass spans to
+// `hf()`. These point straight into the mapped file, except for values that
+// contain escape sequences (which are unescaped into a separate buffer). Thus,
+// no copying takes place.
+extern void eini_span(eini_handler_span_t hf, eini_error_utf8_t ef,
+                      const char *path, void *data);
+
 // Wind down eINI
 extern void eini_winddown();
 
+// The following functions operate on a parser context, which holds all the
+// state `eini()`, `eini_parse()`, and friends need. `eini_init()` isn't
+// required. Different threads can use different contexts concurrently, without
+// any locking. (The functions above use a single default context.)
+
+// Create a new parser context. Return NULL on memory allocation failure.
+extern eini_ctx_t *eini_ctx_new();
+
+// Make `eini_ctx_file()` use `hf()` and `ef()` as handler functions
+extern void eini_ctx_handlers(eini_ctx_t *ctx, eini_handler_t hf,
+                              eini_error_t ef);
+
+// Make `eini_ctx_file()` use the UTF-8 handler functions `hf()` and `ef()`,
+// passing `data` to them
+extern void eini_ctx_handlers_utf8(eini_ctx_t *ctx, eini_handler_utf8_t hf,
+                                   eini_error_utf8_t ef, void *data);
+
+// Make `eini_ctx_file()` use the span handler function `hf()` and the UTF-8
+// error handler function `ef()`, passing `data` to them
+extern void eini_ctx_handlers_span(eini_ctx_t *ctx, eini_handler_span_t hf,
+                                   eini_error_utf8_t ef, void *data);
+
+// Make `eini_ctx_file()` use the batch handler function `hf()` and the UTF-8
+// error handler function `ef()`, passing `data` to them. Instead of being
+// called once per key/value pair, `hf()` is passed up to `size` of them at a
+// time (or `EINI_BATCH_SIZE`, if `size` is 0), so that they can be stored in
+// bulk. Section names and paths are passed as ids: a section gets a new one
+// whenever its header is found, and a file whenever it's parsed. Whatever is
+// pending is passed to `hf()` before any call to `ef()`, and when parsing is
+// over, so that everything is still found in order.
+extern void eini_ctx_handlers_batch(eini_ctx_t *ctx, eini_handler_batch_t hf,
+                                    eini_error_utf8_t ef, unsigned size,
+                                    void *data);
+
+// Make `eini_ctx_file()` use the schema handler function `hf()` and the UTF-8
+// error handler function `ef()`, passing `data` to them. Sections and keys are
+// looked up in `schema` (which must outlive the parse) and passed to `hf()` as
+// ids. Key/value pairs that aren't in `schema` are reported to `ef()`, and
+// parsing goes on.
+extern void eini_ctx_handlers_schema(eini_ctx_t *ctx, eini_schema_t *schema,
+                                     eini_handler_schema_t hf,
+                                     eini_error_utf8_t ef, void *data);
+
+// Make `eini_ctx_file()` memory-map .ini files (if `enable` is true) instead of
+// reading them one line at a time. Files that cannot be mapped are read as
+// usual.
+extern void eini_ctx_mmap(eini_ctx_t *ctx, bool enable);
+
+// Make `eini_ctx_file()` and friends use `rf()` (with user data `data`) to
+// resolve included files
+extern void eini_ctx_resolver(eini_ctx_t *ctx, eini_resolver_t rf, void *data);
+
+// Same as `eini_parse()` and `eini_parse_utf8()`, but use `ctx`. The strings in
+// the result are valid until `ctx` is used again.
+extern eini_t eini_ctx_parse(eini_ctx_t *ctx, char *src);
+extern eini_utf8_t eini_ctx_parse_utf8(eini_ctx_t *ctx, char *src);
+
+// Same as `eini()`, but use `ctx` and its handler functions
+extern void eini_ctx_file(eini_ctx_t *ctx, const char *path);
+
+// Same as `eini_buffer()` and `eini_fd()`, but use `ctx` and its handler
+// functions
+extern void eini_ctx_buffer(eini_ctx_t *ctx, const char *data, size_t len,
+                            const char *virtual_path);
+extern void eini_ctx_fd(eini_ctx_t *ctx, int fd, const char *virtual_path);
+
+// Free a parser context created by `eini_ctx_new()`
+extern void eini_ctx_free(eini_ctx_t *ctx);
+
+// Make `eini_ctx_file()` and friends reject lines longer than `len` characters
+// (not counting the newline) with a "Line too long" error. Lines of any length
+// up to that are accepted, and their keys and values are never truncated. The
+// default is `EINI_MAX_LINE`.
+extern void eini_ctx_max_line(eini_ctx_t *ctx, size_t len);
+
+// Make `eini_ctx_file()` and friends reject `include` directives nested more
+// than `depth` levels deep (the .ini file itself being at level 0) with an
+// "Inclusion of '...' nested too deeply" error. Included files are kept track
+// of on the heap, so the C stack doesn't grow with the depth, and parsing can
+// be done on small stacks (e.g. in coroutines). The default is
+// `EINI_MAX_DEPTH`.
+extern void eini_ctx_max_depth(eini_ctx_t *ctx, unsigned depth);
+
+// Make `eini_ctx_file()` and friends parse included files concurrently, using
+// `n` threads (including the calling one). Handler functions are still called
+// from the calling thread, in exactly the same order (and with the same
+// arguments) as when parsing serially, but only after the whole include tree
+// has been parsed. A file included more than once is parsed only once. The
+// include resolver function (if any) is called from the worker threads, and
+// must be thread-safe. Pass 0 or 1 as `n` to parse serially (the default).
+extern void eini_ctx_threads(eini_ctx_t *ctx, unsigned n);
+
+// Make `ctx` allocate all the strings it passes to handler functions (section
+// names, keys, values, included file paths, and error messages) from `arena`,
+// and return them from `eini_ctx_parse()` and friends. They are no longer
+// overwritten by the next line; instead, they remain valid until `arena` is
+// reset or freed. Spans passed to span handler functions point to strings in
+// `arena` as well, so they are NUL-terminated. Pass NULL as `arena` to stop
+// using an arena.
+extern void eini_ctx_arena(eini_ctx_t *ctx, eini_arena_t *arena);
+
+// Make `eini_ctx_file()` and friends keep what they find in each .ini file in
+// `cache`, and reuse it the next time they are asked to parse the same file, as
+// long as the file hasn't changed in the meantime. Handler functions are called
+// exactly as if every file had been parsed again, but only the files that have
+// changed are. Files read from a buffer or file descriptor, or through an
+// include resolver, are never reused. A cache must not be used by more than one
+// context at a time. Pass NULL as `cache` to stop using a cache.
+extern void eini_ctx_cache(eini_ctx_t *ctx, eini_cache_t *cache);
+
+// Make `eini_ctx_file()` and friends skip `include` directives for files that
+// have already been parsed (if `enable` is true), so that a fragment included
+// from many places is only parsed (and passed to the handler functions) once.
+// Files are told apart by device and inode number, so different paths to the
+// same file count as the same file. Files included through an include resolver
+// are told apart by path.
+extern void eini_ctx_include_once(eini_ctx_t *ctx, bool enable);
+
+// The following functions operate on an arena, which hands out memory from a
+// few large blocks, and releases all of it at once. An arena must not be used
+// by more than one thread at a time.
+
+// Create a new, empty arena. Return NULL on memory allocation failure.
+extern eini_arena_t *eini_arena_new();
+
+// Allocate `size` bytes from `arena`, suitably aligned for any type. Return
+// NULL on memory allocation failure.
+extern void *eini_arena_alloc(eini_arena_t *arena, size_t size);
+
+// Copy the `len` characters in `src` into `arena`, adding a terminating NUL.
+// Return NULL on memory allocation failure.
+extern char *eini_arena_strndup(eini_arena_t *arena, const char *src,
+                                size_t len);
+
+// Release everything allocated from `arena`, but keep its first block of
+// memory around for reuse
+extern void eini_arena_reset(eini_arena_t *arena);
+
+// Free an arena created by `eini_arena_new()`, and everything allocated from it
+extern void eini_arena_free(eini_arena_t *arena);
+
+// Create a new, empty cache (see `eini_ctx_cache()`). A file is considered
+// unchanged if its device, inode, size, and modification time are the same as
+// when it was last parsed or, if `hash` is true, if the hash of its contents
+// is (which requires reading it, but works even where modification times are
+// unreliable). Return NULL on memory allocation failure.
+extern eini_cache_t *eini_cache_new(bool hash);
+
+// Free a cache created by `eini_cache_new()`
+extern void eini_cache_free(eini_cache_t *cache);
+
+// Create a schema (see `eini_ctx_handlers_schema()`) out of the `nkeys` keys
+// in `keys`. The id of a key is its index in `keys`, and sections are numbered
+// in the order they first appear. Both are found with a perfect hash table, so
+// that a lookup takes a single probe. Schemas are never modified, and can be
+// shared by any number of contexts. Return NULL on memory allocation failure,
+// or if a key appears twice in the same section.
+extern eini_schema_t *eini_schema_new(const eini_schema_key_t *keys,
+                                      unsigned nkeys);
+
+// Return the names and hash tables of `schema`, which are valid until it's
+// freed. They can be written out as constants (as `eini-gen` does), and given
+// back to `eini_schema_import()` by a program using the same version of eINI.
+extern const eini_schema_tables_t *
+eini_schema_export(const eini_schema_t *schema);
+
+// Create a schema out of `tables`, from `eini_schema_export()`, without
+// copying or hashing anything (so `tables` must outlive the schema). Return
+// NULL on memory allocation failure, or if `tables` come from another version
+// of eINI (see `EINI_SCHEMA_VERSION`).
+extern eini_schema_t *eini_schema_import(const eini_schema_tables_t *tables);
+
+// Return the id of `section` in `schema`, or -1 if it isn't there
+extern int eini_schema_section(const eini_schema_t *schema,
+                               const char *section);
+
+// Return the id of `key` in `section` of `schema`, or -1 if it isn't there
+extern int eini_schema_key(const eini_schema_t *schema, const char *section,
+                           const char *key);
+
+// Free a schema created by `eini_schema_new()` or `eini_schema_import()`
+extern void eini_schema_free(eini_schema_t *schema);
+
+// The following functions parse a .ini file in the background, so that an
+// event loop isn't blocked by reading (and including) files. The handler
+// functions of the context are still called from the loop's thread.
+
+// Start parsing the .ini file in `path` (and every file it includes) with
+// `ctx`, as `eini_ctx_file()` would, but on a thread of its own (helped by the
+// worker threads of `ctx`, if any). `ctx` must not be used until the parse is
+// over, or freed. Return NULL on failure.
+extern eini_async_t *eini_async_new(eini_ctx_t *ctx, const char *path);
+
+// Return a file descriptor that becomes readable once `async` is ready to call
+// the handler functions, for use with `poll()`, `epoll()`, and friends
+extern int eini_async_fd(const eini_async_t *async);
+
+// Wait up to `timeout` milliseconds (or forever, if it is negative) for
+// `async` to be ready, then call the handler functions of its context with
+// everything found, exactly as `eini_ctx_file()` would, and call `hf()` (with
+// user data `data`) once they're done. Pass 0 as `timeout` once
+// `eini_async_fd()` is readable. Return 1 if `hf()` has been called, 0 on
+// timeout, or -1 on failure (including if it had already been called).
+extern int eini_async_wait(eini_async_t *async, int timeout,
+                           eini_async_handler_t hf, void *data);
+
+// Free `async`, created by `eini_async_new()`. If it is still running, wait
+// for it to finish, and drop its results without calling any handler function.
+extern void eini_async_free(eini_async_t *async);
+
 #endif
@@ -0,0 +1,42 @@
+// eINI image compiler
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "eini_image.h"
+
+// UTF-8 error function. Print the error message, and remember that there was
+// one.
+void error_func(const char *error, const char *path, const unsigned line,
+                void *data) {
+  fprintf(stderr, "Error in %s line %u: %s\n", path, line, error);
+  *(bool *)data = true;
+}
+
+int main(int argc, char **argv) {
+  eini_store_t *store; // key/value pairs
+  bool failed = false; // true if there were errors
+
+  // User must provide the .ini file to compile, and the image file to write
+  if (3 != argc) {
+    printf("Usage: %s <.ini file> <image file>\n", argv[0]);
+    exit(-1);
+  }
+
+  // Parse the .ini file (and everything it includes)
+  store = eini_store_new();
+  if (NULL == store) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  eini_store_load(store, argv[1], error_func, &failed);
+
+  // Write the image, unless the configuration is broken
+  if (!failed && !eini_image_save(store, argv[2])) {
+    fprintf(stderr, "Unable to write '%s'\n", argv[2]);
+    failed = true;
+  }
+
+  eini_store_free(store);
+  exit(failed ? 1 : 0);
+}
@@ -0,0 +1,644 @@
+// eINI parser generator
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eini_value.h"
+
+//
+// Types
+//
+
+// Type of an option
+typedef enum {
+  TYPE_INT,    // `int64_t`
+  TYPE_DOUBLE, // `double`
+  TYPE_BOOL,   // `bool`
+  TYPE_STRING  // `char*` (owned by the structure)
+} type_t;
+
+// An option, as declared in the schema file
+typedef struct {
+  char *section;        // section name
+  char *key;            // key name
+  type_t type;          // type
+  char def[EINI_SHORT]; // default value (as a C expression)
+  char min[EINI_SHORT]; // lower bound (as a C expression; numbers only)
+  char max[EINI_SHORT]; // upper bound (as a C expression; numbers only)
+  char *sdef;           // default value (strings only)
+} option_t;
+
+// Options declared in the schema file
+typedef struct {
+  option_t *opts; // options, in order
+  unsigned nopts; // number of `opts`
+  unsigned copts; // capacity of `opts`
+  bool failed;    // true if there were errors
+} schema_t;
+
+//
+// Constants
+//
+
+// Names of the types in schema files, and of their C counterparts (by
+// `type_t`)
+const char *type_names[] = {"int", "double", "bool", "string"};
+const char *type_ctypes[] = {"int64_t", "double", "bool", "char *"};
+
+// Words that can't be used as section or key names, since they become
+// structure and field names
+const char *keywords[] = {
+    "auto",     "bool",   "break",    "case",     "char",     "const",
+    "continue", "default", "do",      "double",   "else",     "enum",
+    "extern",   "false",  "float",    "for",      "goto",     "if",
+    "inline",   "int",    "long",     "register", "restrict", "return",
+    "short",    "signed", "sizeof",   "static",   "struct",   "switch",
+    "true",     "typedef", "union",   "unsigned", "void",     "volatile",
+    "while"};
+
+//
+// Helper functions and macros
+//
+
+// Helper of `handler_func()` and `main()`. Print an error message, and
+// remember that there was one.
+void fail(schema_t *schema, const char *path, const unsigned line,
+          const char *fmt, const char *arg) {
+  fprintf(stderr, "Error in %s line %u: ", path, line);
+  fprintf(stderr, fmt, arg);
+  fprintf(stderr, "\n");
+  schema->failed = true;
+}
+
+// Helper of `handler_func()` and `main()`. Test whether `name` can be used as
+// a C identifier.
+bool is_identifier(const char *name) {
+  if (!isalpha((unsigned char)name[0]) && '_' != name[0])
+    return false;
+  for (const char *c = name; '\0' != *c; c++)
+    if (!isalnum((unsigned char)*c) && '_' != *c)
+      return false;
+  for (unsigned i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+    if (0 == strcmp(name, keywords[i]))
+      return false;
+  return true;
+}
+
+// Helper of `handler_func()`. Parse number `tok` of type `type` into `num`,
+// and write it as a C expression into `expr`. Return false if it isn't one.
+bool number(type_t type, const char *tok, double *num, char *expr) {
+  eini_span_t span = {tok, strlen(tok)}; // `tok` as a span
+  int64_t ll;                            // `tok` as an integer
+  double d;                              // `tok` as a double
+
+  if (TYPE_INT == type) {
+    if (NULL != eini_value_int(span, &ll))
+      return false;
+    if (INT64_MIN == ll)
+      strlcpy(expr, "INT64_MIN", EINI_SHORT);
+    else
+      snprintf(expr, EINI_SHORT, "%lldLL", (long long)ll);
+    *num = (double)ll;
+  } else {
+    if (NULL != eini_value_double(span, &d))
+      return false;
+    snprintf(expr, EINI_SHORT, "%.17g", d);
+    *num = d;
+  }
+  return true;
+}
+
+// UTF-8 handler function. Add an option, declared as `<type> [<default>
+// [<min> <max>]]`, to the schema.
+void handler_func(const char *section, const char *key, const char *value,
+                  const char *path, const unsigned line, void *data) {
+  schema_t *schema = data;    // options declared so far
+  char *copy = strdup(value); // copy of `value`, to split it
+  char *toks[5];              // words of `copy` (the first 5)
+  unsigned ntoks = 0;         // number of `toks`
+  char *save;                 // state of `strtok_r()`
+  option_t *opt;              // the new option
+  double def = 0, min, max;   // default value and bounds (numbers only)
+
+  if (NULL == copy) {
+    fail(schema, path, line, "%s", "Out of memory");
+    return;
+  }
+  if (!is_identifier(section) || !is_identifier(key)) {
+    fail(schema, path, line, "'%s' is not a valid C identifier",
+         is_identifier(section) ? key : section);
+    free(copy);
+    return;
+  }
+  for (unsigned i = 0; i < schema->nopts; i++)
+    if (0 == strcmp(schema->opts[i].section, section) &&
+        0 == strcmp(schema->opts[i].key, key)) {
+      fail(schema, path, line, "Option '%s' declared twice", key);
+      free(copy);
+      return;
+    }
+
+  if (schema->nopts == schema->copts) {
+    unsigned copts = 0 == schema->copts ? EINI_SHORT : 2 * schema->copts;
+    option_t *opts = realloc(schema->opts, copts * sizeof(option_t));
+    if (NULL == opts) {
+      fail(schema, path, line, "%s", "Out of memory");
+      free(copy);
+      return;
+    }
+    schema->opts = opts;
+    schema->copts = copts;
+  }
+  opt = &schema->opts[schema->nopts];
+  memset(opt, 0, sizeof(option_t));
+
+  // Find the type
+  for (char *tok = strtok_r(copy, " \t", &save); NULL != tok && ntoks < 5;
+       tok = strtok_r(NULL, " \t", &save))
+    toks[ntoks++] = tok;
+  for (opt->type = TYPE_INT; opt->type <= TYPE_STRING; opt->type++)
+    if (ntoks > 0 && 0 == strcmp(toks[0], type_names[opt->type]))
+      break;
+  if (opt->type > TYPE_STRING) {
+    fail(schema, path, line, "Unknown type '%s'", value);
+    free(copy);
+    return;
+  }
+
+  // Find the default value and bounds
+  switch (opt->type) {
+  case TYPE_STRING:
+    // Everything after the type is the default value
+    value += strspn(value, " \t") + strlen(toks[0]);
+    value += strspn(value, " \t");
+    opt->sdef = strdup(value);
+    if (NULL == opt->sdef) {
+      fail(schema, path, line, "%s", "Out of memory");
+      free(copy);
+      return;
+    }
+    break;
+  case TYPE_BOOL:
+    if (ntoks > 2 || (ntoks > 1 && 0 != strcmp(toks[1], "true") &&
+                      0 != strcmp(toks[1], "false"))) {
+      fail(schema, path, line, "Invalid declaration '%s'", value);
+      free(copy);
+      return;
+    }
+    strlcpy(opt->def, ntoks > 1 ? toks[1] : "false", EINI_SHORT);
+    break;
+  default:
+    if (3 == ntoks || 5 == ntoks ||
+        (ntoks > 1 && !number(opt->type, toks[1], &def, opt->def)) ||
+        (ntoks > 3 && (!number(opt->type, toks[2], &min, opt->min) ||
+                       !number(opt->type, toks[3], &max, opt->max) ||
+                       min > max || def < min || def > max))) {
+      fail(schema, path, line, "Invalid declaration '%s'", value);
+      free(copy);
+      return;
+    }
+    if (ntoks < 2)
+      strlcpy(opt->def, "0", EINI_SHORT);
+    if (ntoks < 4 && TYPE_INT == opt->type) {
+      strlcpy(opt->min, "INT64_MIN", EINI_SHORT);
+      strlcpy(opt->max, "INT64_MAX", EINI_SHORT);
+    } else if (ntoks < 4) {
+      strlcpy(opt->min, "-DBL_MAX", EINI_SHORT);
+      strlcpy(opt->max, "DBL_MAX", EINI_SHORT);
+    }
+  }
+  free(copy);
+
+  opt->section = strdup(section);
+  opt->key = strdup(key);
+  if (NULL == opt->section || NULL == opt->key) {
+    fail(schema, path, line, "%s", "Out of memory");
+    free(opt->section);
+    free(opt->key);
+    free(opt->sdef);
+    return;
+  }
+  schema->nopts++;
+}
+
+// UTF-8 error function. Print the error message, and remember that there was
+// one.
+void error_func(const char *error, const char *path, const unsigned line,
+                void *data) {
+  fail(data, path, line, "%s", error);
+}
+
+// Helper of `write_header()` and `write_source()`. Return the file name of
+// `path` (without its directory, which may differ from one build to the next).
+const char *base_name(const char *path) {
+  const char *slash = strrchr(path, '/'); // last slash in `path`
+
+  return NULL == slash ? path : slash + 1;
+}
+
+// Helper of `write_source()`. Write `str` as a C string literal.
+void write_string(FILE *fp, const char *str) {
+  fputc('"', fp);
+  for (const unsigned char *c = (const unsigned char *)str; '\0' != *c; c++)
+    if ('"' == *c || '\\' == *c)
+      fprintf(fp, "\\%c", *c);
+    else if (isprint(*c))
+      fputc(*c, fp);
+    else
+      fprintf(fp, "\\%03o", *c);
+  fputc('"', fp);
+}
+
+// Helper of `write_source()`. Write the `n` numbers in `nums` as the contents
+// of an array, with `EINI_PHF_EMPTY` spelled out.
+void write_numbers(FILE *fp, const unsigned *nums, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    fputs(0 == i % 8 ? "    " : " ", fp);
+    if (EINI_PHF_EMPTY == nums[i])
+      fputs("EINI_PHF_EMPTY,", fp);
+    else
+      fprintf(fp, "%u,", nums[i]);
+    if (7 == i % 8 || i == n - 1)
+      fputc('\n', fp);
+  }
+}
+
+// Helper of `write_source()`. Write the arrays of perfect hash table `phf`,
+// named after `prefix`.
+void write_phf(FILE *fp, const eini_phf_t *phf, const char *prefix) {
+  fprintf(fp, "static const uint32_t %sdisp[] = {\n", prefix);
+  write_numbers(fp, phf->disp, phf->bmask + 1);
+  fprintf(fp, "};\n"
+              "static const unsigned %sslots[] = {\n",
+          prefix);
+  write_numbers(fp, phf->slots, phf->mask + 1);
+  fprintf(fp, "};\n");
+}
+
+// Helper of `main()`. Write the header of parser `name` for `schema`.
+void write_header(FILE *fp, const schema_t *schema, const char *name,
+                  const char *schema_path) {
+  char guard[EINI_SHORT]; // `name`, in upper case
+  int pad = (int)strlen(name) + 18; // indentation of continuation lines
+
+  for (unsigned i = 0; i < EINI_SHORT; i++)
+    if ('\0' == (guard[i] = toupper((unsigned char)name[i])))
+      break;
+  guard[EINI_SHORT - 1] = '\0';
+
+  fprintf(fp,
+          "// Generated by eini-gen from %s. Do not edit.\n"
+          "\n"
+          "#ifndef EINI_GEN_%s_H\n"
+          "\n"
+          "#define EINI_GEN_%s_H\n"
+          "\n"
+          "#include \"eini_value.h\"\n"
+          "\n"
+          "// Configuration, by section\n"
+          "typedef struct {\n",
+          base_name(schema_path), guard, guard);
+
+  // Sections become structures, in the order they are first declared in
+  for (unsigned i = 0; i < schema->nopts; i++) {
+    const option_t *opt = &schema->opts[i]; // first option of its section
+    bool first = true;                      // true if `opt` is the first one
+    for (unsigned j = 0; j < i && first; j++)
+      first = 0 != strcmp(schema->opts[j].section, opt->section);
+    if (!first)
+      continue;
+    fprintf(fp, "  struct {\n");
+    for (unsigned j = i; j < schema->nopts; j++)
+      if (0 == strcmp(schema->opts[j].section, opt->section))
+        fprintf(fp, "    %s%s%s;\n", type_ctypes[schema->opts[j].type],
+                TYPE_STRING == schema->opts[j].type ? "" : " ",
+                schema->opts[j].key);
+    fprintf(fp, "  } %s;\n", opt->section);
+  }
+
+  fprintf(fp,
+          "} %s_t;\n"
+          "\n"
+          "// Set every option in `cfg` to its default value. Return false on "
+          "memory\n"
+          "// allocation failure.\n"
+          "extern bool %s_defaults(%s_t *cfg);\n"
+          "\n"
+          "// Parse the .ini file in `path` (and every file it includes) into "
+          "`cfg`,\n"
+          "// which must have been set by `%s_defaults()`. Every error "
+          "(including\n"
+          "// unknown keys and values that are invalid, or out of bounds) is "
+          "passed to\n"
+          "// `ef()`, with user data `data`. Return false if there were any.\n"
+          "extern bool %s_load(%s_t *cfg, const char *path,\n"
+          "%*seini_error_utf8_t ef, void *data);\n"
+          "\n"
+          "// Free the strings in `cfg`\n"
+          "extern void %s_free(%s_t *cfg);\n"
+          "\n"
+          "#endif\n",
+          name, name, name, name, name, name, pad, "", name, name);
+}
+
+// Helper of `main()`. Write the source of parser `name` for `schema`, which
+// includes header `header`, and looks options up in `tables` (the options of
+// `schema`, hashed by `eini_schema_new()`).
+void write_source(FILE *fp, const schema_t *schema,
+                  const eini_schema_tables_t *tables, const char *name,
+                  const char *schema_path, const char *header) {
+  fprintf(fp,
+          "// Generated by eini-gen from %s. Do not edit.\n"
+          "\n"
+          "#include <float.h>\n"
+          "#include <stdio.h>\n"
+          "#include <stdlib.h>\n"
+          "#include <string.h>\n"
+          "\n"
+          "#include \"%s\"\n"
+          "\n",
+          base_name(schema_path), base_name(header));
+
+  // Fixed part
+  fputs("// State of a parse\n"
+        "typedef struct {\n"
+        "  void *cfg;            // configuration\n"
+        "  eini_error_utf8_t ef; // error handler function\n"
+        "  void *data;           // user data passed to `ef()`\n"
+        "  bool failed;          // true if there were errors\n"
+        "} load_t;\n"
+        "\n"
+        "// Store `value` into `out`. Return false if it isn't an integer "
+        "between `min`\n"
+        "// and `max`.\n"
+        "static bool to_int(eini_span_t value, int64_t min, int64_t max,\n"
+        "                   int64_t *out) {\n"
+        "  int64_t v; // `value` as a number\n"
+        "\n"
+        "  if (NULL != eini_value_int(value, &v) || v < min || v > max)\n"
+        "    return false;\n"
+        "  *out = v;\n"
+        "  return true;\n"
+        "}\n"
+        "\n"
+        "// Store `value` into `out`. Return false if it isn't a number "
+        "between `min`\n"
+        "// and `max`.\n"
+        "static bool to_double(eini_span_t value, double min, double max,\n"
+        "                      double *out) {\n"
+        "  double v; // `value` as a number\n"
+        "\n"
+        "  if (NULL != eini_value_double(value, &v) || v < min || v > max)\n"
+        "    return false;\n"
+        "  *out = v;\n"
+        "  return true;\n"
+        "}\n"
+        "\n"
+        "// Replace the string in `out` by a copy of `value`. Return false on "
+        "memory\n"
+        "// allocation failure.\n"
+        "static bool to_string(eini_span_t value, char **out) {\n"
+        "  char *str = strndup(value.ptr, value.len); // copy of `value`\n"
+        "\n"
+        "  if (NULL == str)\n"
+        "    return false;\n"
+        "  free(*out);\n"
+        "  *out = str;\n"
+        "  return true;\n"
+        "}\n"
+        "\n"
+        "// UTF-8 error handler function. Pass the error on.\n"
+        "static void error_func(const char *error, const char *path,\n"
+        "                       const unsigned line, void *data) {\n"
+        "  load_t *ld = data; // state of the parse\n"
+        "\n"
+        "  ld->failed = true;\n"
+        "  if (NULL != ld->ef)\n"
+        "    ld->ef(error, path, line, ld->data);\n"
+        "}\n"
+        "\n",
+        fp);
+
+  // Schema, hashed already (see `eini_schema_import()`)
+  fprintf(fp, "// Known sections and options, by id\n"
+              "static const eini_span_t sections[] = {\n");
+  for (unsigned i = 0; i < tables->nsections; i++)
+    fprintf(fp, "    {\"%s\", %zu},\n", tables->sections[i].ptr,
+            tables->sections[i].len);
+  fprintf(fp, "};\n"
+              "static const eini_span_t keys[] = {\n");
+  for (unsigned i = 0; i < tables->nkeys; i++)
+    fprintf(fp, "    {\"%s\", %zu},\n", tables->keys[i].ptr,
+            tables->keys[i].len);
+  fprintf(fp, "};\n"
+              "static const unsigned key_sections[] = {\n");
+  write_numbers(fp, tables->key_sections, tables->nkeys);
+  fprintf(fp, "};\n"
+              "\n"
+              "// Perfect hash tables of `sections` and `keys`\n");
+  write_phf(fp, &tables->sphf, "s");
+  write_phf(fp, &tables->kphf, "k");
+  fprintf(fp,
+          "static const eini_schema_tables_t tables = {\n"
+          "    %uu, sections, %u, keys, key_sections, %u,\n"
+          "    {%uu, %uu, %" PRIu32 "u, sdisp, sslots},\n"
+          "    {%uu, %uu, %" PRIu32 "u, kdisp, kslots}};\n"
+          "\n",
+          tables->version, tables->nsections, tables->nkeys, tables->sphf.mask,
+          tables->sphf.bmask, tables->sphf.seed, tables->kphf.mask,
+          tables->kphf.bmask, tables->kphf.seed);
+
+  // Handler: a switch on the key id
+  fprintf(fp,
+          "// Schema handler function. Convert `value`, and store it into "
+          "its field.\n"
+          "static void handler_func(unsigned section, unsigned key, "
+          "eini_span_t value,\n"
+          "                         const char *path, const unsigned line, "
+          "void *data) {\n"
+          "  load_t *ld = data; // state of the parse\n"
+          "  %s_t *cfg = ld->cfg; // configuration\n"
+          "  bool ok = false; // true if `value` is valid\n"
+          "  char error[EINI_LONG]; // error message\n"
+          "\n"
+          "  switch (key) {\n",
+          name);
+  for (unsigned i = 0; i < schema->nopts; i++) {
+    const option_t *opt = &schema->opts[i]; // current option
+    fprintf(fp, "  case %u: // [%s] %s\n", i, opt->section, opt->key);
+    switch (opt->type) {
+    case TYPE_INT:
+      fprintf(fp, "    ok = to_int(value, %s, %s, &cfg->%s.%s);\n", opt->min,
+              opt->max, opt->section, opt->key);
+      break;
+    case TYPE_DOUBLE:
+      fprintf(fp, "    ok = to_double(value, %s, %s, &cfg->%s.%s);\n",
+              opt->min, opt->max, opt->section, opt->key);
+      break;
+    case TYPE_BOOL:
+      fprintf(fp, "    ok = NULL == eini_value_bool(value, &cfg->%s.%s);\n",
+              opt->section, opt->key);
+      break;
+    case TYPE_STRING:
+      fprintf(fp,
+              "    if (!to_string(value, &cfg->%s.%s)) {\n"
+              "      error_func(\"Out of memory\", path, line, data);\n"
+              "      return;\n"
+              "    }\n"
+              "    ok = true;\n",
+              opt->section, opt->key);
+    }
+    fprintf(fp, "    break;\n");
+  }
+  fprintf(fp,
+          "  }\n"
+          "\n"
+          "  if (!ok) {\n"
+          "    snprintf(error, EINI_LONG, \"Invalid value '%%.*s' for key "
+          "'%%s' in section '%%s'\",\n"
+          "             (int)value.len, value.ptr, keys[key].ptr, "
+          "sections[section].ptr);\n"
+          "    error_func(error, path, line, data);\n"
+          "  }\n"
+          "}\n"
+          "\n");
+
+  // Defaults
+  fprintf(fp, "bool %s_defaults(%s_t *cfg) {\n"
+              "  memset(cfg, 0, sizeof(%s_t));\n", name, name, name);
+  for (unsigned i = 0; i < schema->nopts; i++) {
+    const option_t *opt = &schema->opts[i]; // current option
+    fprintf(fp, "  cfg->%s.%s = ", opt->section, opt->key);
+    if (TYPE_STRING == opt->type) {
+      fprintf(fp, "strdup(");
+      write_string(fp, opt->sdef);
+      fprintf(fp, ");\n"
+                  "  if (NULL == cfg->%s.%s) {\n"
+                  "    %s_free(cfg);\n"
+                  "    return false;\n"
+                  "  }\n",
+              opt->section, opt->key, name);
+    } else
+      fprintf(fp, "%s;\n", opt->def);
+  }
+  fprintf(fp, "  return true;\n"
+              "}\n"
+              "\n");
+
+  // Loading
+  fprintf(fp,
+          "bool %s_load(%s_t *cfg, const char *path,\n"
+          "%*seini_error_utf8_t ef, void *data) {\n"
+          "  load_t ld = {cfg, ef, data, false}; // state of the parse\n"
+          "  eini_schema_t *schema;              // known options\n"
+          "  eini_ctx_t *ctx;                    // parser context\n"
+          "\n"
+          "  schema = eini_schema_import(&tables);\n"
+          "  ctx = eini_ctx_new();\n"
+          "  if (NULL == ctx)\n"
+          "    error_func(\"Out of memory\", path, 0, &ld);\n"
+          "  else if (NULL == schema)\n"
+          "    error_func(\"Out of memory, or parser generated by another \"\n"
+          "               \"version of eINI\", path, 0, &ld);\n"
+          "  else {\n"
+          "    eini_ctx_handlers_schema(ctx, schema, handler_func, "
+          "error_func, &ld);\n"
+          "    eini_ctx_file(ctx, path);\n"
+          "  }\n"
+          "\n"
+          "  eini_ctx_free(ctx);\n"
+          "  eini_schema_free(schema);\n"
+          "  return !ld.failed;\n"
+          "}\n"
+          "\n",
+          name, name, (int)strlen(name) + 11, "");
+
+  // Freeing
+  fprintf(fp, "void %s_free(%s_t *cfg) {\n", name, name);
+  for (unsigned i = 0; i < schema->nopts; i++)
+    if (TYPE_STRING == schema->opts[i].type)
+      fprintf(fp,
+              "  free(cfg->%s.%s);\n"
+              "  cfg->%s.%s = NULL;\n",
+              schema->opts[i].section, schema->opts[i].key,
+              schema->opts[i].section, schema->opts[i].key);
+  fprintf(fp, "}\n");
+}
+
+int main(int argc, char **argv) {
+  schema_t schema = {NULL, 0, 0, false}; // declared options
+  eini_schema_key_t *keys = NULL;        // declared options, for hashing
+  eini_schema_t *hashed = NULL;          // declared options, hashed
+  eini_ctx_t *ctx;                       // parser context
+  FILE *src, *hdr;                       // generated files
+
+  // User must provide the schema file, the parser name, and the files to write
+  if (5 != argc) {
+    printf("Usage: %s <schema file> <name> <.c file> <.h file>\n", argv[0]);
+    exit(-1);
+  }
+  if (!is_identifier(argv[2])) {
+    fprintf(stderr, "'%s' is not a valid C identifier\n", argv[2]);
+    exit(1);
+  }
+
+  // Parse the schema file (and everything it includes)
+  ctx = eini_ctx_new();
+  if (NULL == ctx) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  eini_ctx_handlers_utf8(ctx, handler_func, error_func, &schema);
+  eini_ctx_file(ctx, argv[1]);
+  eini_ctx_free(ctx);
+  if (0 == schema.nopts && !schema.failed)
+    fail(&schema, argv[1], 0, "%s", "No options declared");
+
+  // Hash the options now, so that the parser doesn't have to
+  if (!schema.failed) {
+    keys = malloc(schema.nopts * sizeof(eini_schema_key_t));
+    if (NULL != keys) {
+      for (unsigned i = 0; i < schema.nopts; i++) {
+        keys[i].section = schema.opts[i].section;
+        keys[i].key = schema.opts[i].key;
+      }
+      hashed = eini_schema_new(keys, schema.nopts);
+    }
+    if (NULL == hashed) {
+      fprintf(stderr, "Out of memory\n");
+      schema.failed = true;
+    }
+  }
+
+  // Write the parser, unless the schema is broken
+  if (!schema.failed) {
+    src = fopen(argv[3], "w");
+    hdr = fopen(argv[4], "w");
+    if (NULL != src)
+      write_source(src, &schema, eini_schema_export(hashed), argv[2], argv[1],
+                   argv[4]);
+    if (NULL != hdr)
+      write_header(hdr, &schema, argv[2], argv[1]);
+    if (NULL == src || 0 != fclose(src)) {
+      fprintf(stderr, "Unable to write '%s'\n", argv[3]);
+      schema.failed = true;
+    }
+    if (NULL == hdr || 0 != fclose(hdr)) {
+      fprintf(stderr, "Unable to write '%s'\n", argv[4]);
+      schema.failed = true;
+    }
+  }
+
+  for (unsigned i = 0; i < schema.nopts; i++) {
+    free(schema.opts[i].section);
+    free(schema.opts[i].key);
+    free(schema.opts[i].sdef);
+  }
+  free(schema.opts);
+  free(keys);
+  eini_schema_free(hashed);
+  exit(schema.failed ? 1 : 0);
+}
@@ -0,0 +1,357 @@
+// eINI image (implementation)
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "eini_image.h"
+
+//
+// Types
+//
+
+// Image header. All offsets are relative to the start of the image, and all
+// numbers are in the byte order of the machine that wrote it.
+typedef struct {
+  char magic[4];     // "eINI"
+  uint32_t order;    // `BYTE_ORDER_MARK`
+  uint32_t version;  // `EINI_IMAGE_VERSION`
+  uint32_t size;     // size of the image
+  uint32_t nentries; // number of entries
+  uint32_t entries;  // offset of the entry table (an array of `entry_t`)
+  uint32_t npaths;   // number of paths
+  uint32_t paths;    // offset of the path table (an array of string offsets)
+  uint32_t nstrs;    // size of the string table
+  uint32_t strs;     // offset of the string table (NUL-terminated strings)
+} header_t;
+
+// Image entry (a key/value pair). Entries are sorted by section and key.
+typedef struct {
+  uint32_t section; // section name (string offset)
+  uint32_t key;     // key name (string offset)
+  uint32_t value;   // value (string offset)
+  uint32_t path;    // .ini file path (path number)
+  uint32_t line;    // .ini file line
+} entry_t;
+
+// Hash table of strings, keyed by address, used by `eini_image_save()` to
+// write every (interned) string only once
+typedef struct {
+  const char **keys; // strings
+  uint32_t *vals;    // string offsets (or path numbers)
+  unsigned cap;      // capacity of `keys` and `vals` (a power of 2)
+} strmap_t;
+
+//
+// Constants
+//
+
+// Byte order mark, telling images written on machines with the same byte order
+// apart
+#define BYTE_ORDER_MARK 0x01020304u
+
+//
+// Helper functions and macros
+//
+
+// Helper of `eini_image_save()`. Sort key/value pairs by section and key.
+static int compare(const void *a, const void *b) {
+  const eini_entry_t *ea = *(const eini_entry_t **)a; // first pair
+  const eini_entry_t *eb = *(const eini_entry_t **)b; // second pair
+  int res = strcmp(ea->section, eb->section);         // return value
+
+  return 0 != res ? res : strcmp(ea->key, eb->key);
+}
+
+// Helper of `eini_image_save()`. Return the position of `str` in `map`, where
+// it is (or should be) found.
+static unsigned slot(const strmap_t *map, const char *str) {
+  uint64_t h = (uintptr_t)str * 11400714819323198485u; // hash of `str`
+  unsigned j = (h >> 32) & (map->cap - 1);               // iterator
+
+  while (NULL != map->keys[j] && map->keys[j] != str)
+    j = (j + 1) & (map->cap - 1);
+
+  return j;
+}
+
+// Helper of `eini_image_save()`. Return the offset of `str` in string table
+// `strs` (of size `*nstrs`, and capacity `*cstrs`), appending it (and adding
+// it to `map`) if it isn't there already. Return `UINT32_MAX` on failure.
+static uint32_t add_str(strmap_t *map, char **strs, size_t *nstrs,
+                        size_t *cstrs, const char *str) {
+  unsigned j = slot(map, str);  // position of `str` in `map`
+  size_t len = strlen(str) + 1; // size of `str`
+
+  if (NULL != map->keys[j])
+    return map->vals[j];
+
+  if (*nstrs + len >= UINT32_MAX)
+    return UINT32_MAX;
+  if (*nstrs + len > *cstrs) {
+    size_t cap = 2 * (*nstrs + len); // new capacity
+    char *tmp = realloc(*strs, cap);
+    if (NULL == tmp)
+      return UINT32_MAX;
+    *strs = tmp;
+    *cstrs = cap;
+  }
+
+  memcpy(&(*strs)[*nstrs], str, len);
+  map->keys[j] = str;
+  map->vals[j] = *nstrs;
+  *nstrs += len;
+  return map->vals[j];
+}
+
+// Helper of `eini_image_open()` and `eini_image_buffer()`. Check the header of
+// `image`.
+static bool check(const eini_image_t *image) {
+  const header_t *h = (const header_t *)image->map; // header
+
+  if (image->size < sizeof(header_t) || 0 != memcmp(h->magic, "eINI", 4) ||
+      BYTE_ORDER_MARK != h->order || EINI_IMAGE_VERSION != h->version ||
+      h->size != image->size)
+    return false;
+
+  // Every table must fit, and strings must be NUL-terminated
+  return 0 == h->entries % sizeof(uint32_t) &&
+         0 == h->paths % sizeof(uint32_t) &&
+         (uint64_t)h->entries + (uint64_t)h->nentries * sizeof(entry_t) <=
+             image->size &&
+         (uint64_t)h->paths + (uint64_t)h->npaths * sizeof(uint32_t) <=
+             image->size &&
+         (uint64_t)h->strs + h->nstrs <= image->size && h->nstrs > 0 &&
+         '\0' == image->map[h->strs + h->nstrs - 1];
+}
+
+// Helper of `eini_image_get()` and friends. Return the string at offset `off`
+// in the string table of `image`, or NULL if it's out of bounds.
+static const char *str_at(const eini_image_t *image, uint32_t off) {
+  const header_t *h = (const header_t *)image->map; // header
+
+  return off < h->nstrs ? &image->map[h->strs + off] : NULL;
+}
+
+// Helper of `eini_image_get()` and `eini_image_at()`. Store entry `e` of
+// `image` into `entry`. Return false if `e` is corrupted.
+static bool fill(const eini_image_t *image, const entry_t *e,
+                 eini_entry_t *entry) {
+  const header_t *h = (const header_t *)image->map; // header
+  const uint32_t *paths = (const uint32_t *)&image->map[h->paths]; // paths
+
+  entry->section = str_at(image, e->section);
+  entry->key = str_at(image, e->key);
+  entry->value = str_at(image, e->value);
+  entry->path = e->path < h->npaths ? str_at(image, paths[e->path]) : NULL;
+  entry->line = e->line;
+  return NULL != entry->section && NULL != entry->key &&
+         NULL != entry->value && NULL != entry->path;
+}
+
+//
+// Functions
+//
+
+bool eini_image_save(const eini_store_t *store, const char *path) {
+  unsigned n = eini_store_size(store);      // number of entries
+  const eini_entry_t **sorted;              // entries, sorted
+  entry_t *entries;                         // entry table
+  uint32_t *paths;                          // path table
+  unsigned npaths = 0;                      // number of `paths`
+  strmap_t smap = {NULL, NULL, EINI_SHORT}; // string offsets
+  strmap_t pmap = {NULL, NULL, EINI_SHORT}; // path numbers
+  char *strs = NULL;                        // string table
+  size_t nstrs = 0, cstrs = 0;              // size/capacity of `strs`
+  header_t h = {.magic = "eINI"};           // header
+  char *tpath;                              // temporary file path
+  FILE *fp;                                 // file pointer for `tpath`
+  bool ok = false;                          // return value
+
+  while (smap.cap < 8 * n)
+    smap.cap *= 2;
+  while (pmap.cap < 2 * n)
+    pmap.cap *= 2;
+  sorted = malloc((n + 1) * sizeof(eini_entry_t *));
+  entries = malloc((n + 1) * sizeof(entry_t));
+  paths = malloc((n + 1) * sizeof(uint32_t));
+  smap.keys = calloc(smap.cap, sizeof(char *));
+  smap.vals = malloc(smap.cap * sizeof(uint32_t));
+  pmap.keys = calloc(pmap.cap, sizeof(char *));
+  pmap.vals = malloc(pmap.cap * sizeof(uint32_t));
+  tpath = malloc(strlen(path) + EINI_SHORT);
+  if (NULL == sorted || NULL == entries || NULL == paths ||
+      NULL == smap.keys || NULL == smap.vals || NULL == pmap.keys ||
+      NULL == pmap.vals || NULL == tpath)
+    goto wind_down;
+
+  // Build the tables
+  for (unsigned i = 0; i < n; i++)
+    sorted[i] = eini_store_at(store, i);
+  qsort(sorted, n, sizeof(eini_entry_t *), compare);
+  for (unsigned i = 0; i < n; i++) {
+    const eini_entry_t *e = sorted[i]; // current pair
+    unsigned j = slot(&pmap, e->path); // position of its path in `pmap`
+    if (NULL == pmap.keys[j]) {
+      pmap.keys[j] = e->path;
+      pmap.vals[j] = npaths;
+      paths[npaths] = add_str(&smap, &strs, &nstrs, &cstrs, e->path);
+      if (UINT32_MAX == paths[npaths++])
+        goto wind_down;
+    }
+    entries[i].section = add_str(&smap, &strs, &nstrs, &cstrs, e->section);
+    entries[i].key = add_str(&smap, &strs, &nstrs, &cstrs, e->key);
+    entries[i].value = add_str(&smap, &strs, &nstrs, &cstrs, e->value);
+    entries[i].path = pmap.vals[j];
+    entries[i].line = e->line;
+    if (UINT32_MAX == entries[i].section || UINT32_MAX == entries[i].key ||
+        UINT32_MAX == entries[i].value)
+      goto wind_down;
+  }
+  if (0 == nstrs && UINT32_MAX == add_str(&smap, &strs, &nstrs, &cstrs, ""))
+    goto wind_down;
+
+  // Lay them out: header, entries, paths, and strings
+  h.order = BYTE_ORDER_MARK;
+  h.version = EINI_IMAGE_VERSION;
+  h.nentries = n;
+  h.entries = sizeof(header_t);
+  h.npaths = npaths;
+  h.paths = h.entries + n * sizeof(entry_t);
+  h.nstrs = nstrs;
+  h.strs = h.paths + npaths * sizeof(uint32_t);
+  if ((uint64_t)h.strs + nstrs > UINT32_MAX)
+    goto wind_down;
+  h.size = h.strs + nstrs;
+
+  // Write them into a temporary file, and then move it into place
+  snprintf(tpath, strlen(path) + EINI_SHORT, "%s.%ld.tmp", path,
+           (long)getpid());
+  fp = fopen(tpath, "wb");
+  if (NULL == fp)
+    goto wind_down;
+  ok = 1 == fwrite(&h, sizeof(header_t), 1, fp) &&
+       n == fwrite(entries, sizeof(entry_t), n, fp) &&
+       npaths == fwrite(paths, sizeof(uint32_t), npaths, fp) &&
+       nstrs == fwrite(strs, 1, nstrs, fp);
+  ok = 0 == fclose(fp) && ok && 0 == rename(tpath, path);
+  if (!ok)
+    unlink(tpath);
+
+wind_down:
+  free(sorted);
+  free(entries);
+  free(paths);
+  free(smap.keys);
+  free(smap.vals);
+  free(pmap.keys);
+  free(pmap.vals);
+  free(strs);
+  free(tpath);
+  return ok;
+}
+
+bool eini_image_open(eini_image_t *image, const char *path) {
+  int fd = open(path, O_RDONLY); // file descriptor
+  struct stat st;                // file status
+  void *map;                     // memory mapping
+
+  image->map = NULL;
+  image->size = 0;
+  image->mapped = false;
+  if (-1 == fd)
+    return false;
+
+  if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+      (size_t)st.st_size < sizeof(header_t)) {
+    close(fd);
+    return false;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == map)
+    return false;
+
+  image->map = map;
+  image->size = st.st_size;
+  image->mapped = true;
+  if (!check(image)) {
+    eini_image_close(image);
+    return false;
+  }
+
+  return true;
+}
+
+bool eini_image_buffer(eini_image_t *image, const void *data, size_t size) {
+  image->map = data;
+  image->size = size;
+  image->mapped = false;
+  if (!check(image)) {
+    image->map = NULL;
+    image->size = 0;
+    return false;
+  }
+
+  return true;
+}
+
+unsigned eini_image_size(const eini_image_t *image) {
+  return NULL == image->map ? 0 : ((const header_t *)image->map)->nentries;
+}
+
+bool eini_image_get(const eini_image_t *image, const char *section,
+                    const char *key, eini_entry_t *entry) {
+  const header_t *h;      // header
+  const entry_t *entries; // entry table
+  unsigned lo = 0, hi;    // search range
+  int res;                // comparison result
+
+  if (NULL == image->map)
+    return false;
+
+  h = (const header_t *)image->map;
+  entries = (const entry_t *)&image->map[h->entries];
+  hi = h->nentries;
+  while (lo < hi) {
+    unsigned mid = lo + (hi - lo) / 2;                   // middle entry
+    const char *s = str_at(image, entries[mid].section); // its section
+    const char *k = str_at(image, entries[mid].key);     // its key
+    if (NULL == s || NULL == k)
+      return false;
+    res = strcmp(section, s);
+    if (0 == res)
+      res = strcmp(key, k);
+    if (0 == res)
+      return fill(image, &entries[mid], entry);
+    if (res < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return false;
+}
+
+bool eini_image_at(const eini_image_t *image, unsigned i,
+                   eini_entry_t *entry) {
+  const header_t *h = (const header_t *)image->map; // header
+
+  if (NULL == image->map || i >= h->nentries)
+    return false;
+
+  return fill(image, &((const entry_t *)&image->map[h->entries])[i], entry);
+}
+
+void eini_image_close(eini_image_t *image) {
+  if (image->mapped)
+    munmap((void *)image->map, image->size);
+  image->map = NULL;
+  image->size = 0;
+  image->mapped = false;
+}
@@ -0,0 +1,66 @@
+// eINI image (definition)
+
+#ifndef EINI_IMAGE_H
+
+#define EINI_IMAGE_H
+
+#include "eini_store.h"
+
+//
+// Types
+//
+
+// Precompiled configuration (see `eini_image_open()`). All of its fields are
+// private.
+typedef struct {
+  const char *map;  // image contents
+  size_t size;      // size of `map`
+  bool mapped;      // true if `map` is a memory mapping
+} eini_image_t;
+
+//
+// Constants
+//
+
+// Version of the image format written by `eini_image_save()`. Images of any
+// other version are rejected.
+#define EINI_IMAGE_VERSION 1
+
+//
+// Functions
+//
+
+// Write the key/value pairs in `store` (sorted by section and key, together
+// with their paths and lines) into an image file in `path`. The file is
+// replaced atomically, so that processes that have the previous one open keep
+// seeing it. Return false on failure.
+extern bool eini_image_save(const eini_store_t *store, const char *path);
+
+// Memory-map the image file in `path` into `image`, and check its header.
+// Nothing is parsed or allocated. Return false if the file can't be mapped, or
+// isn't a valid image of version `EINI_IMAGE_VERSION`.
+extern bool eini_image_open(eini_image_t *image, const char *path);
+
+// Same as `eini_image_open()`, but use the `size` bytes in `data` (which must
+// be suitably aligned for a `uint32_t`, and remain valid while `image` is in
+// use) instead of a file
+extern bool eini_image_buffer(eini_image_t *image, const void *data,
+                              size_t size);
+
+// Return the number of key/value pairs in `image`
+extern unsigned eini_image_size(const eini_image_t *image);
+
+// Store the key/value pair for `key` in `section` from `image` into `entry`.
+// The strings in `entry` point into `image`. Return false if there isn't one.
+extern bool eini_image_get(const eini_image_t *image, const char *section,
+                           const char *key, eini_entry_t *entry);
+
+// Store the `i`th key/value pair in `image` (sorted by section and key) into
+// `entry`. Return false if there isn't one.
+extern bool eini_image_at(const eini_image_t *image, unsigned i,
+                          eini_entry_t *entry);
+
+// Unmap an image opened by `eini_image_open()` or `eini_image_buffer()`
+extern void eini_image_close(eini_image_t *image);
+
+#endif
@@ -0,0 +1,366 @@
+// eINI store (implementation)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eini_store.h"
+
+//
+// Types
+//
+
+// A key/value pair, together with its hash
+typedef struct {
+  eini_entry_t e; // key/value pair
+  uint32_t hash;  // hash of `e.section` and `e.key`
+} item_t;
+
+// Store of key/value pairs
+struct eini_store {
+  eini_ctx_t *ctx;      // parser context
+  eini_error_utf8_t ef; // error handler function for `eini_store_load()`
+  void *data;           // user data for `ef()`
+  eini_cache_t *cache;  // records of the parsed .ini files
+  eini_arena_t *arena;  // arena holding all strings
+  item_t *items;        // key/value pairs, in file order
+  unsigned nitems;      // number of `items`
+  unsigned citems;      // capacity of `items`
+  unsigned *index;      // hash index of `items` (item number + 1, or 0)
+  unsigned cindex;      // capacity of `index` (a power of 2)
+  const char **strs;    // interned strings (hash table)
+  unsigned nstrs;       // number of `strs`
+  unsigned cstrs;       // capacity of `strs` (a power of 2)
+  bool oom;             // true if a memory allocation has failed
+};
+
+//
+// Constants
+//
+
+// Initial capacity of a hash table
+#define TABLE_SIZE 64
+
+//
+// Helper functions and macros
+//
+
+// Helper of `hash_pair()` and `intern()`. Continue FNV-1a hash `h` over the
+// `len` characters in `src`.
+static uint32_t hash_more(uint32_t h, const char *src, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)src[i];
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+// Helper of `store_handler()` and `eini_store_get()`. Hash `section` and `key`.
+static uint32_t hash_pair(eini_span_t section, eini_span_t key) {
+  uint32_t h = 2166136261u; // return value
+
+  h = hash_more(h, section.ptr, section.len);
+  h = hash_more(h, "", 1);
+  return hash_more(h, key.ptr, key.len);
+}
+
+// Helper of `find()` and `intern()`. Test whether string `str` equals `src`.
+static bool span_eq(const char *str, eini_span_t src) {
+  return 0 == strncmp(str, src.ptr, src.len) && '\0' == str[src.len];
+}
+
+// Helper of `intern()`. Double the capacity of the string table of `store`.
+// Return false if out of memory.
+static bool grow_strs(eini_store_t *store) {
+  unsigned cstrs = 0 == store->cstrs ? TABLE_SIZE : 2 * store->cstrs;
+  const char **strs = calloc(cstrs, sizeof(char *)); // new table
+
+  if (NULL == strs)
+    return false;
+
+  for (unsigned i = 0; i < store->cstrs; i++) {
+    const char *s = store->strs[i]; // string to move
+    if (NULL == s)
+      continue;
+    uint32_t j = hash_more(2166136261u, s, strlen(s)) & (cstrs - 1);
+    while (NULL != strs[j])
+      j = (j + 1) & (cstrs - 1);
+    strs[j] = s;
+  }
+
+  free(store->strs);
+  store->strs = strs;
+  store->cstrs = cstrs;
+  return true;
+}
+
+// Helper of `store_handler()`. Return the interned copy of `src`, adding it to
+// `store` if necessary (or NULL if out of memory). If `copy` is false, `src` is
+// already a NUL-terminated string in the arena of `store`, and is added as it
+// is.
+static const char *intern(eini_store_t *store, eini_span_t src, bool copy) {
+  uint32_t j; // iterator
+
+  if (2 * (store->nstrs + 1) > store->cstrs && !grow_strs(store))
+    return NULL;
+
+  j = hash_more(2166136261u, src.ptr, src.len) & (store->cstrs - 1);
+  while (NULL != store->strs[j]) {
+    if (span_eq(store->strs[j], src))
+      return store->strs[j];
+    j = (j + 1) & (store->cstrs - 1);
+  }
+
+  store->strs[j] =
+      copy ? eini_arena_strndup(store->arena, src.ptr, src.len) : src.ptr;
+  if (NULL != store->strs[j])
+    store->nstrs++;
+  return store->strs[j];
+}
+
+// Helper of `store_handler()` and `eini_store_get()`. Return the position in
+// the hash index of `store` where the key/value pair with `hash`, `section`,
+// and `key` is (or should be) found.
+static unsigned find(const eini_store_t *store, uint32_t hash,
+                     eini_span_t section, eini_span_t key) {
+  unsigned j = hash & (store->cindex - 1); // iterator
+
+  while (0 != store->index[j]) {
+    const item_t *it = &store->items[store->index[j] - 1]; // candidate
+    if (it->hash == hash && span_eq(it->e.section, section) &&
+        span_eq(it->e.key, key))
+      break;
+    j = (j + 1) & (store->cindex - 1);
+  }
+
+  return j;
+}
+
+// Helper of `store_handler()`. Double the capacity of the hash index of
+// `store`. Return false if out of memory.
+static bool grow_index(eini_store_t *store) {
+  unsigned cindex = 0 == store->cindex ? TABLE_SIZE : 2 * store->cindex;
+  unsigned *index = calloc(cindex, sizeof(unsigned)); // new index
+
+  if (NULL == index)
+    return false;
+
+  for (unsigned i = 0; i < store->nitems; i++) {
+    unsigned j = store->items[i].hash & (cindex - 1);
+    while (0 != index[j])
+      j = (j + 1) & (cindex - 1);
+    index[j] = i + 1;
+  }
+
+  free(store->index);
+  store->index = index;
+  store->cindex = cindex;
+  return true;
+}
+
+// Helper of `eini_store_load()`. Report an out of memory error once.
+#define report_oom                                                             \
+  if (!store->oom && NULL != store->ef)                                        \
+    store->ef("Out of memory", path, line, store->data);                       \
+  store->oom = true;                                                           \
+  return;
+
+// Span handler function used by `eini_store_load()`. Add a key/value pair to
+// `data` (the store). The spans point to strings in the arena of the store.
+static void store_handler(eini_span_t section, eini_span_t key,
+                          eini_span_t value, const char *path,
+                          const unsigned line, void *data) {
+  eini_store_t *store = data;               // the store
+  uint32_t hash = hash_pair(section, key);  // hash of `section` and `key`
+  eini_span_t spath = {path, strlen(path)}; // `path` as a span
+  const char *p;                            // interned `path`
+  unsigned j;                               // position in the hash index
+  item_t *it;                               // the key/value pair
+
+  if (2 * (store->nitems + 1) > store->cindex && !grow_index(store)) {
+    report_oom;
+  }
+
+  p = intern(store, spath, true);
+  if (NULL == p) {
+    report_oom;
+  }
+
+  j = find(store, hash, section, key);
+  if (0 != store->index[j]) {
+    // Already there; update it
+    it = &store->items[store->index[j] - 1];
+  } else {
+    // Add a new one
+    if (store->nitems == store->citems) {
+      unsigned citems = 0 == store->citems ? TABLE_SIZE : 2 * store->citems;
+      item_t *items = realloc(store->items, citems * sizeof(item_t));
+      if (NULL == items) {
+        report_oom;
+      }
+      store->items = items;
+      store->citems = citems;
+    }
+    it = &store->items[store->nitems];
+    it->hash = hash;
+    it->e.section = intern(store, section, false);
+    it->e.key = intern(store, key, false);
+    if (NULL == it->e.section || NULL == it->e.key) {
+      report_oom;
+    }
+    store->index[j] = ++store->nitems;
+  }
+
+  it->e.value = value.ptr;
+  it->e.path = p;
+  it->e.line = line;
+}
+
+// UTF-8 error handler function used by `eini_store_load()`. Pass the error on
+// to the store's error handler function.
+static void store_error(const char *error, const char *path,
+                        const unsigned line, void *data) {
+  eini_store_t *store = data; // the store
+
+  if (NULL != store->ef)
+    store->ef(error, path, line, store->data);
+}
+
+//
+// Functions
+//
+
+eini_store_t *eini_store_new() {
+  eini_store_t *store = calloc(1, sizeof(eini_store_t)); // return value
+
+  if (NULL == store)
+    return NULL;
+
+  store->ctx = eini_ctx_new();
+  store->cache = eini_cache_new(false);
+  store->arena = eini_arena_new();
+  if (NULL == store->ctx || NULL == store->cache || NULL == store->arena) {
+    eini_store_free(store);
+    return NULL;
+  }
+  eini_ctx_handlers_span(store->ctx, store_handler, store_error, store);
+  eini_ctx_arena(store->ctx, store->arena);
+  eini_ctx_cache(store->ctx, store->cache);
+  eini_ctx_mmap(store->ctx, true);
+
+  return store;
+}
+
+void eini_store_load(eini_store_t *store, const char *path,
+                     eini_error_utf8_t ef, void *data) {
+  // Report memory allocation failures again, even if an earlier load had some
+  store->oom = false;
+  store->ef = ef;
+  store->data = data;
+  eini_ctx_file(store->ctx, path);
+}
+
+void eini_store_reload(eini_store_t *store, const char *path,
+                       eini_change_handler_t cf, eini_error_utf8_t ef,
+                       void *data) {
+  eini_store_t *next = eini_store_new(); // new contents of `store`
+  eini_store_t old;                      // old contents of `store`
+
+  store->oom = false;
+  if (NULL == next) {
+    if (NULL != ef)
+      ef("Out of memory", path, 0, data);
+    return;
+  }
+
+  // Load `path` into `next`, reusing the records of `store`
+  eini_ctx_cache(next->ctx, store->cache);
+  eini_store_load(next, path, ef, data);
+  eini_ctx_cache(next->ctx, NULL);
+  if (next->oom) {
+    eini_store_free(next);
+    return;
+  }
+
+  // Report what's changed
+  if (NULL != cf) {
+    for (unsigned i = 0; i < store->nitems; i++) {
+      const eini_entry_t *e = &store->items[i].e; // old key/value pair
+      eini_span_t section = {e->section, strlen(e->section)};
+      eini_span_t key = {e->key, strlen(e->key)};
+      unsigned j = 0 == next->nitems
+                       ? 0
+                       : next->index[find(next, store->items[i].hash, section,
+                                          key)]; // new item number + 1
+      if (0 == j)
+        cf(EINI_REMOVED, e, NULL, data);
+      else if (0 != strcmp(e->value, next->items[j - 1].e.value))
+        cf(EINI_CHANGED, e, &next->items[j - 1].e, data);
+    }
+    for (unsigned i = 0; i < next->nitems; i++) {
+      const eini_entry_t *e = &next->items[i].e; // new key/value pair
+      eini_span_t section = {e->section, strlen(e->section)};
+      eini_span_t key = {e->key, strlen(e->key)};
+      if (0 == store->nitems ||
+          0 == store->index[find(store, next->items[i].hash, section, key)])
+        cf(EINI_ADDED, NULL, e, data);
+    }
+  }
+
+  // Swap the contents of `store` and `next`, and get rid of the old ones
+  old = *store;
+  store->arena = next->arena;
+  store->items = next->items;
+  store->nitems = next->nitems;
+  store->citems = next->citems;
+  store->index = next->index;
+  store->cindex = next->cindex;
+  store->strs = next->strs;
+  store->nstrs = next->nstrs;
+  store->cstrs = next->cstrs;
+  eini_ctx_arena(store->ctx, store->arena);
+  next->arena = old.arena;
+  next->items = old.items;
+  next->index = old.index;
+  next->strs = old.strs;
+  eini_store_free(next);
+}
+
+const eini_entry_t *eini_store_get(const eini_store_t *store,
+                                   const char *section, const char *key) {
+  eini_span_t ssection = {section, strlen(section)}; // `section` as a span
+  eini_span_t skey = {key, strlen(key)};             // `key` as a span
+  unsigned j;                                        // position in index
+
+  if (0 == store->nitems)
+    return NULL;
+
+  j = find(store, hash_pair(ssection, skey), ssection, skey);
+  if (0 == store->index[j])
+    return NULL;
+
+  return &store->items[store->index[j] - 1].e;
+}
+
+unsigned eini_store_size(const eini_store_t *store) { return store->nitems; }
+
+const eini_entry_t *eini_store_at(const eini_store_t *store, unsigned i) {
+  if (i >= store->nitems)
+    return NULL;
+
+  return &store->items[i].e;
+}
+
+void eini_store_free(eini_store_t *store) {
+  if (NULL == store)
+    return;
+
+  eini_arena_free(store->arena);
+  eini_cache_free(store->cache);
+  free(store->items);
+  free(store->index);
+  free(store->strs);
+  eini_ctx_free(store->ctx);
+  free(store);
+}
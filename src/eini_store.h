@@ -0,0 +1,79 @@
+// eINI store (definition)
+
+#ifndef EINI_STORE_H
+
+#define EINI_STORE_H
+
+#include "eini.h"
+
+//
+// Types
+//
+
+// A key/value pair held by a store
+typedef struct {
+  const char *section; // section name
+  const char *key;     // key name
+  const char *value;   // value
+  const char *path;    // .ini file path
+  unsigned line;       // .ini file line
+} eini_entry_t;
+
+// Store of key/value pairs (see `eini_store_new()`)
+typedef struct eini_store eini_store_t;
+
+// Kind of change found by `eini_store_reload()`
+typedef enum {
+  EINI_ADDED,   // key/value pair is new
+  EINI_REMOVED, // key/value pair is gone
+  EINI_CHANGED  // value is different
+} eini_change_t;
+
+// Change handler function
+typedef void (*eini_change_handler_t)(
+    eini_change_t change,    // kind of change
+    const eini_entry_t *old, // previous key/value pair, or NULL if added
+    const eini_entry_t *cur, // current key/value pair, or NULL if removed
+    void *data               // user data
+);
+
+//
+// Functions
+//
+
+// Create a new, empty store. Return NULL on memory allocation failure.
+extern eini_store_t *eini_store_new();
+
+// Parse .ini file in `path` (as `eini_utf8()` would), and add all key/value
+// pairs found into `store`. If a key appears more than once in a section, the
+// last value wins. Call `ef()` (with user data `data`) in case of error.
+extern void eini_store_load(eini_store_t *store, const char *path,
+                            eini_error_utf8_t ef, void *data);
+
+// Replace the contents of `store` with the key/value pairs in the .ini file in
+// `path` (parsed as `eini_store_load()` would), calling `cf()` (with user data
+// `data`) for every pair that has been added or removed, or whose value has
+// changed, since the last time `store` was loaded. Pairs that have only moved
+// to a different line are not reported. Files that haven't changed since they
+// were last parsed aren't parsed again (see `eini_ctx_cache()`). Call `ef()` in
+// case of error. If memory runs out, `store` is left untouched.
+extern void eini_store_reload(eini_store_t *store, const char *path,
+                              eini_change_handler_t cf, eini_error_utf8_t ef,
+                              void *data);
+
+// Return the key/value pair for `key` in `section`, or NULL if there isn't one.
+// The result is valid until `store` is modified.
+extern const eini_entry_t *eini_store_get(const eini_store_t *store,
+                                          const char *section, const char *key);
+
+// Return the number of key/value pairs in `store`
+extern unsigned eini_store_size(const eini_store_t *store);
+
+// Return the `i`th key/value pair in `store`, in the order they were first
+// found in the .ini file(s). The result is valid until `store` is modified.
+extern const eini_entry_t *eini_store_at(const eini_store_t *store, unsigned i);
+
+// Free a store created by `eini_store_new()`
+extern void eini_store_free(eini_store_t *store);
+
+#endif
@@ -0,0 +1,369 @@
+// eINI typed values (implementation)
+
+#define _GNU_SOURCE // `strtod_l()`, with glibc
+
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+#include "eini_value.h"
+
+//
+// Types
+//
+
+// A duration unit
+typedef struct {
+  const char *name; // name, as found after a number
+  int64_t ns;       // number of nanoseconds
+} unit_t;
+
+//
+// Constants
+//
+
+// Maximum length of a number converted by `strtod_l()` without allocating
+#define VALUE_LONG 128
+
+// Powers of 10 that are exactly representable as doubles
+const double value_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                              1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                              1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Duration units
+const unit_t value_units[] = {{"ns", 1LL},
+                              {"us", 1000LL},
+                              {"ms", 1000000LL},
+                              {"s", 1000000000LL},
+                              {"m", 60 * 1000000000LL},
+                              {"h", 3600 * 1000000000LL},
+                              {"d", 86400 * 1000000000LL}};
+
+// Size units (powers of 1024, by number of bits to shift)
+const char value_sizes[] = "bkmgtp";
+
+//
+// Helper functions and macros
+//
+
+// Test whether `c` is a decimal digit, whatever the locale
+#define is_digit(c) ((c) >= '0' && (c) <= '9')
+
+// Test whether `c` is an ASCII letter, whatever the locale
+#define is_letter(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
+
+// Helper of `eini_value_bool()` and `eini_value_size()`. Return ASCII letter
+// `c` in lower case, whatever the locale.
+char value_lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+// Helper of `eini_value_bool()` and `eini_value_size()`. Test whether the
+// `len` characters in `str` are `word` (in lower case), in any case.
+bool value_is(const char *str, size_t len, const char *word) {
+  size_t i; // iterator
+
+  for (i = 0; i < len && '\0' != word[i]; i++)
+    if (value_lower(str[i]) != word[i])
+      return false;
+  return i == len && '\0' == word[i];
+}
+
+// Helper of `eini_value_duration()` and `eini_value_size()`. Read an unsigned
+// decimal number, possibly with a fraction, from `*p` (up to `end`), into its
+// integer part `ip` and its fraction `frac`, and move `*p` past it. Return 0 on
+// success, -1 if there isn't one, or 1 if `ip` overflows.
+int value_decimal(const char **p, const char *end, uint64_t *ip,
+                  double *frac) {
+  const char *s = *p;  // current character
+  bool digits = false; // true if there are digits
+  bool range = false;  // true if `ip` overflows
+  double scale = 0.1;  // weight of the next digit of `frac`
+
+  *ip = 0;
+  *frac = 0;
+  for (; s < end && is_digit(*s); s++) {
+    digits = true;
+    if (*ip > (UINT64_MAX - (*s - '0')) / 10)
+      range = true;
+    else
+      *ip = *ip * 10 + (*s - '0');
+  }
+  if (s < end && '.' == *s)
+    for (s++; s < end && is_digit(*s); s++) {
+      digits = true;
+      *frac += (*s - '0') * scale;
+      scale /= 10;
+    }
+  if (!digits)
+    return -1;
+
+  *p = s;
+  return range ? 1 : 0;
+}
+
+// "C" locale, for `value_strtod()` (created once, by `value_locale()`)
+locale_t value_c_locale;
+
+// Helper of `value_strtod()`. Create the "C" locale when eINI is loaded, so
+// that conversions neither depend on nor race with `setlocale()`.
+__attribute__((constructor)) void value_locale() {
+  value_c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+}
+
+// Helper of `eini_value_double()`. Convert the `len` characters in `str`, a
+// valid decimal number, using `strtod_l()` in the "C" locale (on a copy, on
+// the heap if it's longer than `VALUE_LONG`). Return NULL on success, or an
+// error message otherwise.
+const char *value_strtod(const char *str, size_t len, double *out) {
+  char buf[VALUE_LONG + 1]; // `str`, for `strtod_l()`
+  char *copy = buf;         // `buf`, or a longer copy of `str`
+  double d;                 // return value of `strtod_l()`
+
+  if ((locale_t)0 == value_c_locale ||
+      (len > VALUE_LONG && NULL == (copy = malloc(len + 1))))
+    return "Out of memory";
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+
+  d = strtod_l(copy, NULL, value_c_locale);
+  if (copy != buf)
+    free(copy);
+  if (isinf(d))
+    return "Number out of range";
+  *out = d;
+  return NULL;
+}
+
+//
+// Functions
+//
+
+const char *eini_value_int(eini_span_t value, int64_t *out) {
+  const char *p = value.ptr;               // current character
+  const char *end = value.ptr + value.len; // end of `value`
+  bool neg = false;                        // true if negative
+  uint64_t limit = INT64_MAX;              // largest magnitude allowed
+  uint64_t n = 0;                          // magnitude
+
+  if (0 == value.len)
+    return "Invalid integer";
+  if ('+' == *p || '-' == *p) {
+    neg = '-' == *p++;
+    limit += neg;
+  }
+  if (p == end)
+    return "Invalid integer";
+
+  for (; p < end; p++) {
+    if (!is_digit(*p))
+      return "Invalid integer";
+    if (n > (limit - (*p - '0')) / 10)
+      return "Integer out of range";
+    n = n * 10 + (*p - '0');
+  }
+
+  *out = !neg ? (int64_t)n : n > INT64_MAX ? INT64_MIN : -(int64_t)n;
+  return NULL;
+}
+
+const char *eini_value_double(eini_span_t value, double *out) {
+  const char *p = value.ptr;               // current character
+  const char *end = value.ptr + value.len; // end of `value`
+  bool neg = false;                        // true if negative
+  uint64_t m = 0;                          // significant digits
+  unsigned nm = 0;                         // number of digits in `m`
+  bool exact = true;                       // true if `m` holds all of them
+  bool digits = false;                     // true if there are digits
+  int exp = 0;                             // decimal exponent
+  int e = 0;                               // explicit exponent
+  bool eneg = false;                       // true if `e` is negative
+  double d;                                // return value
+  const char *error;                       // error of `value_strtod()`
+
+  if (0 == value.len)
+    return "Invalid number";
+  if ('+' == *p || '-' == *p)
+    neg = '-' == *p++;
+
+  // Mantissa (leading zeros don't count, and digits past the 19th don't fit)
+  for (; p < end && is_digit(*p); p++) {
+    digits = true;
+    if (nm < 19) {
+      m = m * 10 + (*p - '0');
+      nm += 0 != m;
+    } else {
+      exact = exact && '0' == *p;
+      exp++;
+    }
+  }
+  if (p < end && '.' == *p)
+    for (p++; p < end && is_digit(*p); p++) {
+      digits = true;
+      if (nm < 19) {
+        m = m * 10 + (*p - '0');
+        nm += 0 != m;
+        exp--;
+      } else
+        exact = exact && '0' == *p;
+    }
+  if (!digits)
+    return "Invalid number";
+
+  // Exponent
+  if (p < end && ('e' == *p || 'E' == *p)) {
+    p++;
+    if (p < end && ('+' == *p || '-' == *p))
+      eneg = '-' == *p++;
+    if (p == end || !is_digit(*p))
+      return "Invalid number";
+    for (; p < end && is_digit(*p); p++)
+      e = e < 100000 ? e * 10 + (*p - '0') : e;
+    exp += eneg ? -e : e;
+  }
+  if (p != end)
+    return "Invalid number";
+
+  // Numbers that are exact as doubles, scaled by an exact power of 10, are
+  // rounded correctly by a single operation. Others are left to `strtod()`.
+  if (exact && m <= (1ULL << 53) && exp >= -22 && exp <= 22) {
+    d = exp < 0 ? (double)m / value_pow10[-exp] : (double)m * value_pow10[exp];
+    d = neg ? -d : d;
+  } else if (NULL != (error = value_strtod(value.ptr, value.len, &d)))
+    return error;
+
+  *out = d;
+  return NULL;
+}
+
+const char *eini_value_bool(eini_span_t value, bool *out) {
+  const char *words[] = {"false", "true", "no", "yes", "off", "on", "0", "1"};
+
+  for (unsigned i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    if (value_is(value.ptr, value.len, words[i])) {
+      *out = 1 == i % 2;
+      return NULL;
+    }
+  return "Invalid boolean";
+}
+
+const char *eini_value_duration(eini_span_t value, int64_t *out) {
+  const char *p = value.ptr;               // current character
+  const char *end = value.ptr + value.len; // end of `value`
+  int64_t total = 0;                       // return value
+  bool first = true;                       // true for the first number
+
+  if (0 == value.len)
+    return "Invalid duration";
+
+  while (p < end) {
+    uint64_t ip;      // integer part of the number
+    double frac;      // fraction of the number
+    const char *unit; // unit name
+    int64_t ns = 0;   // nanoseconds in the unit
+    int64_t part;     // nanoseconds in this part
+
+    switch (value_decimal(&p, end, &ip, &frac)) {
+    case -1:
+      return "Invalid duration";
+    case 1:
+      return "Duration out of range";
+    }
+    while (p < end && (' ' == *p || '\t' == *p))
+      p++;
+    unit = p;
+    while (p < end && is_letter(*p))
+      p++;
+
+    // A lone number is in seconds
+    if (unit == p && p == end && first)
+      ns = 1000000000LL;
+    first = false;
+    for (unsigned i = 0; i < sizeof(value_units) / sizeof(unit_t); i++)
+      if ((size_t)(p - unit) == strlen(value_units[i].name) &&
+          0 == strncmp(unit, value_units[i].name, p - unit))
+        ns = value_units[i].ns;
+    if (0 == ns)
+      return "Invalid duration";
+
+    if (ip > (uint64_t)(INT64_MAX / ns))
+      return "Duration out of range";
+    part = (int64_t)ip * ns + (int64_t)(frac * ns + 0.5);
+    if (part > INT64_MAX - total)
+      return "Duration out of range";
+    total += part;
+    while (p < end && (' ' == *p || '\t' == *p))
+      p++;
+  }
+
+  *out = total;
+  return NULL;
+}
+
+const char *eini_value_size(eini_span_t value, uint64_t *out) {
+  const char *p = value.ptr;               // current character
+  const char *end = value.ptr + value.len; // end of `value`
+  uint64_t ip;                             // integer part of the number
+  double frac;                             // fraction of the number
+  unsigned shift = 0;                      // bits to shift by for the unit
+  double rest;                             // bytes in the fraction
+
+  switch (value_decimal(&p, end, &ip, &frac)) {
+  case -1:
+    return "Invalid size";
+  case 1:
+    return "Size out of range";
+  }
+  while (p < end && (' ' == *p || '\t' == *p))
+    p++;
+
+  // Unit
+  if (p < end) {
+    const char *u = strchr(value_sizes, value_lower(*p)); // unit letter
+    if (!is_letter(*p) || NULL == u)
+      return "Invalid size";
+    shift = 10 * (u - value_sizes);
+    p++;
+    if (p < end && (0 == shift || (!value_is(p, end - p, "b") &&
+                                   !value_is(p, end - p, "ib"))))
+      return "Invalid size";
+  }
+
+  // Fractions of a byte make no sense
+  if (0 == shift && 0 != frac)
+    return "Invalid size";
+  rest = (double)(uint64_t)(frac * (double)(1ULL << shift) + 0.5);
+  if (ip > UINT64_MAX >> shift || (ip << shift) > UINT64_MAX - (uint64_t)rest)
+    return "Size out of range";
+
+  *out = (ip << shift) + (uint64_t)rest;
+  return NULL;
+}
+
+void eini_list_init(eini_list_t *list, eini_span_t value) {
+  list->ptr = 0 == value.len ? NULL : value.ptr;
+  list->end = 0 == value.len ? NULL : value.ptr + value.len;
+}
+
+bool eini_list_next(eini_list_t *list, eini_span_t *item) {
+  const char *start = list->ptr; // start of the item
+  const char *stop;              // end of the item
+  const char *comma;             // comma after the item
+
+  if (NULL == start)
+    return false;
+
+  comma = memchr(start, ',', list->end - start);
+  stop = NULL == comma ? list->end : comma;
+  list->ptr = NULL == comma ? NULL : comma + 1;
+
+  while (start < stop && (' ' == *start || '\t' == *start))
+    start++;
+  while (stop > start && (' ' == stop[-1] || '\t' == stop[-1]))
+    stop--;
+  item->ptr = start;
+  item->len = stop - start;
+  return true;
+}
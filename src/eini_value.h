@@ -0,0 +1,62 @@
+// eINI typed values (definition)
+
+#ifndef EINI_VALUE_H
+
+#define EINI_VALUE_H
+
+#include <stdint.h>
+
+#include "eini.h"
+
+//
+// Types
+//
+
+// Iterator over the comma-separated items of a value (see `eini_list_init()`).
+// All of its fields are private.
+typedef struct {
+  const char *ptr; // start of the next item
+  const char *end; // end of the value
+} eini_list_t;
+
+//
+// Functions
+//
+
+// The functions below convert the value in `value` (such as one passed to a
+// span, batch, or schema handler function) and store it into `out`. They are
+// independent of the current locale, and don't allocate anything (except for
+// numbers longer than 128 characters). They return NULL on success, or an
+// error message (for the error handler function, along with the path and line
+// the value was found on) otherwise, in which case `out` is left alone.
+
+// Convert a decimal integer, with an optional sign
+extern const char *eini_value_int(eini_span_t value, int64_t *out);
+
+// Convert a decimal number, with an optional sign, fraction, and exponent
+extern const char *eini_value_double(eini_span_t value, double *out);
+
+// Convert a boolean: `true`/`false`, `yes`/`no`, `on`/`off`, or `1`/`0` (in
+// any case)
+extern const char *eini_value_bool(eini_span_t value, bool *out);
+
+// Convert a duration into nanoseconds. Durations are made of one or more
+// numbers (possibly with a fraction), each followed by a unit: `ns`, `us`,
+// `ms`, `s`, `m`, `h`, or `d` (as in `1h30m`, or `1.5s`). A lone number is in
+// seconds.
+extern const char *eini_value_duration(eini_span_t value, int64_t *out);
+
+// Convert a size into bytes. Sizes are made of a number (possibly with a
+// fraction), followed by an optional unit: `K`, `M`, `G`, `T`, or `P` (powers
+// of 1024, in any case, and optionally followed by `B` or `iB`), or `B`.
+extern const char *eini_value_size(eini_span_t value, uint64_t *out);
+
+// Start iterating over the comma-separated items in `value`
+extern void eini_list_init(eini_list_t *list, eini_span_t value);
+
+// Store the next item of `list` (without surrounding whitespace) into `item`,
+// which points into the value. Return false if there are no more items. Empty
+// values have none, and values with `n` commas have `n + 1`.
+extern bool eini_list_next(eini_list_t *list, eini_span_t *item);
+
+#endif
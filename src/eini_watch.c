@@ -0,0 +1,366 @@
+// eINI watcher (implementation)
+
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eini_watch.h"
+
+//
+// Types
+//
+
+// A watched file
+typedef struct {
+  char *path;       // file path
+  const char *base; // file name (within `path`)
+  int wd;           // inotify watch descriptor of its directory (or of its
+                    // nearest existing ancestor), or -1
+  bool parent;      // true if `wd` watches an ancestor of its directory, which
+                    // doesn't exist (yet)
+  bool seen;        // true if found by the latest scan
+  bool scanned;     // true if its includes have been found by the latest scan
+  bool changed;     // true if changed since the last report
+} file_t;
+
+// Watcher of an .ini file and every file it includes
+struct eini_watch {
+  char *root;       // .ini file path
+  int fd;           // inotify file descriptor
+  unsigned delay;   // time to wait for more events, in milliseconds
+  eini_ctx_t *ctx;  // parser context used to classify lines
+  file_t *files;    // watched files
+  unsigned nfiles;  // number of `files`
+  unsigned cfiles;  // capacity of `files`
+  bool oom;         // true if a memory allocation has failed during a scan
+};
+
+//
+// Constants
+//
+
+// Directory events that might concern a watched file
+#define WATCH_MASK                                                             \
+  (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |       \
+   IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+//
+// Helper functions and macros
+//
+
+// Helper of `add_file()` and `drain()`. Watch the directory of `f`, so that it
+// can be replaced, or created later on. If the directory doesn't exist (yet),
+// its nearest existing ancestor is watched instead, so that it's caught when it
+// does. If nothing can be watched, `f->wd` is left at -1. The previous watch of
+// `f` is dropped if no other file needs it.
+static void watch_dir(eini_watch_t *watch, file_t *f) {
+  int old = f->wd;   // previous watch descriptor
+  char *copy, *dir;  // copy of `f->path`, and directory within it
+  bool used = false; // true if `old` is still needed
+
+  f->wd = -1;
+  f->parent = false;
+  copy = strdup(f->path);
+  for (dir = NULL == copy ? NULL : dirname(copy); NULL != dir;) {
+    f->wd = inotify_add_watch(watch->fd, dir, WATCH_MASK);
+    if (-1 != f->wd || (ENOENT != errno && ENOTDIR != errno) ||
+        0 == strcmp(dir, ".") || 0 == strcmp(dir, "/"))
+      break;
+    dir = dirname(dir);
+    f->parent = true;
+  }
+  free(copy);
+
+  if (-1 == old || old == f->wd)
+    return;
+  for (unsigned i = 0; i < watch->nfiles && !used; i++)
+    used = &watch->files[i] != f && watch->files[i].wd == old;
+  if (!used)
+    inotify_rm_watch(watch->fd, old);
+}
+
+// Helper of `scan()` and `find_includes()`. Start watching the file in `path`
+// (or just mark it as seen, if it's already being watched, and try watching
+// its directory again, if it didn't exist).
+static void add_file(eini_watch_t *watch, const char *path) {
+  const char *slash = strrchr(path, '/'); // last slash in `path`
+  file_t *f;                              // the new file
+
+  for (unsigned i = 0; i < watch->nfiles; i++)
+    if (0 == strcmp(watch->files[i].path, path)) {
+      watch->files[i].seen = true;
+      if (-1 == watch->files[i].wd || watch->files[i].parent)
+        watch_dir(watch, &watch->files[i]);
+      return;
+    }
+
+  if (watch->nfiles == watch->cfiles) {
+    unsigned cfiles = 0 == watch->cfiles ? EINI_SHORT : 2 * watch->cfiles;
+    file_t *files = realloc(watch->files, cfiles * sizeof(file_t));
+    if (NULL == files) {
+      watch->oom = true;
+      return;
+    }
+    watch->files = files;
+    watch->cfiles = cfiles;
+  }
+
+  f = &watch->files[watch->nfiles];
+  f->path = strdup(path);
+  if (NULL == f->path) {
+    watch->oom = true;
+    return;
+  }
+  f->base = NULL == slash ? f->path : &f->path[slash - path + 1];
+  f->seen = true;
+  f->scanned = false;
+  f->changed = false;
+  f->wd = -1;
+  watch_dir(watch, f);
+  watch->nfiles++;
+}
+
+// Helper of `scan()`. Start watching the files that the file in `path`
+// includes (located the same way `eini_ctx_file()` does). Every line is
+// classified on its own, so that errors (such as a missing include, or a file
+// that is being written) don't hide the includes that follow them.
+static void find_includes(eini_watch_t *watch, const char *path) {
+  FILE *fp = fopen(path, "r"); // file pointer for `path`
+  char *ln = NULL;             // current line
+  size_t cap = 0;              // capacity of `ln`
+  ssize_t len;                 // length of `ln`
+  eini_utf8_t res;             // classification of `ln`
+  char *dir;                   // directory of `path`
+  char *ipath;                 // path of an included file
+  size_t icap;                 // capacity of `ipath`
+
+  if (NULL == fp)
+    return;
+
+  while (-1 != (len = getline(&ln, &cap, fp))) {
+    if (len > 0 && '\n' == ln[len - 1])
+      ln[len - 1] = '\0';
+    res = eini_ctx_parse_utf8(watch->ctx, ln);
+    if (EINI_INCLUDE != res.type)
+      continue;
+
+    icap = strlen(path) + strlen(res.value) + 2;
+    ipath = malloc(icap);
+    dir = strdup(path);
+    if (NULL == ipath || NULL == dir)
+      watch->oom = true;
+    else if ('/' == res.value[0])
+      add_file(watch, res.value);
+    else {
+      snprintf(ipath, icap, "%s/%s", dirname(dir), res.value);
+      add_file(watch, ipath);
+    }
+    free(ipath);
+    free(dir);
+  }
+
+  free(ln);
+  fclose(fp);
+}
+
+// Helper of `eini_watch_new()` and `eini_watch_wait()`. Find the files the
+// .ini file of `watch` includes, start watching the new ones, and stop
+// watching the ones that are no longer included. Return false on memory
+// allocation failure.
+static bool scan(eini_watch_t *watch) {
+  unsigned n = 0; // number of files kept
+
+  for (unsigned i = 0; i < watch->nfiles; i++)
+    watch->files[i].seen = watch->files[i].scanned = false;
+  watch->oom = false;
+  add_file(watch, watch->root);
+
+  // Find the includes of every file seen, until no new one turns up
+  for (bool more = true; more;) {
+    more = false;
+    for (unsigned i = 0; i < watch->nfiles; i++)
+      if (watch->files[i].seen && !watch->files[i].scanned) {
+        watch->files[i].scanned = more = true;
+        find_includes(watch, watch->files[i].path);
+      }
+  }
+
+  // Forget the files that are no longer included, and stop watching the
+  // directories that no longer hold any watched file
+  for (unsigned i = 0; i < watch->nfiles; i++) {
+    file_t *f = &watch->files[i]; // current file
+    bool used = false;            // true if `f->wd` is still needed
+    if (f->seen) {
+      watch->files[n++] = *f;
+      continue;
+    }
+    for (unsigned j = 0; j < watch->nfiles && !used; j++)
+      used = watch->files[j].seen && watch->files[j].wd == f->wd;
+    if (!used && -1 != f->wd)
+      inotify_rm_watch(watch->fd, f->wd);
+    free(f->path);
+  }
+  watch->nfiles = n;
+
+  return !watch->oom;
+}
+
+// Helper of `eini_watch_wait()`. Return the number of milliseconds since some
+// point in the past.
+static long long now() {
+  struct timespec ts; // current time
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Helper of `eini_watch_wait()`. Read the pending events of `watch`, and mark
+// the files they concern as changed. Directories that appear on the way to a
+// watched file, or that go away, lead to watching the file's directory (or
+// what's left of it) again. Return false on failure.
+static bool drain(eini_watch_t *watch) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;          // number of bytes read into `buf`
+  bool rewatch = false; // true if directories have appeared or gone away
+
+  while (-1 != (len = read(watch->fd, buf, sizeof(buf))))
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        // A watched directory is gone (or elsewhere, which is the same as far
+        // as paths are concerned)
+        if (ev->mask & IN_MOVE_SELF)
+          inotify_rm_watch(watch->fd, ev->wd);
+        for (unsigned i = 0; i < watch->nfiles; i++)
+          if (watch->files[i].wd == ev->wd) {
+            watch->files[i].changed |=
+                !watch->files[i].parent && (ev->mask & IN_MOVE_SELF);
+            watch->files[i].wd = -1;
+          }
+        rewatch = true;
+      } else if ((ev->mask & IN_Q_OVERFLOW) ||
+                 ((ev->mask & IN_ISDIR) &&
+                  (ev->mask & (IN_CREATE | IN_MOVED_TO))))
+        rewatch = true;
+      for (unsigned i = 0; i < watch->nfiles; i++) {
+        file_t *f = &watch->files[i]; // candidate
+        if ((ev->mask & IN_Q_OVERFLOW) ||
+            (ev->wd == f->wd && !f->parent && ev->len > 0 &&
+             0 == strcmp(ev->name, f->base)))
+          f->changed = true;
+      }
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  if (EAGAIN != errno && EWOULDBLOCK != errno)
+    return false;
+
+  // Files whose directory has just appeared may well exist already
+  if (rewatch)
+    for (unsigned i = 0; i < watch->nfiles; i++) {
+      file_t *f = &watch->files[i]; // candidate
+      if (-1 != f->wd && !f->parent)
+        continue;
+      watch_dir(watch, f);
+      if (-1 != f->wd && !f->parent && 0 == access(f->path, F_OK))
+        f->changed = true;
+    }
+  return true;
+}
+
+//
+// Functions
+//
+
+eini_watch_t *eini_watch_new(const char *path, unsigned delay) {
+  eini_watch_t *watch = calloc(1, sizeof(eini_watch_t)); // return value
+
+  if (NULL == watch)
+    return NULL;
+
+  watch->delay = delay;
+  watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  watch->root = strdup(path);
+  watch->ctx = eini_ctx_new();
+  if (-1 == watch->fd || NULL == watch->root || NULL == watch->ctx) {
+    eini_watch_free(watch);
+    return NULL;
+  }
+  if (!scan(watch)) {
+    eini_watch_free(watch);
+    return NULL;
+  }
+
+  return watch;
+}
+
+int eini_watch_fd(const eini_watch_t *watch) { return watch->fd; }
+
+int eini_watch_wait(eini_watch_t *watch, int timeout, eini_watch_handler_t hf,
+                    void *data) {
+  struct pollfd pfd = {watch->fd, POLLIN, 0}; // what to wait for
+  long long end = now() + timeout;            // when to give up
+  const char **paths;                         // changed files
+  unsigned n = 0;                             // number of `paths`
+  int left;                                   // time left, in milliseconds
+  int res;                                    // return value of `poll()`
+
+  // Wait for an event that concerns a watched file
+  while (0 == n) {
+    left = timeout < 0 ? -1 : end > now() ? (int)(end - now()) : 0;
+    res = poll(&pfd, 1, left);
+    if (-1 == res && EINTR == errno)
+      continue;
+    if (res <= 0)
+      return res;
+
+    // Coalesce whatever follows it closely enough
+    do {
+      if (!drain(watch))
+        return -1;
+      res = poll(&pfd, 1, watch->delay);
+    } while (res > 0 || (-1 == res && EINTR == errno));
+
+    for (unsigned i = 0; i < watch->nfiles; i++)
+      if (watch->files[i].changed)
+        n++;
+  }
+
+  // Report the changed files
+  paths = malloc(n * sizeof(char *));
+  if (NULL == paths)
+    return -1;
+  n = 0;
+  for (unsigned i = 0; i < watch->nfiles; i++)
+    if (watch->files[i].changed) {
+      paths[n++] = watch->files[i].path;
+      watch->files[i].changed = false;
+    }
+  if (NULL != hf)
+    hf(paths, n, data);
+  free(paths);
+
+  // Includes might have changed as well
+  return scan(watch) ? 1 : -1;
+}
+
+unsigned eini_watch_size(const eini_watch_t *watch) { return watch->nfiles; }
+
+void eini_watch_free(eini_watch_t *watch) {
+  if (NULL == watch)
+    return;
+
+  for (unsigned i = 0; i < watch->nfiles; i++)
+    free(watch->files[i].path);
+  free(watch->files);
+  if (-1 != watch->fd)
+    close(watch->fd);
+  eini_ctx_free(watch->ctx);
+  free(watch->root);
+  free(watch);
+}
@@ -0,0 +1,62 @@
+// eINI watcher (definition)
+
+#ifndef EINI_WATCH_H
+
+#define EINI_WATCH_H
+
+#include "eini.h"
+
+//
+// Types
+//
+
+// Watcher of an .ini file and every file it includes (see `eini_watch_new()`)
+typedef struct eini_watch eini_watch_t;
+
+// Watch handler function
+typedef void (*eini_watch_handler_t)(
+    const char *const *paths, // paths of the files that have changed
+    unsigned npaths,          // number of `paths`
+    void *data                // user data
+);
+
+//
+// Constants
+//
+
+// Default time to wait for more events, in milliseconds (see
+// `eini_watch_new()`)
+#define EINI_WATCH_DELAY 50
+
+//
+// Functions
+//
+
+// Create a watcher (Linux only) for the .ini file in `path`, and for every file
+// it includes, directly or not (as found by its `include` directives, even
+// those that follow errors). Files that are created, modified, deleted, or
+// renamed are reported, including included files that don't exist yet (even if
+// their directories don't either). Events that follow one another by less than
+// `delay` milliseconds are coalesced into a single report. Return NULL on
+// failure.
+extern eini_watch_t *eini_watch_new(const char *path, unsigned delay);
+
+// Return a file descriptor that becomes readable when `watch` has events
+// pending, for use with `poll()` and friends
+extern int eini_watch_fd(const eini_watch_t *watch);
+
+// Wait up to `timeout` milliseconds (or forever, if it is negative) for changes
+// to the files of `watch`, and call `hf()` (with user data `data`) once, with
+// all the files that changed. The set of watched files is then brought up to
+// date (since includes might have been added or removed). Return 1 if `hf()`
+// has been called, 0 on timeout, or -1 on failure.
+extern int eini_watch_wait(eini_watch_t *watch, int timeout,
+                           eini_watch_handler_t hf, void *data);
+
+// Return the number of files `watch` is watching
+extern unsigned eini_watch_size(const eini_watch_t *watch);
+
+// Free a watcher created by `eini_watch_new()`
+extern void eini_watch_free(eini_watch_t *watch);
+
+#endif
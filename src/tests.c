@@ -17,12 +17,24 @@
 
 #include <CUnit/Basic.h>
 #include <CUnit/CUnit.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wchar.h>
 
 #include "eini.h"
+#include "eini_image.h"
+#include "eini_store.h"
+#include "eini_value.h"
+#include "tests_schema.h"
+#ifdef __linux__
+#include "eini_watch.h"
+#endif
 
 //
 // Helper macros
@@ -170,9 +182,25 @@ void test_eini_parse() {
   CU_ASSERT(0 == wcscmp(parsed.key, L"se7enUp"));
   CU_ASSERT(0 == wcscmp(parsed.value, L"in single \' quotes\\"));
 
+  parsed = eini_parse("\tk_8 \t=\t \t");
+  CU_ASSERT_EQUAL(parsed.type, EINI_VALUE);
+  CU_ASSERT(0 == wcscmp(parsed.key, L"k_8"));
+  CU_ASSERT(0 == wcscmp(parsed.value, L""));
+
   parsed = eini_parse("");
   CU_ASSERT_EQUAL(parsed.type, EINI_NONE);
 
+  parsed = eini_parse(" \t ; just a comment");
+  CU_ASSERT_EQUAL(parsed.type, EINI_NONE);
+
+  parsed = eini_parse("[sec tion]");
+  CU_ASSERT_EQUAL(parsed.type, EINI_ERROR);
+  CU_ASSERT(0 == wcscmp(parsed.value, L"Unable to parse '[sec tion]'"));
+
+  parsed = eini_parse("[_section]");
+  CU_ASSERT_EQUAL(parsed.type, EINI_ERROR);
+  CU_ASSERT(0 == wcscmp(parsed.value, L"Unable to parse '[_section]'"));
+
   parsed = eini_parse("[garbled$ect_on]");
   CU_ASSERT_EQUAL(parsed.type, EINI_ERROR);
   CU_ASSERT(0 == wcscmp(parsed.value, L"Unable to parse '[garbled$ect_on]'"));
@@ -241,6 +269,42 @@ void test_eini_parse() {
   eini_winddown();
 }
 
+// Tests for `eini_parse_utf8()`
+
+// Main test function
+void test_eini_parse_utf8() {
+  eini_utf8_t parsed; // return value of `eini_parse_utf8()`
+
+  eini_init();
+
+  parsed = eini_parse_utf8(" include \"/usr/share/foo\" ; comment");
+  CU_ASSERT_EQUAL(parsed.type, EINI_INCLUDE);
+  CU_ASSERT(0 == strcmp(parsed.value, "/usr/share/foo"));
+
+  parsed = eini_parse_utf8("  [\tSectionTwo  ]\t\t \n");
+  CU_ASSERT_EQUAL(parsed.type, EINI_SECTION);
+  CU_ASSERT(0 == strcmp(parsed.value, "SectionTwo"));
+
+  parsed = eini_parse_utf8("key4= \"ακόμη ένα eggie \\\"ή\\\" αυγό\"");
+  CU_ASSERT_EQUAL(parsed.type, EINI_VALUE);
+  CU_ASSERT(0 == strcmp(parsed.key, "key4"));
+  CU_ASSERT(0 == strcmp(parsed.value, "ακόμη ένα eggie \"ή\" αυγό"));
+
+  parsed = eini_parse_utf8("key=\xce\xb1\xce");
+  CU_ASSERT_EQUAL(parsed.type, EINI_ERROR);
+  CU_ASSERT(0 == strcmp(parsed.value, "Non-string data"));
+
+  parsed = eini_parse_utf8("key=\xc0\xaf");
+  CU_ASSERT_EQUAL(parsed.type, EINI_ERROR);
+  CU_ASSERT(0 == strcmp(parsed.value, "Non-string data"));
+
+  parsed = eini_parse_utf8("κλειδί=value");
+  CU_ASSERT_EQUAL(parsed.type, EINI_ERROR);
+  CU_ASSERT(0 == strcmp(parsed.value, "Unable to parse 'κλειδί=value'"));
+
+  eini_winddown();
+}
+
 // Tests for `eini()`
 
 wchar_t *test_eini_output[256]; // `test_eini_handler()` and `test_eini_error()`
@@ -292,6 +356,27 @@ void test_eini_error(const wchar_t *error, const char *path,
   test_eini_output[test_eini_output_i++] = output;
 }
 
+// UTF-8 handler function for `eini_utf8()`
+void test_eini_handler_utf8(const char *section, const char *key,
+                            const char *value, const char *path,
+                            const unsigned line, void *data) {
+  wchar_t *output = calloc(EINI_LONG, sizeof(wchar_t));
+
+  swprintf(output, EINI_LONG, L"%s:%d -- %s.%s=%s (%s)", path, line, section,
+           key, value, (char *)data);
+  test_eini_output[test_eini_output_i++] = output;
+}
+
+// UTF-8 error function for `eini_utf8()`
+void test_eini_error_utf8(const char *error, const char *path,
+                          const unsigned line, void *data) {
+  wchar_t *output = calloc(EINI_LONG, sizeof(wchar_t));
+
+  swprintf(output, EINI_LONG, L"%s:%d -- %s (%s)", path, line, error,
+           (char *)data);
+  test_eini_output[test_eini_output_i++] = output;
+}
+
 // Main test function
 void test_eini() {
   char tpath[EINI_SHORT];      // path to a temporary config file
@@ -355,12 +440,1946 @@ void test_eini() {
            tpath);
   CU_ASSERT(0 == wcscmp(test_eini_output[6], expected));
 
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fwrite(test_eini_data_1, sizeof(char), strlen(test_eini_data_1), tp);
+  fclose(tp);
+  eini_utf8(test_eini_handler_utf8, test_eini_error_utf8, tpath, "utf8");
+  CU_ASSERT_EQUAL(test_eini_output_i, 10);
+  swprintf(expected, EINI_LONG, L"%s:4 -- section1.opt1=value #1 (utf8)",
+           tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[7], expected))
+  swprintf(expected, EINI_LONG, L"%s:8 -- section2.opt3=value #3 (utf8)",
+           tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[9], expected))
+
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fwrite(test_eini_data_4, sizeof(char), strlen(test_eini_data_4), tp);
+  fclose(tp);
+  eini_utf8(test_eini_handler_utf8, test_eini_error_utf8, tpath, "utf8");
+  CU_ASSERT_EQUAL(test_eini_output_i, 11);
+  swprintf(expected, EINI_LONG,
+           L"%s:3 -- Unable to parse 'yadayada bah poo' (utf8)", tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[10], expected));
+
   eini_winddown();
   for (unsigned i = 0; i < test_eini_output_i; i++)
     free(test_eini_output[i]);
   unlink(tpath);
 }
 
+// Tests for `eini_span()`
+
+// Span handler function for `eini_span()`
+void test_eini_handler_span(eini_span_t section, eini_span_t key,
+                            eini_span_t value, const char *path,
+                            const unsigned line, void *data) {
+  wchar_t *output = calloc(EINI_LONG, sizeof(wchar_t));
+
+  swprintf(output, EINI_LONG, L"%s:%d -- %.*s.%.*s=%.*s", path, line,
+           (int)section.len, section.ptr, (int)key.len, key.ptr,
+           (int)value.len, value.ptr);
+  test_eini_output[test_eini_output_i++] = output;
+}
+
+// Main test function
+void test_eini_span() {
+  char tpath[EINI_SHORT];      // path to a temporary config file
+  FILE *tp;                    // file handler for `tpath`
+  wchar_t expected[EINI_LONG]; // expected result
+  char *data = "[section1]\n"
+               "opt1 = 'value #1' ; comment\n"
+               "opt2=\"escaped\\tvalue\"\n"
+               "\n"
+               "[ section2 ]\n"
+               "opt3=value #3"; // test data
+
+  strlcpy(tpath, "testsXXXXXX", EINI_SHORT);
+  close(mkstemp(tpath));
+  test_eini_output_i = 0;
+  eini_init();
+
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fwrite(data, sizeof(char), strlen(data), tp);
+  fclose(tp);
+  eini_span(test_eini_handler_span, test_eini_error_utf8, tpath, "span");
+  CU_ASSERT_EQUAL(test_eini_output_i, 3);
+  swprintf(expected, EINI_LONG, L"%s:2 -- section1.opt1=value #1", tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[0], expected));
+  swprintf(expected, EINI_LONG, L"%s:3 -- section1.opt2=escaped\tvalue", tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[1], expected));
+  swprintf(expected, EINI_LONG, L"%s:6 -- section2.opt3=value #3", tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[2], expected));
+
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fwrite(test_eini_data_4, sizeof(char), strlen(test_eini_data_4), tp);
+  fclose(tp);
+  eini_span(test_eini_handler_span, test_eini_error_utf8, tpath, "span");
+  CU_ASSERT_EQUAL(test_eini_output_i, 4);
+  swprintf(expected, EINI_LONG,
+           L"%s:3 -- Unable to parse 'yadayada bah poo' (span)", tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[3], expected));
+
+  eini_winddown();
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+  unlink(tpath);
+}
+
+// Tests for `eini_buffer()` and `eini_fd()`
+
+// Include resolver function for `eini_buffer()`
+int test_eini_resolver(const char *path, eini_span_t *contents, void *data) {
+  if (0 == strcmp(path, "/virtual/other.ini")) {
+    contents->ptr = (char *)data;
+    contents->len = strlen((char *)data);
+    return 1;
+  } else if (0 == strcmp(path, "/virtual/missing.ini"))
+    return -1;
+
+  return 0;
+}
+
+// Main test function
+void test_eini_buffer() {
+  char tpath[EINI_SHORT]; // path to a temporary config file
+  FILE *tp;               // file handler for `tpath`
+  int fd;                 // file descriptor for `tpath`
+  char *data = "[a]\n"
+               "x=1\n"
+               "include other.ini\n"
+               "include missing.ini\n"
+               "z=3"; // test data
+  char *other = "[b]\n"
+                "y=2\n"; // test data (included from `data`)
+
+  test_eini_output_i = 0;
+  eini_init();
+
+  eini_resolver(test_eini_resolver, other);
+  eini_buffer(data, strlen(data), "/virtual/main.ini", test_eini_handler,
+              test_eini_error);
+  eini_resolver(NULL, NULL);
+  CU_ASSERT_EQUAL(test_eini_output_i, 3);
+  CU_ASSERT(0 == wcscmp(test_eini_output[0], L"/virtual/main.ini:2 -- a.x=1"));
+  CU_ASSERT(0 == wcscmp(test_eini_output[1], L"/virtual/other.ini:2 -- b.y=2"));
+  CU_ASSERT(0 == wcscmp(test_eini_output[2],
+                        L"/virtual/main.ini:4 -- Unable to open "
+                        L"'/virtual/missing.ini'"));
+
+  strlcpy(tpath, "testsXXXXXX", EINI_SHORT);
+  close(mkstemp(tpath));
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fwrite(test_eini_data_1, sizeof(char), strlen(test_eini_data_1), tp);
+  fclose(tp);
+  fd = open(tpath, O_RDONLY);
+  eini_fd(fd, "fd.ini", test_eini_handler, test_eini_error);
+  close(fd);
+  CU_ASSERT_EQUAL(test_eini_output_i, 6);
+  CU_ASSERT(
+      0 == wcscmp(test_eini_output[3], L"fd.ini:4 -- section1.opt1=value #1"));
+  CU_ASSERT(
+      0 == wcscmp(test_eini_output[5], L"fd.ini:8 -- section2.opt3=value #3"));
+
+  eini_winddown();
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+  unlink(tpath);
+}
+
+// Tests for `eini_ctx_*()`
+
+// Thread body for `test_eini_ctx()`. Parse a line that is unique to the thread
+// many times over, using a separate context, and return the number of times
+// that the result was wrong.
+void *test_eini_ctx_thread(void *arg) {
+  long n = (long)arg;           // thread number
+  long bad = 0;                 // number of wrong results
+  char src[EINI_SHORT];         // line to parse
+  char expected[EINI_SHORT];    // expected value
+  eini_utf8_t parsed;           // return value of `eini_ctx_parse_utf8()`
+  eini_ctx_t *ctx = eini_ctx_new(); // context used by this thread
+
+  snprintf(src, EINI_SHORT, "key%ld = 'value \\'%ld\\''", n, n);
+  snprintf(expected, EINI_SHORT, "value '%ld'", n);
+  for (unsigned i = 0; i < 10000; i++) {
+    parsed = eini_ctx_parse_utf8(ctx, src);
+    if (EINI_VALUE != parsed.type || 0 != strcmp(parsed.value, expected))
+      bad++;
+  }
+
+  eini_ctx_free(ctx);
+  return (void *)bad;
+}
+
+// Main test function
+void test_eini_ctx() {
+  pthread_t thr[4]; // threads
+  void *bad;        // return value of `test_eini_ctx_thread()`
+  eini_ctx_t *ctx;  // context
+  eini_t parsed;    // return value of `eini_ctx_parse()`
+
+  ctx = eini_ctx_new();
+  CU_ASSERT_PTR_NOT_NULL(ctx);
+  parsed = eini_ctx_parse(ctx, "[ctx]");
+  CU_ASSERT_EQUAL(parsed.type, EINI_SECTION);
+  CU_ASSERT(0 == wcscmp(parsed.value, L"ctx"));
+  parsed = eini_ctx_parse(ctx, "key=\"ctx value\"");
+  CU_ASSERT_EQUAL(parsed.type, EINI_VALUE);
+  CU_ASSERT(0 == wcscmp(parsed.key, L"key"));
+  CU_ASSERT(0 == wcscmp(parsed.value, L"ctx value"));
+  eini_ctx_free(ctx);
+
+  for (long i = 0; i < 4; i++)
+    pthread_create(&thr[i], NULL, test_eini_ctx_thread, (void *)i);
+  for (long i = 0; i < 4; i++) {
+    pthread_join(thr[i], &bad);
+    CU_ASSERT_EQUAL((long)bad, 0);
+  }
+}
+
+// Tests for `eini_ctx_max_line()`
+
+// UTF-8 handler function for `eini_ctx_max_line()`. Record the length of the
+// value, instead of the value itself.
+void test_eini_handler_max_line(const char *section, const char *key,
+                                const char *value, const char *path,
+                                const unsigned line, void *data) {
+  wchar_t *output = calloc(EINI_LONG, sizeof(wchar_t));
+
+  swprintf(output, EINI_LONG, L"%u -- %s.%s has %zu characters", line, section,
+           key, strlen(value));
+  test_eini_output[test_eini_output_i++] = output;
+}
+
+// Main test function
+void test_eini_max_line() {
+  char tpath[EINI_SHORT];      // path to a temporary config file
+  FILE *tp;                    // file handler for `tpath`
+  eini_ctx_t *ctx;             // context
+  wchar_t expected[EINI_LONG]; // expected result
+
+  strlcpy(tpath, "testsXXXXXX", EINI_SHORT);
+  close(mkstemp(tpath));
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fprintf(tp, "[section]\nshort=1\nlong='");
+  for (unsigned i = 0; i < 4 * EINI_LONG; i++)
+    fprintf(tp, "x\\t");
+  fprintf(tp, "'\nafter=2\n");
+  fclose(tp);
+  test_eini_output_i = 0;
+
+  // Read the file with `getline()`, and then memory-mapped
+  ctx = eini_ctx_new();
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_max_line, test_eini_error_utf8,
+                         "max_line");
+  for (int map = 0; map < 2; map++) {
+    eini_ctx_mmap(ctx, map);
+    eini_ctx_file(ctx, tpath);
+  }
+  CU_ASSERT_EQUAL(test_eini_output_i, 6);
+  for (unsigned i = 0; i < 6; i += 3) {
+    CU_ASSERT(0 == wcscmp(test_eini_output[i],
+                          L"2 -- section.short has 1 characters"));
+    swprintf(expected, EINI_LONG, L"3 -- section.long has %u characters",
+             8 * EINI_LONG);
+    CU_ASSERT(0 == wcscmp(test_eini_output[i + 1], expected));
+    CU_ASSERT(0 == wcscmp(test_eini_output[i + 2],
+                          L"4 -- section.after has 1 characters"));
+  }
+
+  // Give up on over-long lines
+  eini_ctx_max_line(ctx, EINI_LONG);
+  for (int map = 0; map < 2; map++) {
+    eini_ctx_mmap(ctx, map);
+    eini_ctx_file(ctx, tpath);
+  }
+  CU_ASSERT_EQUAL(test_eini_output_i, 10);
+  swprintf(expected, EINI_LONG, L"%s:3 -- Line too long (max_line)", tpath);
+  CU_ASSERT(0 == wcscmp(test_eini_output[7], expected));
+  CU_ASSERT(0 == wcscmp(test_eini_output[9], expected));
+
+  eini_ctx_free(ctx);
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+  unlink(tpath);
+}
+
+// Tests for comment, quote, and escape handling on long lines
+
+// Main test function
+void test_eini_escapes() {
+  char src[4 * EINI_LONG];      // line to parse
+  char expected[4 * EINI_LONG]; // expected value
+  eini_utf8_t res;              // parse result
+  bool ok = true;               // true if all lines were parsed as expected
+
+  eini_init();
+
+  // Quotes, escapes and comments at every position across block boundaries
+  for (int n = 0; n < 200; n++) {
+    // Even run of `\`s before a quote: the quote ends the string
+    snprintf(src, sizeof(src), "k=\"%*s\\\"; \\\\\" ; comment \"", n, "");
+    snprintf(expected, sizeof(expected), "%*s\"; \\", n, "");
+    res = eini_parse_utf8(src);
+    if (EINI_VALUE != res.type || 0 != strcmp(res.value, expected))
+      ok = false;
+
+    // Odd run of `\`s before a quote: the quote is escaped
+    snprintf(src, sizeof(src), "k='%*s\\\\\\'' ; comment '", n, "");
+    snprintf(expected, sizeof(expected), "%*s\\'", n, "");
+    res = eini_parse_utf8(src);
+    if (EINI_VALUE != res.type || 0 != strcmp(res.value, expected))
+      ok = false;
+
+    // Run of 15 `\`s (possibly crossing a block boundary) before a quote:
+    // the quote is escaped, and the string goes on
+    snprintf(src, sizeof(src), "k=\"%*s", n, "");
+    for (unsigned i = 0; i < 15; i++)
+      strlcat(src, "\\", sizeof(src));
+    strlcat(src, "\" ; x\"", sizeof(src));
+    snprintf(expected, sizeof(expected), "%*s\\\\\\\\\\\\\\\" ; x", n,
+             "");
+    res = eini_parse_utf8(src);
+    if (EINI_VALUE != res.type || 0 != strcmp(res.value, expected))
+      ok = false;
+  }
+  CU_ASSERT(ok);
+
+  eini_winddown();
+}
+
+// Tests for `eini_ctx_threads()`
+
+// Helper of `test_eini_threads()`. Write `data` into file `name` in `dir`.
+void test_eini_threads_file(const char *dir, const char *name,
+                            const char *data) {
+  char path[EINI_LONG]; // file path
+  FILE *fp;             // file handler for `path`
+
+  snprintf(path, EINI_LONG, "%s/%s", dir, name);
+  fp = fopen(path, "w");
+  CU_ASSERT_NOT_EQUAL(fp, NULL);
+  fputs(data, fp);
+  fclose(fp);
+}
+
+// Main test function
+void test_eini_threads() {
+  char dir[EINI_SHORT];        // temporary directory for the include tree
+  char path[EINI_LONG];        // path of the root file
+  char name[EINI_SHORT];       // name of a generated file
+  char data[EINI_LONG];        // contents of a generated file
+  char root[4 * EINI_LONG] = "[main]\n"
+                             "a=1\n"
+                             "include frag1.ini\n"
+                             "b='two'\n"
+                             "include sub/frag2.ini\n"
+                             "include frag1.ini\n"; // root file contents
+  eini_ctx_t *ctx;             // context
+  unsigned n;                  // number of results of serial parsing
+  wchar_t expected[EINI_LONG]; // expected result
+  char cmd[EINI_LONG];         // command to remove `dir`
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  snprintf(path, EINI_LONG, "%s/sub", dir);
+  mkdir(path, 0700);
+  test_eini_threads_file(dir, "frag1.ini",
+                         "[f1]\nx=one\ninclude frag3.ini\nw=after\n");
+  test_eini_threads_file(dir, "frag3.ini",
+                         "[f3]\ny=\"\\tz\"\nyadayada bah poo\nz=never\n");
+  test_eini_threads_file(dir, "sub/frag2.ini", "k=no section\n");
+  for (unsigned i = 0; i < 20; i++) {
+    snprintf(name, EINI_SHORT, "many%02u.ini", i);
+    snprintf(data, EINI_LONG, "[s%u]\nk%u=%u\n", i, i, i);
+    test_eini_threads_file(dir, name, data);
+    snprintf(data, EINI_LONG, "include %s\n", name);
+    strlcat(root, data, 4 * EINI_LONG);
+  }
+  strlcat(root, "include missing.ini\nc=never\n", 4 * EINI_LONG);
+  test_eini_threads_file(dir, "main.ini", root);
+  test_eini_threads_file(dir, "cycle.ini", "[c]\nk=v\ninclude cycle.ini\n");
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  ctx = eini_ctx_new();
+
+  // Parallel parsing gives the same results as serial parsing (wide)
+  test_eini_output_i = 0;
+  eini_ctx_handlers(ctx, test_eini_handler, test_eini_error);
+  eini_ctx_file(ctx, path);
+  n = test_eini_output_i;
+  CU_ASSERT_EQUAL(n, 32);
+  eini_ctx_threads(ctx, 4);
+  eini_ctx_file(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+  for (unsigned i = 0; i < n && i + n < test_eini_output_i; i++)
+    CU_ASSERT(0 == wcscmp(test_eini_output[i], test_eini_output[i + n]));
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+
+  // Parallel parsing gives the same results as serial parsing (UTF-8)
+  test_eini_output_i = 0;
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_utf8, test_eini_error_utf8,
+                         "threads");
+  eini_ctx_threads(ctx, 0);
+  eini_ctx_file(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, n);
+  eini_ctx_threads(ctx, 3);
+  eini_ctx_file(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+  for (unsigned i = 0; i < n && i + n < test_eini_output_i; i++)
+    CU_ASSERT(0 == wcscmp(test_eini_output[i], test_eini_output[i + n]));
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+
+  // Circular inclusion is caught
+  test_eini_output_i = 0;
+  snprintf(path, EINI_LONG, "%s/cycle.ini", dir);
+  eini_ctx_file(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2);
+  swprintf(expected, EINI_LONG,
+           L"%s:3 -- Circular inclusion of '%s': '%s' -> '%s' (threads)", path,
+           path, path, path);
+  CU_ASSERT(0 == wcscmp(test_eini_output[1], expected));
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+
+  eini_ctx_free(ctx);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for include cycles and `eini_ctx_include_once()`
+void test_eini_include_once() {
+  char dir[EINI_SHORT];        // temporary directory for the include tree
+  char path[EINI_LONG];        // path of the root file
+  wchar_t expected[EINI_LONG]; // expected result
+  char cmd[EINI_LONG];         // command to remove `dir`
+  eini_ctx_t *ctx;             // context
+  eini_cache_t *cache;         // cache
+  unsigned n;                  // number of results of serial parsing
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  snprintf(path, EINI_LONG, "%s/sub", dir);
+  mkdir(path, 0700);
+  test_eini_threads_file(dir, "a.ini", "[a]\nk=1\ninclude sub/b.ini\nz=9\n");
+  test_eini_threads_file(dir, "sub/b.ini", "[b]\nk=2\ninclude ../a.ini\n");
+  test_eini_threads_file(dir, "f.ini", "[f]\nk=3\n");
+  test_eini_threads_file(dir, "once.ini",
+                         "[o]\ninclude f.ini\ninclude sub/../f.ini\n"
+                         "include f.ini\nk=4\n");
+  ctx = eini_ctx_new();
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_utf8, test_eini_error_utf8,
+                         "once");
+
+  // A cycle is caught even if the paths differ, and the whole of it is
+  // reported, both serially and in parallel
+  test_eini_output_i = 0;
+  snprintf(path, EINI_LONG, "%s/a.ini", dir);
+  eini_ctx_file(ctx, path);
+  n = test_eini_output_i;
+  CU_ASSERT_EQUAL(n, 4);
+  swprintf(expected, EINI_LONG,
+           L"%s/sub/b.ini:3 -- Circular inclusion of '%s/sub/../a.ini': "
+           L"'%s/a.ini' -> '%s/sub/b.ini' -> '%s/sub/../a.ini' (once)",
+           dir, dir, dir, dir, dir);
+  CU_ASSERT(0 == wcscmp(test_eini_output[2], expected));
+  swprintf(expected, EINI_LONG, L"%s/a.ini:4 -- a.z=9 (once)", dir);
+  CU_ASSERT(0 == wcscmp(test_eini_output[3], expected));
+  eini_ctx_threads(ctx, 4);
+  eini_ctx_file(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+  for (unsigned i = 0; i < n && i + n < test_eini_output_i; i++)
+    CU_ASSERT(0 == wcscmp(test_eini_output[i], test_eini_output[i + n]));
+  for (unsigned i = n; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+
+  // The same goes with a cache, whether the records are fresh or reused, and
+  // whether they're parsed serially or in parallel
+  cache = eini_cache_new(false);
+  eini_ctx_cache(ctx, cache);
+  for (unsigned i = 0; i < 4; i++) {
+    test_eini_output_i = n;
+    eini_ctx_threads(ctx, i < 2 ? 0 : 4);
+    eini_ctx_file(ctx, path);
+    CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+    for (unsigned j = 0; j < n && j + n < test_eini_output_i; j++)
+      CU_ASSERT(0 == wcscmp(test_eini_output[j], test_eini_output[j + n]));
+    for (unsigned j = n; j < test_eini_output_i; j++)
+      free(test_eini_output[j]);
+  }
+  eini_ctx_cache(ctx, NULL);
+  eini_cache_free(cache);
+  for (unsigned i = 0; i < n; i++)
+    free(test_eini_output[i]);
+
+  // Files are included every time, unless in `include_once` mode
+  test_eini_output_i = 0;
+  snprintf(path, EINI_LONG, "%s/once.ini", dir);
+  eini_ctx_threads(ctx, 0);
+  eini_ctx_file(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 4);
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+  test_eini_output_i = 0;
+  eini_ctx_include_once(ctx, true);
+  eini_ctx_file(ctx, path);
+  n = test_eini_output_i;
+  CU_ASSERT_EQUAL(n, 2);
+  swprintf(expected, EINI_LONG, L"%s/f.ini:2 -- f.k=3 (once)", dir);
+  CU_ASSERT(0 == wcscmp(test_eini_output[0], expected));
+  eini_ctx_threads(ctx, 4);
+  eini_ctx_file(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+  for (unsigned i = 0; i < n && i + n < test_eini_output_i; i++)
+    CU_ASSERT(0 == wcscmp(test_eini_output[i], test_eini_output[i + n]));
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+
+  eini_ctx_free(ctx);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for included files that are empty, missing, or reached through other
+// names
+
+// Helper of `test_eini_include_open()`. Parse `path` with `ctx` serially, in
+// parallel, and with a cache, check that the results are the same every time,
+// and return their number. The results of the serial parse are kept.
+unsigned test_eini_include_open_parse(eini_ctx_t *ctx, const char *path) {
+  eini_cache_t *cache = eini_cache_new(false); // cache
+  unsigned n;                                  // number of results
+
+  test_eini_output_i = 0;
+  eini_ctx_file(ctx, path);
+  n = test_eini_output_i;
+  for (unsigned i = 0; i < 2; i++) {
+    eini_ctx_threads(ctx, 0 == i ? 4 : 0);
+    eini_ctx_cache(ctx, 0 == i ? NULL : cache);
+    eini_ctx_file(ctx, path);
+    CU_ASSERT_EQUAL(test_eini_output_i, (i + 2) * n);
+    for (unsigned j = 0; j < n && (i + 1) * n + j < test_eini_output_i; j++)
+      CU_ASSERT(0 ==
+                wcscmp(test_eini_output[j], test_eini_output[(i + 1) * n + j]));
+  }
+  for (unsigned j = n; j < test_eini_output_i; j++)
+    free(test_eini_output[j]);
+  test_eini_output_i = n;
+
+  eini_ctx_cache(ctx, NULL);
+  eini_cache_free(cache);
+  return n;
+}
+
+// Main test function
+void test_eini_include_open() {
+  char dir[EINI_SHORT];        // temporary directory for the include tree
+  char path[EINI_LONG];        // path of the root file
+  char alias[EINI_LONG];       // path of a link
+  wchar_t expected[EINI_LONG]; // expected result
+  char cmd[EINI_LONG];         // command to remove `dir`
+  eini_ctx_t *ctx;             // context
+  unsigned n;                  // number of results
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  test_eini_threads_file(dir, "main.ini",
+                         "[m]\na=1\ninclude empty.ini\ninclude f.ini\n"
+                         "include hard.ini\ninclude missing.ini\nz=never\n");
+  test_eini_threads_file(dir, "empty.ini", "");
+  test_eini_threads_file(dir, "f.ini", "[f]\nk=1\n");
+  test_eini_threads_file(dir, "a.ini", "[a]\nk=1\ninclude link.ini\nz=never\n");
+  snprintf(path, EINI_LONG, "%s/f.ini", dir);
+  snprintf(alias, EINI_LONG, "%s/hard.ini", dir);
+  CU_ASSERT_EQUAL(link(path, alias), 0);
+  snprintf(alias, EINI_LONG, "%s/link.ini", dir);
+  CU_ASSERT_EQUAL(symlink("a.ini", alias), 0);
+  ctx = eini_ctx_new();
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_utf8, test_eini_error_utf8,
+                         "open");
+
+  // Empty files are fine, missing files are reported where they're included
+  // (which is where the including file stops), and a hard link is included
+  // again, unless in `include_once` mode
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  for (unsigned once = 0; once < 2; once++) {
+    eini_ctx_include_once(ctx, once);
+    n = test_eini_include_open_parse(ctx, path);
+    CU_ASSERT_EQUAL(n, 4 - once);
+    swprintf(expected, EINI_LONG, L"%s/f.ini:2 -- f.k=1 (open)", dir);
+    CU_ASSERT(n > 1 && 0 == wcscmp(test_eini_output[1], expected));
+    swprintf(expected, EINI_LONG,
+             L"%s:6 -- Unable to open '%s/missing.ini' (open)", path, dir);
+    CU_ASSERT(n > 0 && 0 == wcscmp(test_eini_output[n - 1], expected));
+    for (unsigned i = 0; i < n; i++)
+      free(test_eini_output[i]);
+  }
+
+  // A file that includes itself through a symbolic link is caught
+  snprintf(path, EINI_LONG, "%s/a.ini", dir);
+  n = test_eini_include_open_parse(ctx, path);
+  CU_ASSERT_EQUAL(n, 2);
+  swprintf(expected, EINI_LONG,
+           L"%s:3 -- Circular inclusion of '%s': '%s' -> '%s' (open)", path,
+           alias, path, alias);
+  CU_ASSERT(n > 1 && 0 == wcscmp(test_eini_output[1], expected));
+  for (unsigned i = 0; i < n; i++)
+    free(test_eini_output[i]);
+
+  eini_ctx_free(ctx);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for `eini_ctx_max_depth()`
+
+unsigned test_eini_max_depth_n;            // number of key/value pairs found
+char test_eini_max_depth_error[EINI_LONG]; // last error
+char test_eini_max_depth_path[EINI_LONG];  // path of the root file
+unsigned test_eini_max_depth_calls;        // number of calls to the resolver
+
+// UTF-8 handler function for `eini_ctx_max_depth()`. Just count the key/value
+// pairs.
+void test_eini_handler_max_depth(const char *section, const char *key,
+                                 const char *value, const char *path,
+                                 const unsigned line, void *data) {
+  test_eini_max_depth_n++;
+}
+
+// UTF-8 error function for `eini_ctx_max_depth()`. Keep the last error.
+void test_eini_error_max_depth(const char *error, const char *path,
+                               const unsigned line, void *data) {
+  snprintf(test_eini_max_depth_error, EINI_LONG, "%s:%u -- %s", path, line,
+           error);
+}
+
+// Include resolver function for `eini_ctx_max_depth()`. Make every file include
+// itself again, through a longer path every time.
+int test_eini_resolver_max_depth(const char *path, eini_span_t *contents,
+                                 void *data) {
+  __atomic_add_fetch(&test_eini_max_depth_calls, 1, __ATOMIC_RELAXED);
+  *contents = (eini_span_t){"[r]\nk=1\ninclude ./r.ini\n", 24};
+  return 1;
+}
+
+// Thread body for `test_eini_max_depth()`. Parse the root file with context
+// `arg`.
+void *test_eini_max_depth_thread(void *arg) {
+  eini_ctx_file(arg, test_eini_max_depth_path);
+  return NULL;
+}
+
+// Main test function
+void test_eini_max_depth() {
+  char dir[EINI_SHORT];     // temporary directory for the include chain
+  char name[EINI_SHORT];    // name of a generated file
+  char data[EINI_LONG];     // contents of a generated file
+  char expected[EINI_LONG]; // expected error
+  char cmd[EINI_LONG];      // command to remove `dir`
+  eini_ctx_t *ctx;          // context
+  eini_cache_t *cache;      // cache
+  pthread_attr_t attr;      // attributes of `thr`
+  pthread_t thr;            // thread with a small stack
+  const unsigned n = 2000;  // length of the include chain
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  for (unsigned i = 0; i < n; i++) {
+    snprintf(name, EINI_SHORT, "d%04u.ini", i);
+    snprintf(data, EINI_LONG, "[d]\nk=%u\n", i);
+    if (i + 1 < n)
+      snprintf(&data[strlen(data)], EINI_SHORT, "include d%04u.ini\n", i + 1);
+    test_eini_threads_file(dir, name, data);
+  }
+  snprintf(test_eini_max_depth_path, EINI_LONG, "%s/d0000.ini", dir);
+  snprintf(expected, EINI_LONG,
+           "%s/d%04u.ini:3 -- Inclusion of '%s/d%04u.ini' nested too deeply",
+           dir, EINI_MAX_DEPTH, dir, EINI_MAX_DEPTH + 1);
+  ctx = eini_ctx_new();
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_max_depth,
+                         test_eini_error_max_depth, NULL);
+
+  // The default maximum depth is enforced, both serially and in parallel
+  test_eini_max_depth_n = 0;
+  eini_ctx_file(ctx, test_eini_max_depth_path);
+  CU_ASSERT_EQUAL(test_eini_max_depth_n, EINI_MAX_DEPTH + 1);
+  CU_ASSERT_STRING_EQUAL(test_eini_max_depth_error, expected);
+  test_eini_max_depth_n = 0;
+  test_eini_max_depth_error[0] = '\0';
+  eini_ctx_threads(ctx, 4);
+  eini_ctx_file(ctx, test_eini_max_depth_path);
+  CU_ASSERT_EQUAL(test_eini_max_depth_n, EINI_MAX_DEPTH + 1);
+  CU_ASSERT_STRING_EQUAL(test_eini_max_depth_error, expected);
+
+  // Deep include chains don't need a deep stack
+  eini_ctx_max_depth(ctx, n);
+  for (unsigned threads = 0; threads <= 4; threads += 4) {
+    test_eini_max_depth_n = 0;
+    eini_ctx_threads(ctx, threads);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    CU_ASSERT_EQUAL(pthread_create(&thr, &attr, test_eini_max_depth_thread,
+                                   ctx),
+                    0);
+    pthread_join(thr, NULL);
+    pthread_attr_destroy(&attr);
+    CU_ASSERT_EQUAL(test_eini_max_depth_n, n);
+  }
+
+  // Includes past the maximum depth aren't parsed in parallel or with a cache
+  // either, even if they never end (here, a file made up by the resolver
+  // includes itself, through a longer path every time)
+  test_eini_threads_file(dir, "r.ini", "[r]\nk=0\ninclude ./r.ini\n");
+  snprintf(test_eini_max_depth_path, EINI_LONG, "%s/r.ini", dir);
+  eini_ctx_max_depth(ctx, 8);
+  eini_ctx_resolver(ctx, test_eini_resolver_max_depth, NULL);
+  cache = eini_cache_new(false);
+  for (unsigned i = 0; i < 3; i++) {
+    test_eini_max_depth_n = 0;
+    test_eini_max_depth_calls = 0;
+    eini_ctx_threads(ctx, 1 == i ? 4 : 0);
+    eini_ctx_cache(ctx, 2 == i ? cache : NULL);
+    eini_ctx_file(ctx, test_eini_max_depth_path);
+    CU_ASSERT_EQUAL(test_eini_max_depth_n, 9);
+    CU_ASSERT_EQUAL(test_eini_max_depth_calls, 9);
+    if (0 == i)
+      strlcpy(expected, test_eini_max_depth_error, EINI_LONG);
+    CU_ASSERT_STRING_EQUAL(test_eini_max_depth_error, expected);
+  }
+  CU_ASSERT_PTR_NOT_NULL(strstr(expected, "nested too deeply"));
+  eini_ctx_cache(ctx, NULL);
+  eini_cache_free(cache);
+
+  eini_ctx_free(ctx);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for `eini_ctx_handlers_batch()`
+
+unsigned test_eini_batch_calls; // number of calls to the batch handler
+bool test_eini_batch_ok;        // false if a batch was too large
+
+// Batch handler function for `eini_ctx_handlers_batch()`. Store each key/value
+// pair just as `test_eini_handler_utf8()` would.
+void test_eini_handler_batch(const eini_batch_entry_t *entries,
+                             unsigned nentries, const eini_span_t *sections,
+                             const char *const *paths, void *data) {
+  test_eini_batch_calls++;
+  if (0 == nentries || nentries > 8)
+    test_eini_batch_ok = false;
+  for (unsigned i = 0; i < nentries; i++) {
+    const eini_batch_entry_t *e = &entries[i]; // current entry
+    if (e->key.len != strlen(e->key.ptr) ||
+        e->value.len != strlen(e->value.ptr))
+      test_eini_batch_ok = false;
+    test_eini_handler_utf8(sections[e->section].ptr, e->key.ptr, e->value.ptr,
+                           paths[e->path], e->line, data);
+  }
+}
+
+// Main test function
+void test_eini_batch() {
+  char dir[EINI_SHORT];     // temporary directory
+  char path[EINI_LONG];     // path of the root file
+  char data[8 * EINI_LONG]; // contents of a generated file
+  char line[EINI_SHORT];    // line of `data`
+  char cmd[EINI_LONG];      // command to remove `dir`
+  eini_ctx_t *ctx;          // context
+  unsigned n;               // number of results of per-key parsing
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  strlcpy(data, "[s1]\n", sizeof(data));
+  for (unsigned i = 0; i < 30; i++) {
+    snprintf(line, EINI_SHORT, "k%u = 'v\\t%u'\n", i, i);
+    strlcat(data, line, sizeof(data));
+  }
+  strlcat(data, "include inc.ini\n[s2]\n", sizeof(data));
+  for (unsigned i = 0; i < 30; i++) {
+    snprintf(line, EINI_SHORT, "k%u=%u\n", i, i);
+    strlcat(data, line, sizeof(data));
+  }
+  test_eini_threads_file(dir, "main.ini", data);
+  strlcpy(data, "[inc]\n", sizeof(data));
+  for (unsigned i = 0; i < 20; i++) {
+    snprintf(line, EINI_SHORT, "i%u=%u\n", i, i);
+    strlcat(data, line, sizeof(data));
+  }
+  strlcat(data, "oops\n", sizeof(data));
+  test_eini_threads_file(dir, "inc.ini", data);
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  ctx = eini_ctx_new();
+
+  // Batches hold the same key/value pairs (and errors come in the same place)
+  // as separate calls, serially and in parallel, with or without mapping
+  for (unsigned threads = 0; threads <= 4; threads += 4) {
+    for (unsigned map = 0; map <= 1; map++) {
+      test_eini_output_i = 0;
+      eini_ctx_threads(ctx, threads);
+      eini_ctx_mmap(ctx, map);
+      eini_ctx_handlers_utf8(ctx, test_eini_handler_utf8, test_eini_error_utf8,
+                             "batch");
+      eini_ctx_file(ctx, path);
+      n = test_eini_output_i;
+      CU_ASSERT_EQUAL(n, 81);
+      test_eini_batch_calls = 0;
+      test_eini_batch_ok = true;
+      eini_ctx_handlers_batch(ctx, test_eini_handler_batch,
+                              test_eini_error_utf8, 8, "batch");
+      eini_ctx_file(ctx, path);
+      CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+      for (unsigned i = 0; i < n && i + n < test_eini_output_i; i++)
+        CU_ASSERT(0 == wcscmp(test_eini_output[i], test_eini_output[i + n]));
+      CU_ASSERT(test_eini_batch_ok);
+      CU_ASSERT(test_eini_batch_calls >= 80 / 8);
+      CU_ASSERT(test_eini_batch_calls < 80 / 4);
+      for (unsigned i = 0; i < test_eini_output_i; i++)
+        free(test_eini_output[i]);
+    }
+  }
+
+  eini_ctx_free(ctx);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for `eini_schema_*()` and `eini_ctx_handlers_schema()`
+
+unsigned test_eini_schema_n;  // number of calls to the schema handler
+bool test_eini_schema_ok;     // false if a key/value pair got the wrong ids
+
+// Schema handler function for `eini_ctx_handlers_schema()`. Values are the ids
+// their keys are expected to get.
+void test_eini_handler_schema(unsigned section, unsigned key, eini_span_t value,
+                              const char *path, const unsigned line,
+                              void *data) {
+  test_eini_schema_n++;
+  if (key != strtoul(value.ptr, NULL, 10) || section != key / 100)
+    test_eini_schema_ok = false;
+}
+
+// Main test function
+void test_eini_schema() {
+  eini_schema_key_t keys[1000];   // 100 keys in each of 10 sections
+  char names[1000][EINI_SHORT];   // section and key names of `keys`
+  char dir[EINI_SHORT];           // temporary directory
+  char path[EINI_LONG];           // path of the root file
+  char *data = malloc(64 * 1024); // contents of the root file
+  char line[EINI_SHORT];          // line of `data`
+  char cmd[EINI_LONG];            // command to remove `dir`
+  eini_schema_t *schema;          // schema
+  eini_schema_t *imported;        // schema, out of the tables of `schema`
+  eini_schema_tables_t tables;    // tables of `schema`, from another version
+  eini_ctx_t *ctx;                // context
+
+  for (unsigned i = 0; i < 1000; i++) {
+    snprintf(names[i], EINI_SHORT, "s%u%ck%u", i / 100, '\0', i % 100);
+    keys[i].section = names[i];
+    keys[i].key = &names[i][strlen(names[i]) + 1];
+  }
+
+  // Keys can't be repeated in a section
+  keys[1].key = keys[0].key;
+  CU_ASSERT_PTR_NULL(eini_schema_new(keys, 1000));
+  keys[1].key = &names[1][strlen(names[1]) + 1];
+
+  // Every section and key is found, and nothing else is
+  schema = eini_schema_new(keys, 1000);
+  CU_ASSERT_PTR_NOT_NULL(schema);
+  if (NULL == schema)
+    return;
+  for (unsigned i = 0; i < 1000; i++) {
+    CU_ASSERT_EQUAL(eini_schema_section(schema, keys[i].section), i / 100);
+    CU_ASSERT_EQUAL(eini_schema_key(schema, keys[i].section, keys[i].key), i);
+  }
+  CU_ASSERT_EQUAL(eini_schema_section(schema, "s10"), -1);
+  CU_ASSERT_EQUAL(eini_schema_section(schema, ""), -1);
+  CU_ASSERT_EQUAL(eini_schema_key(schema, "s1", "k100"), -1);
+  CU_ASSERT_EQUAL(eini_schema_key(schema, "s10", "k0"), -1);
+
+  // An imported schema finds the same ids
+  imported = eini_schema_import(eini_schema_export(schema));
+  CU_ASSERT_PTR_NOT_NULL(imported);
+  if (NULL != imported) {
+    for (unsigned i = 0; i < 1000; i++)
+      CU_ASSERT_EQUAL(
+          eini_schema_key(imported, keys[i].section, keys[i].key), i);
+    CU_ASSERT_EQUAL(eini_schema_key(imported, "s1", "k100"), -1);
+    eini_schema_free(imported);
+  }
+
+  // Tables from another version of eINI aren't imported
+  tables = *eini_schema_export(schema);
+  tables.version++;
+  CU_ASSERT_PTR_NULL(eini_schema_import(&tables));
+
+  // Key/value pairs get the ids of their section and key, serially and in
+  // parallel, and those that aren't known are reported
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  data[0] = '\0';
+  for (unsigned i = 0; i < 1000; i++) {
+    if (0 == i % 100) {
+      snprintf(line, EINI_SHORT, "[%s]\n", keys[i].section);
+      strlcat(data, line, 64 * 1024);
+    }
+    snprintf(line, EINI_SHORT, "%s = %u\n", keys[i].key, i);
+    strlcat(data, line, 64 * 1024);
+  }
+  strlcat(data, "k100 = x\n[s10]\nk0 = x\n", 64 * 1024);
+  test_eini_threads_file(dir, "main.ini", data);
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  ctx = eini_ctx_new();
+  eini_ctx_handlers_schema(ctx, schema, test_eini_handler_schema,
+                           test_eini_error_utf8, "schema");
+  for (unsigned threads = 0; threads <= 4; threads += 4) {
+    test_eini_output_i = 0;
+    test_eini_schema_n = 0;
+    test_eini_schema_ok = true;
+    eini_ctx_threads(ctx, threads);
+    eini_ctx_file(ctx, path);
+    CU_ASSERT_EQUAL(test_eini_schema_n, 1000);
+    CU_ASSERT(test_eini_schema_ok);
+    CU_ASSERT_EQUAL(test_eini_output_i, 2);
+    if (2 == test_eini_output_i) {
+      swprintf((wchar_t *)data, EINI_LONG,
+               L"%s:1011 -- Unknown key 'k100' in section 's9' (schema)",
+               path);
+      CU_ASSERT(0 == wcscmp(test_eini_output[0], (wchar_t *)data));
+      swprintf((wchar_t *)data, EINI_LONG,
+               L"%s:1013 -- Unknown key 'k0' in section 's10' (schema)", path);
+      CU_ASSERT(0 == wcscmp(test_eini_output[1], (wchar_t *)data));
+    }
+    for (unsigned i = 0; i < test_eini_output_i; i++)
+      free(test_eini_output[i]);
+  }
+
+  eini_ctx_free(ctx);
+  eini_schema_free(schema);
+  free(data);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for parsers generated by `eini-gen` (see `tests_schema.ini`)
+
+// Main test function
+void test_eini_gen() {
+  char dir[EINI_SHORT];   // temporary directory
+  char path[EINI_LONG];   // path of the root file
+  char cmd[EINI_LONG];    // command to remove `dir`
+  wchar_t exp[EINI_LONG]; // expected error message
+  tests_schema_t cfg;     // configuration
+
+  // Options start with their default values
+  CU_ASSERT(tests_schema_defaults(&cfg));
+  CU_ASSERT_EQUAL(cfg.server.port, 8080);
+  CU_ASSERT_STRING_EQUAL(cfg.server.host, "localhost");
+  CU_ASSERT_EQUAL(cfg.server.timeout, 2.5);
+  CU_ASSERT_FALSE(cfg.server.verbose);
+  CU_ASSERT_EQUAL(cfg.log.level, 1);
+  CU_ASSERT_STRING_EQUAL(cfg.log.file, "");
+
+  // Values are converted and checked, and errors leave options alone
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  test_eini_threads_file(dir, "main.ini",
+                         "[server]\n"
+                         "port = 443\n"
+                         "host = 'example.org'\n"
+                         "timeout = 0.25\n"
+                         "verbose = Yes\n"
+                         "[log]\n"
+                         "level = 6\n"
+                         "file = /var/log/foo.log\n"
+                         "color = on\n");
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  test_eini_output_i = 0;
+  CU_ASSERT_FALSE(tests_schema_load(&cfg, path, test_eini_error_utf8, "gen"));
+  CU_ASSERT_EQUAL(cfg.server.port, 443);
+  CU_ASSERT_STRING_EQUAL(cfg.server.host, "example.org");
+  CU_ASSERT_EQUAL(cfg.server.timeout, 0.25);
+  CU_ASSERT_TRUE(cfg.server.verbose);
+  CU_ASSERT_EQUAL(cfg.log.level, 1);
+  CU_ASSERT_STRING_EQUAL(cfg.log.file, "/var/log/foo.log");
+  CU_ASSERT_EQUAL(test_eini_output_i, 2);
+  if (2 == test_eini_output_i) {
+    swprintf(exp, EINI_LONG,
+             L"%s:7 -- Invalid value '6' for key 'level' in section 'log' "
+             L"(gen)",
+             path);
+    CU_ASSERT(0 == wcscmp(test_eini_output[0], exp));
+    swprintf(exp, EINI_LONG,
+             L"%s:9 -- Unknown key 'color' in section 'log' (gen)", path);
+    CU_ASSERT(0 == wcscmp(test_eini_output[1], exp));
+  }
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+
+  tests_schema_free(&cfg);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for `eini_value_*()` and `eini_list_*()`
+
+// Return `str` as a span
+eini_span_t test_eini_value_span(const char *str) {
+  eini_span_t span = {str, strlen(str)}; // return value
+
+  return span;
+}
+
+// Main test function
+void test_eini_value() {
+  int64_t i = 42;                 // integer
+  double d = 42;                  // number
+  bool b = false;                 // boolean
+  uint64_t u = 42;                // size
+  char number[200];               // number longer than 128 characters
+  char value[] = "a, b ,,c d,x";  // list (without its last character)
+  const char *items[] = {"a", "b", "", "c d", ""}; // items of `value`
+  eini_list_t list;               // iterator over `value`
+  eini_span_t item;               // item of `list`
+  unsigned n = 0;                 // number of items
+
+  // Integers
+  CU_ASSERT_PTR_NULL(eini_value_int(test_eini_value_span("-17"), &i));
+  CU_ASSERT_EQUAL(i, -17);
+  CU_ASSERT_PTR_NULL(
+      eini_value_int(test_eini_value_span("9223372036854775807"), &i));
+  CU_ASSERT_EQUAL(i, INT64_MAX);
+  CU_ASSERT_PTR_NULL(
+      eini_value_int(test_eini_value_span("-9223372036854775808"), &i));
+  CU_ASSERT_EQUAL(i, INT64_MIN);
+  CU_ASSERT_STRING_EQUAL(
+      eini_value_int(test_eini_value_span("9223372036854775808"), &i),
+      "Integer out of range");
+  CU_ASSERT_STRING_EQUAL(eini_value_int(test_eini_value_span("12a"), &i),
+                         "Invalid integer");
+  CU_ASSERT_PTR_NOT_NULL(eini_value_int(test_eini_value_span("-"), &i));
+  CU_ASSERT_PTR_NOT_NULL(eini_value_int(test_eini_value_span(""), &i));
+  CU_ASSERT_EQUAL(i, INT64_MIN);
+
+  // Numbers, whatever the locale
+  setlocale(LC_NUMERIC, "de_DE.UTF-8");
+  CU_ASSERT_PTR_NULL(eini_value_double(test_eini_value_span("2.5"), &d));
+  CU_ASSERT_EQUAL(d, 2.5);
+  CU_ASSERT_PTR_NULL(eini_value_double(test_eini_value_span("-.125e3"), &d));
+  CU_ASSERT_EQUAL(d, -125);
+  CU_ASSERT_PTR_NULL(eini_value_double(test_eini_value_span("0.1"), &d));
+  CU_ASSERT_EQUAL(d, 0.1);
+  CU_ASSERT_PTR_NULL(
+      eini_value_double(test_eini_value_span("3.14159265358979323846264"), &d));
+  CU_ASSERT_EQUAL(d, 3.14159265358979323846264);
+  memset(number, '0', sizeof(number) - 1);
+  memcpy(number, "0.", 2);
+  memcpy(&number[sizeof(number) - 6], "15e-7", 5);
+  number[sizeof(number) - 1] = '\0';
+  CU_ASSERT_PTR_NULL(eini_value_double(test_eini_value_span(number), &d));
+  CU_ASSERT_EQUAL(d, 1.5e-200);
+  CU_ASSERT_PTR_NULL(eini_value_double(test_eini_value_span("1.5e-300"), &d));
+  CU_ASSERT_EQUAL(d, 1.5e-300);
+  setlocale(LC_NUMERIC, "C");
+  CU_ASSERT_STRING_EQUAL(eini_value_double(test_eini_value_span("1e400"), &d),
+                         "Number out of range");
+  CU_ASSERT_STRING_EQUAL(eini_value_double(test_eini_value_span("1,5"), &d),
+                         "Invalid number");
+  CU_ASSERT_PTR_NOT_NULL(eini_value_double(test_eini_value_span("."), &d));
+  CU_ASSERT_PTR_NOT_NULL(eini_value_double(test_eini_value_span("1e"), &d));
+  CU_ASSERT_PTR_NOT_NULL(eini_value_double(test_eini_value_span("nan"), &d));
+  CU_ASSERT_EQUAL(d, 1.5e-300);
+
+  // Booleans
+  CU_ASSERT_PTR_NULL(eini_value_bool(test_eini_value_span("YES"), &b));
+  CU_ASSERT_TRUE(b);
+  CU_ASSERT_PTR_NULL(eini_value_bool(test_eini_value_span("Off"), &b));
+  CU_ASSERT_FALSE(b);
+  CU_ASSERT_STRING_EQUAL(eini_value_bool(test_eini_value_span("yess"), &b),
+                         "Invalid boolean");
+
+  // Durations
+  CU_ASSERT_PTR_NULL(eini_value_duration(test_eini_value_span("1h30m"), &i));
+  CU_ASSERT_EQUAL(i, 5400 * 1000000000LL);
+  CU_ASSERT_PTR_NULL(
+      eini_value_duration(test_eini_value_span("1.5s 250us"), &i));
+  CU_ASSERT_EQUAL(i, 1500250000LL);
+  CU_ASSERT_PTR_NULL(eini_value_duration(test_eini_value_span("2"), &i));
+  CU_ASSERT_EQUAL(i, 2000000000LL);
+  CU_ASSERT_STRING_EQUAL(eini_value_duration(test_eini_value_span("1h 30"), &i),
+                         "Invalid duration");
+  CU_ASSERT_STRING_EQUAL(eini_value_duration(test_eini_value_span("5w"), &i),
+                         "Invalid duration");
+  CU_ASSERT_STRING_EQUAL(eini_value_duration(test_eini_value_span("300y"), &i),
+                         "Invalid duration");
+  CU_ASSERT_STRING_EQUAL(
+      eini_value_duration(test_eini_value_span("200000d"), &i),
+      "Duration out of range");
+
+  // Sizes
+  CU_ASSERT_PTR_NULL(eini_value_size(test_eini_value_span("512"), &u));
+  CU_ASSERT_EQUAL(u, 512);
+  CU_ASSERT_PTR_NULL(eini_value_size(test_eini_value_span("4k"), &u));
+  CU_ASSERT_EQUAL(u, 4096);
+  CU_ASSERT_PTR_NULL(eini_value_size(test_eini_value_span("1.5 GiB"), &u));
+  CU_ASSERT_EQUAL(u, 3ULL << 29);
+  CU_ASSERT_PTR_NULL(eini_value_size(test_eini_value_span("16MB"), &u));
+  CU_ASSERT_EQUAL(u, 16ULL << 20);
+  CU_ASSERT_STRING_EQUAL(eini_value_size(test_eini_value_span("1.5"), &u),
+                         "Invalid size");
+  CU_ASSERT_STRING_EQUAL(eini_value_size(test_eini_value_span("2X"), &u),
+                         "Invalid size");
+  CU_ASSERT_STRING_EQUAL(eini_value_size(test_eini_value_span("16384P"), &u),
+                         "Size out of range");
+  CU_ASSERT_EQUAL(u, 16ULL << 20);
+
+  // Lists are split in place
+  eini_list_init(&list, (eini_span_t){value, strlen(value) - 1});
+  while (eini_list_next(&list, &item)) {
+    CU_ASSERT(n < 5);
+    if (n < 5) {
+      CU_ASSERT_EQUAL(item.len, strlen(items[n]));
+      CU_ASSERT(0 == strncmp(item.ptr, items[n], item.len));
+      CU_ASSERT(item.ptr >= value && item.ptr + item.len <= value + 11);
+    }
+    n++;
+  }
+  CU_ASSERT_EQUAL(n, 5);
+  eini_list_init(&list, test_eini_value_span(""));
+  CU_ASSERT_FALSE(eini_list_next(&list, &item));
+}
+
+// Tests for reading .ini files from pipes (see `eini_ctx_fd()`)
+
+unsigned test_eini_pipe_n;    // number of key/value pairs found
+bool test_eini_pipe_ok;       // false if a key/value pair was mangled
+unsigned test_eini_pipe_line; // line of the last error
+
+// Thread function for `eini_ctx_fd()`. Write a large .ini file into pipe `fd`,
+// with a line longer than a chunk, and no newline at the end.
+void *test_eini_pipe_writer(void *fd) {
+  FILE *fp = fdopen(*(int *)fd, "w"); // write end of the pipe
+
+  fprintf(fp, "[s]\nlong = ");
+  for (unsigned i = 0; i < 100000; i++)
+    fputc('a' + i % 26, fp);
+  for (unsigned i = 0; i < 20000; i++)
+    fprintf(fp, "\nk%u = v%u", i, i);
+  fclose(fp);
+  return NULL;
+}
+
+// Span handler function for `eini_ctx_fd()`. Check that values match keys.
+void test_eini_handler_pipe(eini_span_t section, eini_span_t key,
+                            eini_span_t value, const char *path,
+                            const unsigned line, void *data) {
+  test_eini_pipe_n++;
+  if (4 == key.len && 0 == memcmp(key.ptr, "long", 4))
+    test_eini_pipe_ok = test_eini_pipe_ok && 100000 == value.len &&
+                        'z' == value.ptr[25] && 'd' == value.ptr[99999];
+  else
+    test_eini_pipe_ok = test_eini_pipe_ok && key.len == value.len &&
+                        0 == memcmp(key.ptr + 1, value.ptr + 1, key.len - 1) &&
+                        line == strtoul(key.ptr + 1, NULL, 10) + 3;
+}
+
+// UTF-8 error function for `eini_ctx_fd()`. Remember the line.
+void test_eini_error_pipe(const char *error, const char *path,
+                          const unsigned line, void *data) {
+  test_eini_pipe_line = line;
+}
+
+// Main test function
+void test_eini_pipe() {
+  eini_ctx_t *ctx = eini_ctx_new(); // context
+  pthread_t thr;                    // writer thread
+  int fds[2];                       // pipe
+
+  eini_ctx_handlers_span(ctx, test_eini_handler_pipe, test_eini_error_pipe,
+                         NULL);
+
+  // Lines are found across chunks, even without a newline at the end, both
+  // with and without mapping enabled (pipes can't be mapped)
+  for (unsigned map = 0; map <= 1; map++) {
+    test_eini_pipe_n = 0;
+    test_eini_pipe_ok = true;
+    test_eini_pipe_line = 0;
+    CU_ASSERT_EQUAL(pipe(fds), 0);
+    pthread_create(&thr, NULL, test_eini_pipe_writer, &fds[1]);
+    eini_ctx_mmap(ctx, map);
+    eini_ctx_fd(ctx, fds[0], "pipe");
+    pthread_join(thr, NULL);
+    close(fds[0]);
+    CU_ASSERT_EQUAL(test_eini_pipe_n, 20001);
+    CU_ASSERT(test_eini_pipe_ok);
+    CU_ASSERT_EQUAL(test_eini_pipe_line, 0);
+  }
+
+  // Lines that are too long are found without reading all of them (and the
+  // writer finds the pipe closed)
+  signal(SIGPIPE, SIG_IGN);
+  test_eini_pipe_n = 0;
+  eini_ctx_max_line(ctx, 1000);
+  CU_ASSERT_EQUAL(pipe(fds), 0);
+  pthread_create(&thr, NULL, test_eini_pipe_writer, &fds[1]);
+  eini_ctx_fd(ctx, fds[0], "pipe");
+  close(fds[0]);
+  pthread_join(thr, NULL);
+  CU_ASSERT_EQUAL(test_eini_pipe_n, 0);
+  CU_ASSERT_EQUAL(test_eini_pipe_line, 2);
+
+  eini_ctx_free(ctx);
+}
+
+// Tests for `eini_async_*()`
+
+// Completion handler function for `eini_async_wait()`. Copy the path into
+// `data`.
+void test_eini_async_done(const char *path, void *data) {
+  strlcpy(data, path, EINI_LONG);
+}
+
+// Main test function
+void test_eini_async() {
+  char dir[EINI_SHORT]; // temporary directory for the include tree
+  char path[EINI_LONG]; // path of the root file
+  char done[EINI_LONG]; // path passed to `test_eini_async_done()`
+  char cmd[EINI_LONG];  // command to remove `dir`
+  eini_ctx_t *ctx;      // context
+  eini_cache_t *cache;  // cache
+  eini_async_t *async;  // parse
+  struct pollfd pfd;    // `eini_async_fd()`, for `poll()`
+  unsigned n;           // number of results of serial parsing
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  test_eini_threads_file(dir, "main.ini",
+                         "[main]\na=1\ninclude frag.ini\nb=2\n"
+                         "include missing.ini\nc=never\n");
+  test_eini_threads_file(dir, "frag.ini", "[frag]\nx=one\nbad line\n");
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  ctx = eini_ctx_new();
+  cache = eini_cache_new(false);
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_utf8, test_eini_error_utf8,
+                         "async");
+  test_eini_output_i = 0;
+  eini_ctx_file(ctx, path);
+  n = test_eini_output_i;
+  CU_ASSERT_EQUAL(n, 5);
+
+  // Parsing in the background gives the same results as parsing serially,
+  // with or without worker threads and a cache, once the file descriptor is
+  // readable
+  for (unsigned i = 0; i < 3; i++) {
+    eini_ctx_threads(ctx, 1 == i ? 3 : 0);
+    eini_ctx_cache(ctx, 2 == i ? cache : NULL);
+    test_eini_output_i = n;
+    done[0] = '\0';
+    async = eini_async_new(ctx, path);
+    CU_ASSERT_PTR_NOT_NULL(async);
+    if (NULL == async)
+      continue;
+    pfd = (struct pollfd){eini_async_fd(async), POLLIN, 0};
+    CU_ASSERT_EQUAL(poll(&pfd, 1, -1), 1);
+    CU_ASSERT_EQUAL(test_eini_output_i, n);
+    CU_ASSERT_EQUAL(eini_async_wait(async, 0, test_eini_async_done, done), 1);
+    CU_ASSERT_STRING_EQUAL(done, path);
+    CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+    for (unsigned j = 0; j < n && j + n < test_eini_output_i; j++)
+      CU_ASSERT(0 == wcscmp(test_eini_output[j], test_eini_output[j + n]));
+    for (unsigned j = n; j < test_eini_output_i; j++)
+      free(test_eini_output[j]);
+
+    // Results are only passed once
+    CU_ASSERT_EQUAL(eini_async_wait(async, 0, test_eini_async_done, done), -1);
+    eini_async_free(async);
+  }
+
+  // Waiting without polling first works, and so does freeing a parse without
+  // waiting for it (in which case its results are dropped)
+  test_eini_output_i = n;
+  async = eini_async_new(ctx, path);
+  CU_ASSERT_EQUAL(eini_async_wait(async, -1, NULL, NULL), 1);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+  eini_async_free(async);
+  eini_async_free(eini_async_new(ctx, path));
+  CU_ASSERT_EQUAL(test_eini_output_i, 2 * n);
+  for (unsigned j = 0; j < test_eini_output_i; j++)
+    free(test_eini_output[j]);
+
+  eini_ctx_free(ctx);
+  eini_cache_free(cache);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for `eini_arena_*()` and `eini_ctx_arena()`
+
+const char *test_eini_arena_output[16]; // `test_eini_handler_arena()` and
+                                        // `test_eini_error_arena()` store the
+                                        // strings they are passed in here
+unsigned test_eini_arena_output_i;      // index for `test_eini_arena_output`
+
+// UTF-8 handler function for `eini_ctx_arena()`. Keep the strings, without
+// copying them.
+void test_eini_handler_arena(const char *section, const char *key,
+                             const char *value, const char *path,
+                             const unsigned line, void *data) {
+  test_eini_arena_output[test_eini_arena_output_i++] = section;
+  test_eini_arena_output[test_eini_arena_output_i++] = key;
+  test_eini_arena_output[test_eini_arena_output_i++] = value;
+}
+
+// UTF-8 error function for `eini_ctx_arena()`. Keep the error message, without
+// copying it.
+void test_eini_error_arena(const char *error, const char *path,
+                           const unsigned line, void *data) {
+  test_eini_arena_output[test_eini_arena_output_i++] = error;
+}
+
+// Main test function
+void test_eini_arena() {
+  eini_arena_t *arena;    // arena
+  eini_ctx_t *ctx;        // context
+  eini_utf8_t parsed;     // return value of `eini_ctx_parse_utf8()`
+  char *long_value;       // a value longer than `EINI_LONG`
+  char *p;                // return value of `eini_arena_alloc()`
+  char *data = "[a]\n"
+               "x='one\\ttwo'\n"
+               "[b]\n"
+               "y=2\n"
+               "yadayada bah poo\n"; // test data
+
+  arena = eini_arena_new();
+  CU_ASSERT_PTR_NOT_NULL(arena);
+  p = eini_arena_alloc(arena, 3);
+  CU_ASSERT_PTR_NOT_NULL(p);
+  CU_ASSERT_EQUAL((size_t)p % _Alignof(max_align_t), 0);
+  p = eini_arena_alloc(arena, 1);
+  CU_ASSERT_EQUAL((size_t)p % _Alignof(max_align_t), 0);
+  p = eini_arena_alloc(arena, 4 * EINI_ARENA_BLOCK);
+  CU_ASSERT_PTR_NOT_NULL(p);
+  memset(p, 'x', 4 * EINI_ARENA_BLOCK);
+  CU_ASSERT(0 == strcmp(eini_arena_strndup(arena, "abcdef", 3), "abc"));
+  eini_arena_reset(arena);
+
+  // Strings outlive the lines they came from
+  test_eini_arena_output_i = 0;
+  ctx = eini_ctx_new();
+  eini_ctx_arena(ctx, arena);
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_arena, test_eini_error_arena,
+                         NULL);
+  eini_ctx_buffer(ctx, data, strlen(data), "arena.ini");
+  CU_ASSERT_EQUAL(test_eini_arena_output_i, 7);
+  CU_ASSERT(0 == strcmp(test_eini_arena_output[0], "a"));
+  CU_ASSERT(0 == strcmp(test_eini_arena_output[1], "x"));
+  CU_ASSERT(0 == strcmp(test_eini_arena_output[2], "one\ttwo"));
+  CU_ASSERT(0 == strcmp(test_eini_arena_output[3], "b"));
+  CU_ASSERT(0 == strcmp(test_eini_arena_output[4], "y"));
+  CU_ASSERT(0 == strcmp(test_eini_arena_output[5], "2"));
+  CU_ASSERT(0 == strcmp(test_eini_arena_output[6],
+                        "Unable to parse 'yadayada bah poo'"));
+
+  // Values aren't truncated
+  long_value = calloc(4 * EINI_LONG, sizeof(char));
+  strlcpy(long_value, "k=", 4 * EINI_LONG);
+  memset(&long_value[2], 'v', 3 * EINI_LONG);
+  parsed = eini_ctx_parse_utf8(ctx, long_value);
+  CU_ASSERT_EQUAL(parsed.type, EINI_VALUE);
+  CU_ASSERT_EQUAL(strlen(parsed.value), 3 * EINI_LONG);
+  free(long_value);
+
+  eini_ctx_free(ctx);
+  eini_arena_free(arena);
+}
+
+// Tests for `eini_store_*()`
+
+// Main test function
+void test_eini_store() {
+  char tpath[EINI_SHORT];    // path to a temporary config file
+  char key[EINI_SHORT];      // key to look up
+  FILE *tp;                  // file handler for `tpath`
+  eini_store_t *store;       // the store
+  const eini_entry_t *entry; // return value of `eini_store_get()`
+  bool ok = true;            // true if all lookups succeeded
+  char *data = "[section1]\n"
+               "opt1 = 'value #1'\n"
+               "opt2=value #2\n"
+               "[section2]\n"
+               "opt1=\"other\\tvalue\"\n"
+               "[section1]\n"
+               "opt1=overridden\n"; // test data
+
+  strlcpy(tpath, "testsXXXXXX", EINI_SHORT);
+  close(mkstemp(tpath));
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fwrite(data, sizeof(char), strlen(data), tp);
+  for (unsigned i = 0; i < 1000; i++)
+    fprintf(tp, "key%u=%u\n", i, i);
+  fprintf(tp, "yadayada bah poo\n");
+  fclose(tp);
+  test_eini_output_i = 0;
+
+  store = eini_store_new();
+  CU_ASSERT_PTR_NOT_NULL(store);
+  eini_store_load(store, tpath, test_eini_error_utf8, "store");
+  CU_ASSERT_EQUAL(test_eini_output_i, 1);
+  CU_ASSERT_EQUAL(eini_store_size(store), 1003);
+
+  entry = eini_store_get(store, "section1", "opt1");
+  CU_ASSERT_PTR_NOT_NULL(entry);
+  CU_ASSERT(0 == strcmp(entry->value, "overridden"));
+  CU_ASSERT(0 == strcmp(entry->path, tpath));
+  CU_ASSERT_EQUAL(entry->line, 7);
+  entry = eini_store_get(store, "section2", "opt1");
+  CU_ASSERT_PTR_NOT_NULL(entry);
+  CU_ASSERT(0 == strcmp(entry->value, "other\tvalue"));
+  CU_ASSERT_PTR_NULL(eini_store_get(store, "section2", "opt2"));
+  CU_ASSERT_PTR_NULL(eini_store_get(store, "section", "1opt1"));
+
+  entry = eini_store_at(store, 0);
+  CU_ASSERT(0 == strcmp(entry->key, "opt1"));
+  CU_ASSERT(0 == strcmp(entry->value, "overridden"));
+  entry = eini_store_at(store, 2);
+  CU_ASSERT(0 == strcmp(entry->section, "section2"));
+  CU_ASSERT_PTR_NULL(eini_store_at(store, 1003));
+
+  for (unsigned i = 0; i < 1000; i++) {
+    snprintf(key, EINI_SHORT, "key%u", i);
+    entry = eini_store_get(store, "section1", key);
+    if (NULL == entry || (unsigned)atoi(entry->value) != i ||
+        entry->line != i + 8)
+      ok = false;
+  }
+  CU_ASSERT(ok);
+
+  eini_store_free(store);
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+  unlink(tpath);
+}
+
+// Tests for `eini_cache_*()` and `eini_ctx_cache()`
+
+// Helper of `test_eini_cache()`. Overwrite file `name` in `dir` with `data`,
+// keeping its modification time (so that only its contents give it away).
+void test_eini_cache_sneak(const char *dir, const char *name,
+                           const char *data) {
+  char path[EINI_LONG]; // file path
+  struct stat st;       // file status
+  struct timespec t[2]; // access and modification times
+
+  snprintf(path, EINI_LONG, "%s/%s", dir, name);
+  CU_ASSERT_EQUAL(stat(path, &st), 0);
+  test_eini_threads_file(dir, name, data);
+  t[0] = st.st_atim;
+  t[1] = st.st_mtim;
+  CU_ASSERT_EQUAL(utimensat(AT_FDCWD, path, t, 0), 0);
+}
+
+// Helper of `test_eini_cache()`. Parse `path` with `ctx`, and return the
+// output, as a single string.
+wchar_t *test_eini_cache_parse(eini_ctx_t *ctx, const char *path) {
+  wchar_t *ret = calloc(4 * EINI_LONG, sizeof(wchar_t)); // return value
+
+  test_eini_output_i = 0;
+  eini_ctx_file(ctx, path);
+  for (unsigned i = 0; i < test_eini_output_i; i++) {
+    wcscat(ret, test_eini_output[i]);
+    wcscat(ret, L"\n");
+    free(test_eini_output[i]);
+  }
+
+  return ret;
+}
+
+// Main test function
+void test_eini_cache() {
+  char dir[EINI_SHORT];  // temporary directory for the include tree
+  char path[EINI_LONG];  // path of the root file
+  char cmd[EINI_LONG];   // command to remove `dir`
+  eini_ctx_t *ctx;       // context
+  eini_cache_t *cache;   // cache
+  eini_store_t *store;   // store
+  wchar_t *fresh, *out;  // output without and with a cache
+  wchar_t expected[EINI_LONG]; // expected result
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  test_eini_threads_file(dir, "main.ini",
+                         "[main]\na=1\ninclude f1.ini\ninclude f2.ini\n"
+                         "include f1.ini\nyadayada bah poo\n");
+  test_eini_threads_file(dir, "f1.ini", "[f1]\nx=1\n");
+  test_eini_threads_file(dir, "f2.ini", "[f2]\ny=1\n");
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  ctx = eini_ctx_new();
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_utf8, test_eini_error_utf8,
+                         "cache");
+
+  // A cached parse gives the same results as an uncached one, every time
+  fresh = test_eini_cache_parse(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 5);
+  cache = eini_cache_new(false);
+  eini_ctx_cache(ctx, cache);
+  for (unsigned i = 0; i < 3; i++) {
+    out = test_eini_cache_parse(ctx, path);
+    CU_ASSERT(0 == wcscmp(fresh, out));
+    free(out);
+  }
+  eini_ctx_threads(ctx, 3);
+  out = test_eini_cache_parse(ctx, path);
+  CU_ASSERT(0 == wcscmp(fresh, out));
+  free(out);
+  eini_ctx_threads(ctx, 0);
+  free(fresh);
+
+  // Changed files are parsed again; unchanged ones (as far as their status
+  // goes) are not
+  test_eini_cache_sneak(dir, "f1.ini", "[f1]\nx=2\n");
+  test_eini_threads_file(dir, "f2.ini", "[f2]\ny=22\n");
+  out = test_eini_cache_parse(ctx, path);
+  CU_ASSERT_PTR_NOT_NULL(wcsstr(out, L"f1.x=1 (cache)"));
+  CU_ASSERT_PTR_NULL(wcsstr(out, L"f1.x=2 (cache)"));
+  CU_ASSERT_PTR_NOT_NULL(wcsstr(out, L"f2.y=22 (cache)"));
+  free(out);
+
+  // Files that are no longer included are dropped
+  test_eini_threads_file(dir, "main.ini", "[main]\na=2\ninclude f2.ini\n");
+  out = test_eini_cache_parse(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2);
+  CU_ASSERT_PTR_NULL(wcsstr(out, L"f1."));
+  free(out);
+  eini_cache_free(cache);
+
+  // Changed files are always caught when hashing their contents
+  cache = eini_cache_new(true);
+  eini_ctx_cache(ctx, cache);
+  test_eini_threads_file(dir, "main.ini", "[main]\na=3\ninclude f1.ini\n");
+  free(test_eini_cache_parse(ctx, path));
+  test_eini_cache_sneak(dir, "f1.ini", "[f1]\nx=3\n");
+  out = test_eini_cache_parse(ctx, path);
+  CU_ASSERT_PTR_NOT_NULL(wcsstr(out, L"f1.x=3 (cache)"));
+  free(out);
+
+  // Every path of a file leads to the same record, so a file that includes
+  // itself through other paths is caught as a cycle, rather than parsed over
+  // and over again (by a store, too)
+  snprintf(path, EINI_LONG, "%s/cyc", dir);
+  mkdir(path, 0700);
+  test_eini_threads_file(dir, "cyc/a.ini",
+                         "[a]\nk=1\ninclude ./a.ini\ninclude ../cyc/a.ini\n");
+  snprintf(path, EINI_LONG, "%s/cyc/a.ini", dir);
+  eini_ctx_cache(ctx, NULL);
+  fresh = test_eini_cache_parse(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 2);
+  swprintf(expected, EINI_LONG,
+           L"%s/cyc/a.ini:3 -- Circular inclusion of '%s/cyc/./a.ini': "
+           L"'%s/cyc/a.ini' -> '%s/cyc/./a.ini' (cache)\n",
+           dir, dir, dir, dir);
+  CU_ASSERT_PTR_NOT_NULL(wcsstr(fresh, expected));
+  eini_ctx_cache(ctx, cache);
+  for (unsigned threads = 0; threads <= 4; threads += 4) {
+    eini_ctx_threads(ctx, threads);
+    out = test_eini_cache_parse(ctx, path);
+    CU_ASSERT(0 == wcscmp(fresh, out));
+    free(out);
+  }
+  eini_ctx_threads(ctx, 0);
+  free(fresh);
+  store = eini_store_new();
+  test_eini_output_i = 0;
+  eini_store_load(store, path, test_eini_error_utf8, "cache");
+  CU_ASSERT_EQUAL(test_eini_output_i, 1);
+  CU_ASSERT(test_eini_output_i > 0 &&
+            NULL != wcsstr(test_eini_output[0], L"Circular inclusion"));
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+  eini_store_free(store);
+
+  eini_ctx_free(ctx);
+  eini_cache_free(cache);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for quote and escape handling, when parsing serially, in parallel, and
+// from a cache
+void test_eini_quotes() {
+  char dir[EINI_SHORT];        // temporary directory for the .ini file
+  char path[EINI_LONG];        // path of the .ini file
+  char cmd[EINI_LONG];         // command to remove `dir`
+  wchar_t expected[EINI_LONG]; // expected result
+  eini_ctx_t *ctx;             // context
+  eini_cache_t *cache;         // cache
+  wchar_t *fresh, *out;        // output without and with records
+  const char *values[] = {"a=plain value", "b=it's", "c=tab\there",
+                          "d=ends with \\", "f=x",
+                          "g=semi ; colon"}; // expected key/value pairs
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  test_eini_threads_file(dir, "q.ini",
+                         "[q]\n"
+                         "a=\"plain value\" ; comment\n"
+                         "b='it\\'s'\n"
+                         "c=\"tab\\there\"\n"
+                         "d=\"ends with \\\\\" ; \"comment\n"
+                         "f=x ; \"not a quote\n"
+                         "g = \"semi ; colon\"\n"
+                         "e=\"escaped end\\\"\n"
+                         "h=never\n");
+  snprintf(path, EINI_LONG, "%s/q.ini", dir);
+  ctx = eini_ctx_new();
+  eini_ctx_handlers_utf8(ctx, test_eini_handler_utf8, test_eini_error_utf8,
+                         "quotes");
+
+  // Escaped quotes neither begin nor end strings, `;`s only begin comments
+  // outside of strings, and a value whose closing quote is escaped is
+  // unterminated
+  fresh = test_eini_cache_parse(ctx, path);
+  CU_ASSERT_EQUAL(test_eini_output_i, 7);
+  for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    swprintf(expected, EINI_LONG, L"%s:%u -- q.%s (quotes)\n", path, i + 2,
+             values[i]);
+    CU_ASSERT_PTR_NOT_NULL(wcsstr(fresh, expected));
+  }
+  swprintf(expected, EINI_LONG, L"%s:8 -- Non-terminated quote (quotes)\n",
+           path);
+  CU_ASSERT_PTR_NOT_NULL(wcsstr(fresh, expected));
+
+  // Records, parsed in parallel or kept in a cache, are replayed with the same
+  // results
+  eini_ctx_threads(ctx, 3);
+  out = test_eini_cache_parse(ctx, path);
+  CU_ASSERT(0 == wcscmp(fresh, out));
+  free(out);
+  eini_ctx_threads(ctx, 0);
+  cache = eini_cache_new(false);
+  eini_ctx_cache(ctx, cache);
+  for (unsigned i = 0; i < 2; i++) {
+    out = test_eini_cache_parse(ctx, path);
+    CU_ASSERT(0 == wcscmp(fresh, out));
+    free(out);
+  }
+  free(fresh);
+
+  // Values of a file that changed are unescaped again, instead of replayed
+  test_eini_threads_file(dir, "q.ini", "[q]\nc=\"new\\tvalue\"\n");
+  out = test_eini_cache_parse(ctx, path);
+  swprintf(expected, EINI_LONG, L"%s:2 -- q.c=new\tvalue (quotes)\n", path);
+  CU_ASSERT(0 == wcscmp(out, expected));
+  free(out);
+
+  eini_ctx_free(ctx);
+  eini_cache_free(cache);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+
+// Tests for `eini_store_reload()`
+
+// Change handler function for `eini_store_reload()`
+void test_eini_handler_change(eini_change_t change, const eini_entry_t *old,
+                              const eini_entry_t *cur, void *data) {
+  wchar_t *output = calloc(EINI_LONG, sizeof(wchar_t));
+  const eini_entry_t *e = NULL == cur ? old : cur; // entry to describe
+
+  swprintf(output, EINI_LONG, L"%c %s.%s=%s (line %u)",
+           "+-~"[change], e->section, e->key, e->value, e->line);
+  test_eini_output[test_eini_output_i++] = output;
+}
+
+// Helper of `test_eini_store_reload()`. Write the test file in `path`, with
+// `n` keys, skipping `skip`, giving `changed` a different value, and starting
+// with `pad` comment lines.
+void test_eini_store_reload_file(const char *path, unsigned n, unsigned skip,
+                                 unsigned changed, unsigned pad) {
+  FILE *tp = fopen(path, "w"); // file handler for `path`
+
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  for (unsigned i = 0; i < pad; i++)
+    fprintf(tp, "; padding\n");
+  fprintf(tp, "[s]\n");
+  for (unsigned i = 0; i < n; i++)
+    if (i != skip)
+      fprintf(tp, "key%u=%u\n", i, i == changed ? 0 : i);
+  fclose(tp);
+}
+
+// Main test function
+void test_eini_store_reload() {
+  char tpath[EINI_SHORT]; // path to a temporary config file
+  eini_store_t *store;    // the store
+
+  strlcpy(tpath, "testsXXXXXX", EINI_SHORT);
+  close(mkstemp(tpath));
+  store = eini_store_new();
+  CU_ASSERT_PTR_NOT_NULL(store);
+
+  // Everything is new at first
+  test_eini_store_reload_file(tpath, 200, -1, -1, 0);
+  test_eini_output_i = 0;
+  eini_store_reload(store, tpath, test_eini_handler_change,
+                    test_eini_error_utf8, "reload");
+  CU_ASSERT_EQUAL(test_eini_output_i, 200);
+  CU_ASSERT_EQUAL(eini_store_size(store), 200);
+  CU_ASSERT(0 == wcscmp(test_eini_output[0], L"+ s.key0=0 (line 2)"));
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+
+  // Nothing has changed
+  test_eini_output_i = 0;
+  eini_store_reload(store, tpath, test_eini_handler_change,
+                    test_eini_error_utf8, "reload");
+  CU_ASSERT_EQUAL(test_eini_output_i, 0);
+
+  // Only actual changes are reported (not moved lines)
+  test_eini_store_reload_file(tpath, 201, 10, 20, 3);
+  eini_store_reload(store, tpath, test_eini_handler_change,
+                    test_eini_error_utf8, "reload");
+  CU_ASSERT_EQUAL(test_eini_output_i, 3);
+  if (3 == test_eini_output_i) {
+    CU_ASSERT(0 == wcscmp(test_eini_output[0], L"- s.key10=10 (line 12)"));
+    CU_ASSERT(0 == wcscmp(test_eini_output[1], L"~ s.key20=0 (line 24)"));
+    CU_ASSERT(0 == wcscmp(test_eini_output[2], L"+ s.key200=200 (line 204)"));
+  }
+  for (unsigned i = 0; i < test_eini_output_i; i++)
+    free(test_eini_output[i]);
+  CU_ASSERT_EQUAL(eini_store_size(store), 200);
+  CU_ASSERT_PTR_NULL(eini_store_get(store, "s", "key10"));
+  CU_ASSERT(0 == strcmp(eini_store_get(store, "s", "key20")->value, "0"));
+  CU_ASSERT_EQUAL(eini_store_get(store, "s", "key20")->line, 24);
+
+  eini_store_free(store);
+  unlink(tpath);
+}
+
+// Tests for `eini_image_*()`
+
+// Main test function
+void test_eini_image() {
+  char tpath[EINI_SHORT];  // path to a temporary config file
+  char ipath[EINI_LONG];   // path to the image file
+  FILE *tp;                // file handler for `tpath`
+  eini_store_t *store;     // the store
+  eini_image_t image;      // the image
+  eini_entry_t e;          // a key/value pair from `image`
+  const eini_entry_t *se;  // the same key/value pair from `store`
+  bool ok = true;          // true if everything matched
+  char *copy;              // copy of the image, for corruption
+  size_t size;             // size of `copy`
+
+  strlcpy(tpath, "testsXXXXXX", EINI_SHORT);
+  close(mkstemp(tpath));
+  snprintf(ipath, EINI_LONG, "%s.img", tpath);
+  tp = fopen(tpath, "w");
+  CU_ASSERT_NOT_EQUAL(tp, NULL);
+  fprintf(tp, "[zeta]\nb=2\na=1\n[alpha]\nkey=\"x\\ty\"\n");
+  for (unsigned i = 0; i < 500; i++)
+    fprintf(tp, "[s%u]\nk%u=%u\n", i % 7, i, i);
+  fprintf(tp, "[zeta]\nb=overridden\n");
+  fclose(tp);
+  store = eini_store_new();
+  eini_store_load(store, tpath, NULL, NULL);
+  CU_ASSERT(eini_image_save(store, ipath));
+
+  // Everything in the store is in the image, and nothing else
+  CU_ASSERT(eini_image_open(&image, ipath));
+  CU_ASSERT_EQUAL(eini_image_size(&image), eini_store_size(store));
+  for (unsigned i = 0; i < eini_store_size(store); i++) {
+    se = eini_store_at(store, i);
+    if (!eini_image_get(&image, se->section, se->key, &e) ||
+        0 != strcmp(e.value, se->value) || 0 != strcmp(e.path, tpath) ||
+        e.line != se->line)
+      ok = false;
+  }
+  CU_ASSERT(ok);
+  CU_ASSERT(eini_image_get(&image, "zeta", "b", &e));
+  CU_ASSERT(0 == strcmp(e.value, "overridden"));
+  CU_ASSERT(eini_image_get(&image, "alpha", "key", &e));
+  CU_ASSERT(0 == strcmp(e.value, "x\ty"));
+  CU_ASSERT(eini_image_get(&image, "zeta", "a", &e));
+  CU_ASSERT_EQUAL(e.line, 3);
+  CU_ASSERT(!eini_image_get(&image, "zeta", "c", &e));
+  CU_ASSERT(!eini_image_get(&image, "s1", "k0", &e));
+
+  // Entries are sorted by section and key
+  CU_ASSERT(eini_image_at(&image, 0, &e));
+  CU_ASSERT(0 == strcmp(e.section, "alpha") && 0 == strcmp(e.key, "key"));
+  CU_ASSERT(eini_image_at(&image, 1, &e));
+  CU_ASSERT(0 == strcmp(e.section, "s0") && 0 == strcmp(e.key, "k0"));
+  CU_ASSERT(eini_image_at(&image, eini_image_size(&image) - 1, &e));
+  CU_ASSERT(0 == strcmp(e.section, "zeta") && 0 == strcmp(e.key, "b"));
+  CU_ASSERT(!eini_image_at(&image, eini_image_size(&image), &e));
+
+  // Corrupted or truncated images are rejected
+  size = image.size;
+  copy = malloc(size);
+  memcpy(copy, image.map, size);
+  eini_image_close(&image);
+  CU_ASSERT(eini_image_buffer(&image, copy, size));
+  CU_ASSERT(!eini_image_buffer(&image, copy, size - 1));
+  copy[4] ^= 1;
+  CU_ASSERT(!eini_image_buffer(&image, copy, size));
+  copy[4] ^= 1;
+  copy[size - 1] = 'x';
+  CU_ASSERT(!eini_image_buffer(&image, copy, size));
+  CU_ASSERT_EQUAL(eini_image_size(&image), 0);
+  CU_ASSERT(!eini_image_open(&image, tpath));
+  free(copy);
+
+  eini_store_free(store);
+  unlink(tpath);
+  unlink(ipath);
+}
+
+// Tests for `eini_watch_*()`
+
+#ifdef __linux__
+// Watch handler function for `eini_watch_wait()`
+void test_eini_handler_watch(const char *const *paths, unsigned npaths,
+                             void *data) {
+  for (unsigned i = 0; i < npaths; i++) {
+    wchar_t *output = calloc(EINI_LONG, sizeof(wchar_t));
+    swprintf(output, EINI_LONG, L"%s", strrchr(paths[i], '/') + 1);
+    test_eini_output[test_eini_output_i++] = output;
+  }
+}
+
+// Helper of `test_eini_watch()`. Wait for changes to the files of `watch`, and
+// check that exactly the files in `expected` (a space-separated list) changed.
+void test_eini_watch_expect(eini_watch_t *watch, const wchar_t *expected) {
+  wchar_t got[EINI_LONG] = L""; // changed files, as a space-separated list
+
+  test_eini_output_i = 0;
+  CU_ASSERT_EQUAL(eini_watch_wait(watch, 5000, test_eini_handler_watch, NULL),
+                  1);
+  for (unsigned i = 0; i < test_eini_output_i; i++) {
+    if (i > 0)
+      wcscat(got, L" ");
+    wcscat(got, test_eini_output[i]);
+    free(test_eini_output[i]);
+  }
+  CU_ASSERT(0 == wcscmp(got, expected));
+}
+
+// Main test function
+void test_eini_watch() {
+  char dir[EINI_SHORT]; // temporary directory for the include tree
+  char path[EINI_LONG]; // path of the root file
+  char cmd[EINI_LONG];  // command to remove `dir`
+  eini_watch_t *watch;  // watcher
+
+  strlcpy(dir, "testsXXXXXX", EINI_SHORT);
+  CU_ASSERT_PTR_NOT_NULL(mkdtemp(dir));
+  test_eini_threads_file(dir, "main.ini",
+                         "[main]\ninclude a.ini\ninclude b.ini\n");
+  test_eini_threads_file(dir, "a.ini", "[a]\nx=1\ninclude c.ini\n");
+  test_eini_threads_file(dir, "c.ini", "[c]\ny=1\n");
+  test_eini_threads_file(dir, "other.ini", "[o]\nz=1\n");
+  snprintf(path, EINI_LONG, "%s/main.ini", dir);
+  watch = eini_watch_new(path, EINI_WATCH_DELAY);
+  CU_ASSERT_PTR_NOT_NULL(watch);
+  if (NULL == watch)
+    return;
+
+  // Every file reached through includes is watched, even if it's missing
+  CU_ASSERT_EQUAL(eini_watch_size(watch), 4);
+  CU_ASSERT(eini_watch_fd(watch) >= 0);
+
+  // Nothing happens when nothing changes, or when unrelated files change
+  test_eini_threads_file(dir, "other.ini", "[o]\nz=2\n");
+  CU_ASSERT_EQUAL(eini_watch_wait(watch, 200, test_eini_handler_watch, NULL),
+                  0);
+
+  // Changes to included files are reported, and bursts are coalesced
+  test_eini_threads_file(dir, "c.ini", "[c]\ny=2\n");
+  test_eini_threads_file(dir, "c.ini", "[c]\ny=3\n");
+  test_eini_threads_file(dir, "main.ini",
+                         "[main]\ninclude a.ini\ninclude b.ini\n\n");
+  test_eini_watch_expect(watch, L"main.ini c.ini");
+
+  // Files that appear are reported
+  test_eini_threads_file(dir, "b.ini", "[b]\nw=1\n");
+  test_eini_watch_expect(watch, L"b.ini");
+
+  // Files that are no longer included stop being watched
+  test_eini_threads_file(dir, "a.ini", "[a]\nx=2\n");
+  test_eini_watch_expect(watch, L"a.ini");
+  CU_ASSERT_EQUAL(eini_watch_size(watch), 3);
+  test_eini_threads_file(dir, "c.ini", "[c]\ny=4\n");
+  CU_ASSERT_EQUAL(eini_watch_wait(watch, 200, test_eini_handler_watch, NULL),
+                  0);
+
+  // Files that are removed are reported
+  snprintf(cmd, EINI_LONG, "%s/b.ini", dir);
+  unlink(cmd);
+  test_eini_watch_expect(watch, L"b.ini");
+
+  // Includes that follow a missing file are watched, and reported once they
+  // appear
+  test_eini_threads_file(dir, "main.ini",
+                         "[main]\ninclude a.ini\ninclude b.ini\n"
+                         "include d.ini\n");
+  test_eini_watch_expect(watch, L"main.ini");
+  CU_ASSERT_EQUAL(eini_watch_size(watch), 4);
+  test_eini_threads_file(dir, "d.ini", "[d]\nv=1\n");
+  test_eini_watch_expect(watch, L"d.ini");
+
+  // Includes that follow a syntax error are watched, before and after the
+  // error is fixed
+  test_eini_threads_file(dir, "a.ini", "[a\ninclude c.ini\n");
+  test_eini_watch_expect(watch, L"a.ini");
+  CU_ASSERT_EQUAL(eini_watch_size(watch), 5);
+  test_eini_threads_file(dir, "c.ini", "[c]\ny=5\n");
+  test_eini_watch_expect(watch, L"c.ini");
+  test_eini_threads_file(dir, "a.ini", "[a]\ninclude c.ini\n");
+  test_eini_watch_expect(watch, L"a.ini");
+  test_eini_threads_file(dir, "c.ini", "[c]\ny=6\n");
+  test_eini_watch_expect(watch, L"c.ini");
+
+  // Files in directories that don't exist yet are watched once they do, however
+  // deep they are, and wherever they're created from
+  test_eini_threads_file(dir, "main.ini", "[main]\ninclude sub/deep/e.ini\n");
+  test_eini_watch_expect(watch, L"main.ini");
+  snprintf(cmd, EINI_LONG, "%s/sub", dir);
+  mkdir(cmd, 0700);
+  CU_ASSERT_EQUAL(eini_watch_wait(watch, 200, test_eini_handler_watch, NULL),
+                  0);
+  snprintf(cmd, EINI_LONG, "%s/sub/deep", dir);
+  mkdir(cmd, 0700);
+  CU_ASSERT_EQUAL(eini_watch_wait(watch, 200, test_eini_handler_watch, NULL),
+                  0);
+  test_eini_threads_file(dir, "sub/deep/e.ini", "[e]\nu=1\n");
+  test_eini_watch_expect(watch, L"e.ini");
+
+  // Files whose directory goes away are reported, and still watched when it
+  // comes back (with the files already in it)
+  snprintf(cmd, EINI_LONG, "rm -rf %s/sub", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+  test_eini_watch_expect(watch, L"e.ini");
+  snprintf(cmd, EINI_LONG,
+           "mkdir -p %s/sub/deep && echo '[e]' > %s/sub/deep/e.ini", dir, dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+  test_eini_watch_expect(watch, L"e.ini");
+  CU_ASSERT_EQUAL(eini_watch_size(watch), 2);
+
+  eini_watch_free(watch);
+  snprintf(cmd, EINI_LONG, "rm -rf %s", dir);
+  CU_ASSERT_EQUAL(system(cmd), 0);
+}
+#endif
+
 // Where we hope it works
 int main(int argc, char **argv) {
   setlocale(LC_ALL, "");
@@ -368,7 +2387,32 @@ int main(int argc, char **argv) {
 
   // `add_test()` all your tests here
   add_test(eini_parse);
+  add_test(eini_parse_utf8);
   add_test(eini);
+  add_test(eini_span);
+  add_test(eini_buffer);
+  add_test(eini_ctx);
+  add_test(eini_arena);
+  add_test(eini_max_line);
+  add_test(eini_escapes);
+  add_test(eini_threads);
+  add_test(eini_include_once);
+  add_test(eini_include_open);
+  add_test(eini_max_depth);
+  add_test(eini_batch);
+  add_test(eini_schema);
+  add_test(eini_gen);
+  add_test(eini_value);
+  add_test(eini_pipe);
+  add_test(eini_async);
+  add_test(eini_store);
+  add_test(eini_cache);
+  add_test(eini_quotes);
+  add_test(eini_store_reload);
+  add_test(eini_image);
+#ifdef __linux__
+  add_test(eini_watch);
+#endif
 
   run_tests_and_exit();
 }